@@ -28,6 +28,7 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 #include <limits>
 #include <numeric>
 #include <string>
+#include <thread>
 #include <vector>
 
 #include "deepspeed_aio_common.h"
@@ -65,7 +66,11 @@ static void _get_aio_latencies(std::vector<std::chrono::duration<double>>& raw_l
     summary_latencies._min_usec = *(std::min_element(lat_usec.begin(), lat_usec.end()));
     summary_latencies._max_usec = *(std::max_element(lat_usec.begin(), lat_usec.end()));
     summary_latencies._avg_usec =
-        std::accumulate(lat_usec.begin(), lat_usec.end(), 0) / lat_usec.size();
+        std::accumulate(lat_usec.begin(), lat_usec.end(), 0.0) / lat_usec.size();
+
+    std::sort(lat_usec.begin(), lat_usec.end());
+    summary_latencies._p50_usec = lat_usec[(lat_usec.size() + 1) / 2 - 1];
+    summary_latencies._p99_usec = lat_usec[(lat_usec.size() * 99 + 99) / 100 - 1];
 }
 
 static void _do_io_submit_singles(const long long int n_iocbs,
@@ -126,11 +131,12 @@ static int _do_io_complete(const long long int min_completes,
     return n_completes;
 }
 
-void do_aio_operation_sequential(const bool read_op,
-                                 std::unique_ptr<aio_context>& aio_ctxt,
-                                 std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
-                                 deepspeed_aio_config_t* config,
-                                 deepspeed_aio_perf_t* perf)
+long long int do_aio_operation_sequential(const bool read_op,
+                                          std::unique_ptr<aio_context>& aio_ctxt,
+                                          std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
+                                          deepspeed_aio_config_t* config,
+                                          deepspeed_aio_perf_t* perf,
+                                          const io_preempt_fn_t& preempt)
 {
     struct io_prep_context prep_ctxt(read_op, xfer_ctxt, aio_ctxt->_block_size, &aio_ctxt->_iocbs);
 
@@ -147,6 +153,7 @@ void do_aio_operation_sequential(const bool read_op,
     const auto max_queue_bytes =
         static_cast<long long int>(aio_ctxt->_queue_depth * aio_ctxt->_block_size);
 
+    long long int completed_bytes = 0;
     auto start = std::chrono::high_resolution_clock::now();
     for (long long iocb_index = 0; iocb_index < num_io_blocks;
          iocb_index += aio_ctxt->_queue_depth) {
@@ -164,6 +171,8 @@ void do_aio_operation_sequential(const bool read_op,
         }
 
         _do_io_complete(n_iocbs, n_iocbs, aio_ctxt, reap_times);
+        completed_bytes += num_bytes;
+        if (preempt && preempt(completed_bytes)) { break; }
     }
     const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
 
@@ -188,13 +197,15 @@ void do_aio_operation_sequential(const bool read_op,
     std::cout << c_library_name << ": finish " << io_op_name << " " << xfer_ctxt->_num_bytes
               << " bytes " << std::endl;
 #endif
+    return completed_bytes;
 }
 
-void do_aio_operation_overlap(const bool read_op,
-                              std::unique_ptr<aio_context>& aio_ctxt,
-                              std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
-                              deepspeed_aio_config_t* config,
-                              deepspeed_aio_perf_t* perf)
+long long int do_aio_operation_overlap(const bool read_op,
+                                       std::unique_ptr<aio_context>& aio_ctxt,
+                                       std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
+                                       deepspeed_aio_config_t* config,
+                                       deepspeed_aio_perf_t* perf,
+                                       const io_preempt_fn_t& preempt)
 {
     struct io_prep_generator io_gen(read_op, xfer_ctxt, aio_ctxt->_block_size);
 
@@ -210,9 +221,12 @@ void do_aio_operation_overlap(const bool read_op,
     auto request_iocbs = aio_ctxt->_queue_depth;
     auto n_pending_iocbs = 0;
     const auto min_completes = 1;
+    long long int n_completed_iocbs = 0;
+    auto preempted = false;
     auto start = std::chrono::high_resolution_clock::now();
     while (true) {
-        const auto n_iocbs = io_gen.prep_iocbs(request_iocbs - n_pending_iocbs, &aio_ctxt->_iocbs);
+        const auto n_iocbs =
+            preempted ? 0 : io_gen.prep_iocbs(request_iocbs - n_pending_iocbs, &aio_ctxt->_iocbs);
         if (n_iocbs > 0) {
             if (config->_single_submit) {
                 _do_io_submit_singles(
@@ -231,6 +245,15 @@ void do_aio_operation_overlap(const bool read_op,
         const auto n_complete =
             _do_io_complete(min_completes, n_pending_iocbs, aio_ctxt, reap_times);
         n_pending_iocbs -= n_complete;
+        n_completed_iocbs += n_complete;
+
+        if (preempt && !preempted) {
+            // Only the last block may be short, so this overestimates by less than a block.
+            const auto completed_bytes = std::min(
+                n_completed_iocbs * static_cast<long long int>(aio_ctxt->_block_size),
+                xfer_ctxt->_num_bytes);
+            preempted = preempt(completed_bytes);
+        }
     }
 
     const std::chrono::duration<double> elapsed = std::chrono::high_resolution_clock::now() - start;
@@ -256,6 +279,57 @@ void do_aio_operation_overlap(const bool read_op,
     std::cout << c_library_name << ": finish " << io_op_name << " " << xfer_ctxt->_num_bytes
               << " bytes " << std::endl;
 #endif
+    return xfer_ctxt->_num_bytes - io_gen._remaining_bytes;
+}
+
+static void _do_aio_operation_slice(const bool read_op,
+                                    const int tid,
+                                    const int fd,
+                                    const void* buffer,
+                                    const long long int num_bytes,
+                                    deepspeed_aio_config_t* config,
+                                    deepspeed_aio_perf_t* perf)
+{
+    std::unique_ptr<aio_context> aio_ctxt(new aio_context(config->_block_size, config->_queue_depth));
+    std::unique_ptr<io_xfer_ctxt> xfer_ctxt(new io_xfer_ctxt(fd, num_bytes * tid, num_bytes, buffer));
+
+    if (config->_overlap_events) {
+        do_aio_operation_overlap(read_op, aio_ctxt, xfer_ctxt, config, perf);
+    } else {
+        do_aio_operation_sequential(read_op, aio_ctxt, xfer_ctxt, config, perf);
+    }
+}
+
+// Split num_bytes evenly across num_threads, each with its own aio context, and return the
+// end-to-end time in seconds. Thread i transfers bytes [i * slice, (i + 1) * slice) of the file.
+double do_parallel_aio_operation(const bool read_op,
+                                 const int fd,
+                                 const void* buffer,
+                                 const long long int num_bytes,
+                                 const int num_threads,
+                                 deepspeed_aio_config_t* config,
+                                 std::vector<deepspeed_aio_perf_t>* perfs)
+{
+    assert((num_bytes % num_threads) == 0);
+    const auto bytes_per_thread = num_bytes / num_threads;
+    if (perfs) { perfs->assign(num_threads, deepspeed_aio_perf_t()); }
+
+    const auto start_time = std::chrono::high_resolution_clock::now();
+    std::vector<std::thread> threads;
+    for (auto tid = 0; tid < num_threads; ++tid) {
+        threads.push_back(std::thread(_do_aio_operation_slice,
+                                      read_op,
+                                      tid,
+                                      fd,
+                                      buffer,
+                                      bytes_per_thread,
+                                      config,
+                                      perfs ? &perfs->at(tid) : nullptr));
+    }
+    for (auto& thr : threads) { thr.join(); }
+    const std::chrono::duration<double> elapsed =
+        std::chrono::high_resolution_clock::now() - start_time;
+    return elapsed.count();
 }
 
 void report_file_error(const char* filename, const std::string file_op, const int error_code)
@@ -265,9 +339,10 @@ void report_file_error(const char* filename, const std::string file_op, const in
     std::cerr << c_library_name << ":  " << err_msg << std::endl;
 }
 
-int open_file(const char* filename, const bool read_op)
+int open_file(const char* filename, const bool read_op, const bool o_direct)
 {
-    const int flags = read_op ? (O_RDONLY | O_DIRECT) : (O_WRONLY | O_CREAT | O_DIRECT);
+    const int direct_flag = o_direct ? O_DIRECT : 0;
+    const int flags = read_op ? (O_RDONLY | direct_flag) : (O_WRONLY | O_CREAT | direct_flag);
     const int mode = 0600;
     const auto fd = open(filename, flags, mode);
     if (fd == -1) {
@@ -7,26 +7,45 @@
 Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 */
 
+#pragma once
+
 #include <deepspeed_aio_utils.h>
 #include <stdlib.h>
+#include <functional>
 #include <memory>
 #include <string>
 
 using namespace std;
 
-void do_aio_operation_sequential(const bool read_op,
-                                 std::unique_ptr<aio_context>& aio_ctxt,
-                                 std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
+// Called with the number of bytes completed so far each time blocks are reaped. Returning true
+// stops further submissions: the operation returns once the blocks in flight complete.
+using io_preempt_fn_t = std::function<bool(const long long int)>;
+
+// Both return the number of bytes transferred, which is a prefix of the transfer and only falls
+// short of it when preempted.
+long long int do_aio_operation_sequential(const bool read_op,
+                                          std::unique_ptr<aio_context>& aio_ctxt,
+                                          std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
+                                          deepspeed_aio_config_t* config,
+                                          deepspeed_aio_perf_t* perf,
+                                          const io_preempt_fn_t& preempt = nullptr);
+
+long long int do_aio_operation_overlap(const bool read_op,
+                                       std::unique_ptr<aio_context>& aio_ctxt,
+                                       std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
+                                       deepspeed_aio_config_t* config,
+                                       deepspeed_aio_perf_t* perf,
+                                       const io_preempt_fn_t& preempt = nullptr);
+
+double do_parallel_aio_operation(const bool read_op,
+                                 const int fd,
+                                 const void* buffer,
+                                 const long long int num_bytes,
+                                 const int num_threads,
                                  deepspeed_aio_config_t* config,
-                                 deepspeed_aio_perf_t* perf);
-
-void do_aio_operation_overlap(const bool read_op,
-                              std::unique_ptr<aio_context>& aio_ctxt,
-                              std::unique_ptr<io_xfer_ctxt>& xfer_ctxt,
-                              deepspeed_aio_config_t* config,
-                              deepspeed_aio_perf_t* perf);
+                                 std::vector<deepspeed_aio_perf_t>* perfs);
 
-int open_file(const char* filename, const bool read_op);
+int open_file(const char* filename, const bool read_op, const bool o_direct = true);
 
 void report_file_error(const char* filename, const std::string file_op, const int error_code);
 
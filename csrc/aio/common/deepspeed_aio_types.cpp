@@ -40,7 +40,8 @@ deepspeed_aio_config_t::deepspeed_aio_config_t(const int block_size,
 
 void deepspeed_aio_latency_t::dump(const std::string tag)
 {
-    std::cout << tag << _min_usec << " " << _max_usec << " " << _avg_usec << " " << std::endl;
+    std::cout << tag << _min_usec << " " << _max_usec << " " << _avg_usec << " " << _p50_usec << " "
+              << _p99_usec << " " << std::endl;
 }
 
 void deepspeed_aio_latency_t::accumulate(const struct deepspeed_aio_latency_t& other)
@@ -48,6 +49,8 @@ void deepspeed_aio_latency_t::accumulate(const struct deepspeed_aio_latency_t& o
     _min_usec += other._min_usec;
     _max_usec += other._max_usec;
     _avg_usec += other._avg_usec;
+    _p50_usec += other._p50_usec;
+    _p99_usec += other._p99_usec;
 }
 
 void deepspeed_aio_latency_t::scale(const float scaler)
@@ -55,6 +58,8 @@ void deepspeed_aio_latency_t::scale(const float scaler)
     _min_usec *= scaler;
     _max_usec *= scaler;
     _avg_usec *= scaler;
+    _p50_usec *= scaler;
+    _p99_usec *= scaler;
 }
 
 aio_context::aio_context(const int block_size, const int queue_depth)
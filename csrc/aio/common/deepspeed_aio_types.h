@@ -19,6 +19,8 @@ struct deepspeed_aio_latency_t {
     double _min_usec;
     double _max_usec;
     double _avg_usec;
+    double _p50_usec;
+    double _p99_usec;
 
     void dump(const std::string tag);
     void accumulate(const deepspeed_aio_latency_t&);
@@ -21,7 +21,20 @@ io_xfer_ctxt::io_xfer_ctxt(const int fd,
                            const long long int file_offset,
                            const long long int num_bytes,
                            const void* buffer)
-    : _fd(fd), _base_offset(file_offset), _mem_buffer(buffer), _num_bytes(num_bytes)
+    : io_xfer_ctxt(fd, file_offset, file_offset, num_bytes, buffer)
+{
+}
+
+io_xfer_ctxt::io_xfer_ctxt(const int fd,
+                           const long long int file_offset,
+                           const long long int mem_offset,
+                           const long long int num_bytes,
+                           const void* buffer)
+    : _fd(fd),
+      _base_offset(file_offset),
+      _mem_offset(mem_offset),
+      _mem_buffer(buffer),
+      _num_bytes(num_bytes)
 {
 }
 
@@ -41,7 +54,7 @@ void io_prep_context::prep_iocbs(const int n_iocbs,
     assert(static_cast<size_t>(n_iocbs) <= _iocbs->size());
     for (auto i = 0; i < n_iocbs; ++i) {
         const auto shift = i * _block_size;
-        const auto xfer_buffer = (char*)start_buffer + _xfer_ctxt->_base_offset + shift;
+        const auto xfer_buffer = (char*)start_buffer + _xfer_ctxt->_mem_offset + shift;
         const auto xfer_offset = _xfer_ctxt->_base_offset + start_offset + shift;
         auto byte_count = _block_size;
         if ((shift + _block_size) > num_bytes) { byte_count = num_bytes - shift; }
@@ -80,7 +93,8 @@ int io_prep_generator::prep_iocbs(const int n_iocbs, std::vector<struct iocb*>*
     auto actual_n_iocbs = min(static_cast<long long int>(n_iocbs), _remaining_io_blocks);
     for (auto i = 0; i < actual_n_iocbs; ++i, ++_next_iocb_index) {
         const auto xfer_offset = _xfer_ctxt->_base_offset + (_next_iocb_index * _block_size);
-        const auto xfer_buffer = (char*)_xfer_ctxt->_mem_buffer + xfer_offset;
+        const auto mem_offset = _xfer_ctxt->_mem_offset + (_next_iocb_index * _block_size);
+        const auto xfer_buffer = (char*)_xfer_ctxt->_mem_buffer + mem_offset;
         const auto num_bytes = min(static_cast<long long int>(_block_size), _remaining_bytes);
 
         if (_read_op) {
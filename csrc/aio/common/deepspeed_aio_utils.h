@@ -28,9 +28,12 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 #include <string>
 #include <vector>
 
+// Transfer of num_bytes between file offset _base_offset and _mem_buffer + _mem_offset. By
+// default memory is addressed like the file, i.e. _mem_buffer holds the whole file.
 struct io_xfer_ctxt {
     const int _fd;
     const long long int _base_offset;
+    const long long int _mem_offset;
     const void* _mem_buffer;
     const long long int _num_bytes;
 
@@ -38,6 +41,12 @@ struct io_xfer_ctxt {
                  const long long int file_offset,
                  const long long int num_bytes,
                  const void* buffer);
+
+    io_xfer_ctxt(const int fd,
+                 const long long int file_offset,
+                 const long long int mem_offset,
+                 const long long int num_bytes,
+                 const void* buffer);
 };
 
 struct io_prep_context {
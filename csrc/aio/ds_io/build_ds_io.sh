@@ -0,0 +1,23 @@
+#!/bin/bash
+# Build the ds_io native AIO benchmark. Requires the libaio development package.
+# Usage: ./build_ds_io.sh [output binary]
+
+SCRIPT_DIR=$(cd "$(dirname "${BASH_SOURCE[0]}")" && pwd)
+AIO_DIR=${SCRIPT_DIR}/..
+OUTPUT=${1:-${SCRIPT_DIR}/ds_io}
+CXX=${CXX:-g++}
+
+SOURCES="${SCRIPT_DIR}/ds_io.cpp \
+    ${AIO_DIR}/common/deepspeed_aio_common.cpp \
+    ${AIO_DIR}/common/deepspeed_aio_types.cpp \
+    ${AIO_DIR}/common/deepspeed_aio_utils.cpp"
+
+cmd="${CXX} -O2 -std=c++14 -Wall -Wno-reorder ${CFLAGS} -I${AIO_DIR}/common ${SOURCES} -o ${OUTPUT} ${LDFLAGS} -laio -lpthread"
+echo ${cmd}
+eval ${cmd}
+res=$?
+if [[ $res != 0 ]]; then
+    echo "Failed to build ds_io"
+    echo "Possible fix: sudo apt-get install libaio-dev"
+    exit 1
+fi
@@ -0,0 +1,505 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+/*
+ds_io: native performance sweep of the DeepSpeed asynchronous I/O engine.
+
+Runs every combination of block size, queue depth, thread count, submit mode, event
+overlap and O_DIRECT in a single process, and reports bandwidth and latency percentiles
+as JSON or CSV. This replaces launching one python process per configuration with
+csrc/aio/py_test/aio_bench_perf_sweep.py.
+*/
+
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <chrono>
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+#include "deepspeed_aio_common.h"
+
+using namespace std;
+
+static const std::string c_tool_name = "ds_io";
+static const long long int c_io_alignment = 4096;
+
+struct ds_io_args_t {
+    std::string _path;
+    long long int _io_size;
+    std::vector<long long int> _block_sizes;
+    std::vector<long long int> _queue_depths;
+    std::vector<long long int> _thread_counts;
+    std::vector<bool> _single_submits;
+    std::vector<bool> _overlap_events;
+    std::vector<bool> _o_directs;
+    std::vector<bool> _read_ops;
+    int _loops;
+    int _warmup;
+    std::string _format;
+    std::string _output;
+
+    ds_io_args_t()
+        : _io_size(400LL * 1024 * 1024),
+          _block_sizes({128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024}),
+          _queue_depths({4, 8, 16, 32}),
+          _thread_counts({1, 2, 4, 8}),
+          _single_submits({false, true}),
+          _overlap_events({true, false}),
+          _o_directs({true}),
+          _read_ops({true, false}),
+          _loops(3),
+          _warmup(1),
+          _format("json")
+    {
+    }
+};
+
+struct ds_io_config_t {
+    bool _read_op;
+    long long int _block_size;
+    long long int _queue_depth;
+    long long int _thread_count;
+    bool _single_submit;
+    bool _overlap_events;
+    bool _o_direct;
+};
+
+struct ds_io_result_t {
+    ds_io_config_t _config;
+    double _min_GB;
+    double _avg_GB;
+    double _max_GB;
+    deepspeed_aio_latency_t _e2e;
+    deepspeed_aio_latency_t _submit;
+    deepspeed_aio_latency_t _complete;
+};
+
+static void _usage()
+{
+    std::cout
+        << "usage: " << c_tool_name << " --path <file or dir> [options]\n"
+        << "  --io_size <bytes>            bytes read/written per operation (default 400M)\n"
+        << "  --block_size <list>          e.g. 128K,256K,1M\n"
+        << "  --queue_depth <list>         e.g. 4,8,16,32\n"
+        << "  --threads <list>             e.g. 1,2,4,8\n"
+        << "  --submit <list>              single,block\n"
+        << "  --overlap <list>             overlap,sequential\n"
+        << "  --o_direct <list>            on,off\n"
+        << "  --ops <list>                 read,write\n"
+        << "  --loops <n>                  measured repetitions per configuration (default 3)\n"
+        << "  --warmup <n>                 unmeasured repetitions per configuration (default 1)\n"
+        << "  --format <json|csv>          output format (default json)\n"
+        << "  --output <file>              output file (default stdout)" << std::endl;
+}
+
+static long long int _parse_size(const std::string& value)
+{
+    if (value.empty()) { throw std::invalid_argument("empty size"); }
+    long long int scale = 1;
+    auto digits = value;
+    switch (toupper(value.back())) {
+        case 'K': scale = 1024LL; break;
+        case 'M': scale = 1024LL * 1024; break;
+        case 'G': scale = 1024LL * 1024 * 1024; break;
+        default: break;
+    }
+    if (scale != 1) { digits = value.substr(0, value.size() - 1); }
+    return std::stoll(digits) * scale;
+}
+
+static std::vector<std::string> _split(const std::string& value)
+{
+    std::vector<std::string> tokens;
+    std::stringstream stream(value);
+    std::string token;
+    while (std::getline(stream, token, ',')) {
+        if (!token.empty()) { tokens.push_back(token); }
+    }
+    return tokens;
+}
+
+static std::vector<long long int> _parse_size_list(const std::string& value)
+{
+    std::vector<long long int> sizes;
+    for (const auto& token : _split(value)) { sizes.push_back(_parse_size(token)); }
+    return sizes;
+}
+
+static std::vector<bool> _parse_choice_list(const std::string& value,
+                                            const std::string& true_choice,
+                                            const std::string& false_choice)
+{
+    std::vector<bool> choices;
+    for (const auto& token : _split(value)) {
+        if (token == true_choice) {
+            choices.push_back(true);
+        } else if (token == false_choice) {
+            choices.push_back(false);
+        } else {
+            throw std::invalid_argument("expected " + true_choice + " or " + false_choice +
+                                        ", got " + token);
+        }
+    }
+    return choices;
+}
+
+static bool _parse_args(int argc, char** argv, ds_io_args_t& args)
+{
+    for (auto i = 1; i < argc; ++i) {
+        const std::string flag(argv[i]);
+        if (flag == "-h" || flag == "--help") { return false; }
+        if (i + 1 >= argc) {
+            std::cerr << c_tool_name << ": missing value for " << flag << std::endl;
+            return false;
+        }
+        const std::string value(argv[++i]);
+        if (flag == "--path") {
+            args._path = value;
+        } else if (flag == "--io_size") {
+            args._io_size = _parse_size(value);
+        } else if (flag == "--block_size") {
+            args._block_sizes = _parse_size_list(value);
+        } else if (flag == "--queue_depth") {
+            args._queue_depths = _parse_size_list(value);
+        } else if (flag == "--threads") {
+            args._thread_counts = _parse_size_list(value);
+        } else if (flag == "--submit") {
+            args._single_submits = _parse_choice_list(value, "single", "block");
+        } else if (flag == "--overlap") {
+            args._overlap_events = _parse_choice_list(value, "overlap", "sequential");
+        } else if (flag == "--o_direct") {
+            args._o_directs = _parse_choice_list(value, "on", "off");
+        } else if (flag == "--ops") {
+            args._read_ops = _parse_choice_list(value, "read", "write");
+        } else if (flag == "--loops") {
+            args._loops = std::stoi(value);
+        } else if (flag == "--warmup") {
+            args._warmup = std::stoi(value);
+        } else if (flag == "--format") {
+            args._format = value;
+        } else if (flag == "--output") {
+            args._output = value;
+        } else {
+            std::cerr << c_tool_name << ": unknown option " << flag << std::endl;
+            return false;
+        }
+    }
+
+    if (args._path.empty()) {
+        std::cerr << c_tool_name << ": --path is required" << std::endl;
+        return false;
+    }
+    if (args._format != "json" && args._format != "csv") {
+        std::cerr << c_tool_name << ": --format must be json or csv" << std::endl;
+        return false;
+    }
+    if (args._loops < 1 || args._io_size <= 0) {
+        std::cerr << c_tool_name << ": --loops and --io_size must be positive" << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static std::string _get_io_filename(const std::string& path)
+{
+    struct stat st;
+    if (stat(path.c_str(), &st) == 0 && S_ISDIR(st.st_mode)) {
+        return path + "/ds_io_" + std::to_string(getpid()) + ".bin";
+    }
+    return path;
+}
+
+// Make sure the read target holds at least io_size bytes, using buffered writes.
+static bool _prepare_read_file(const std::string& filename, const long long int io_size)
+{
+    long long int num_file_bytes = 0;
+    if (get_file_size(filename.c_str(), num_file_bytes) == 0 && num_file_bytes >= io_size) {
+        return true;
+    }
+
+    const auto fd = open_file(filename.c_str(), false, false);
+    if (fd == -1) { return false; }
+
+    std::vector<char> chunk(c_io_alignment * 256);
+    for (size_t i = 0; i < chunk.size(); ++i) { chunk[i] = static_cast<char>(i * 31 + 7); }
+    long long int written = 0;
+    while (written < io_size) {
+        const auto n_bytes = min(static_cast<long long int>(chunk.size()), io_size - written);
+        const auto ret = pwrite(fd, chunk.data(), n_bytes, written);
+        if (ret <= 0) {
+            report_file_error(filename.c_str(), " pwrite", errno);
+            close(fd);
+            return false;
+        }
+        written += ret;
+    }
+    fsync(fd);
+    close(fd);
+    return true;
+}
+
+// Run a single repetition across all threads, returning end-to-end seconds (or -1 on error).
+static double _run_once(const std::string& filename,
+                        const ds_io_config_t& config,
+                        char* buffer,
+                        const long long int io_size,
+                        std::vector<deepspeed_aio_perf_t>& thread_perfs)
+{
+    const auto fd = open_file(filename.c_str(), config._read_op, config._o_direct);
+    if (fd == -1) { return -1; }
+
+    // Keep buffered reads honest by evicting the file from the page cache.
+    if (config._read_op && !config._o_direct) { posix_fadvise(fd, 0, 0, POSIX_FADV_DONTNEED); }
+
+    deepspeed_aio_config_t aio_config(static_cast<int>(config._block_size),
+                                      static_cast<int>(config._queue_depth),
+                                      config._single_submit,
+                                      config._overlap_events,
+                                      false);
+    auto elapsed = do_parallel_aio_operation(config._read_op,
+                                             fd,
+                                             buffer,
+                                             io_size,
+                                             static_cast<int>(config._thread_count),
+                                             &aio_config,
+                                             &thread_perfs);
+
+    // Buffered writes are only complete once they reach the device.
+    if (!config._read_op && !config._o_direct) {
+        const auto start_time = std::chrono::high_resolution_clock::now();
+        fdatasync(fd);
+        const std::chrono::duration<double> sync_time =
+            std::chrono::high_resolution_clock::now() - start_time;
+        elapsed += sync_time.count();
+    }
+
+    close(fd);
+    return elapsed;
+}
+
+static void _summarize(std::vector<double>& values_usec, deepspeed_aio_latency_t& summary)
+{
+    std::sort(values_usec.begin(), values_usec.end());
+    summary._min_usec = values_usec.front();
+    summary._max_usec = values_usec.back();
+    double total = 0;
+    for (auto v : values_usec) { total += v; }
+    summary._avg_usec = total / values_usec.size();
+    summary._p50_usec = values_usec[(values_usec.size() + 1) / 2 - 1];
+    summary._p99_usec = values_usec[(values_usec.size() * 99 + 99) / 100 - 1];
+}
+
+static bool _run_config(const ds_io_args_t& args,
+                        const std::string& filename,
+                        const ds_io_config_t& config,
+                        char* buffer,
+                        ds_io_result_t& result)
+{
+    std::vector<deepspeed_aio_perf_t> thread_perfs;
+    for (auto i = 0; i < args._warmup; ++i) {
+        if (_run_once(filename, config, buffer, args._io_size, thread_perfs) < 0) { return false; }
+    }
+
+    std::vector<double> e2e_usec;
+    std::vector<double> rates_GB;
+    deepspeed_aio_latency_t submit = {};
+    deepspeed_aio_latency_t complete = {};
+    for (auto i = 0; i < args._loops; ++i) {
+        const auto elapsed = _run_once(filename, config, buffer, args._io_size, thread_perfs);
+        if (elapsed < 0) { return false; }
+        e2e_usec.push_back(elapsed * 1e6);
+        rates_GB.push_back(args._io_size / elapsed / 1e9);
+        for (auto& perf : thread_perfs) {
+            submit.accumulate(perf._submit);
+            complete.accumulate(perf._complete);
+        }
+    }
+
+    const auto num_samples = static_cast<float>(args._loops * config._thread_count);
+    submit.scale(1.0 / num_samples);
+    complete.scale(1.0 / num_samples);
+
+    result._config = config;
+    result._min_GB = *std::min_element(rates_GB.begin(), rates_GB.end());
+    result._max_GB = *std::max_element(rates_GB.begin(), rates_GB.end());
+    double total_GB = 0;
+    for (auto r : rates_GB) { total_GB += r; }
+    result._avg_GB = total_GB / rates_GB.size();
+    _summarize(e2e_usec, result._e2e);
+    result._submit = submit;
+    result._complete = complete;
+    return true;
+}
+
+static bool _is_valid_config(const ds_io_args_t& args, const ds_io_config_t& config)
+{
+    if (config._thread_count < 1 || config._queue_depth < 1 || config._block_size < 1) {
+        return false;
+    }
+    if (args._io_size % config._thread_count) { return false; }
+    const auto bytes_per_thread = args._io_size / config._thread_count;
+    if (config._o_direct &&
+        ((bytes_per_thread % c_io_alignment) || (config._block_size % c_io_alignment))) {
+        return false;
+    }
+    return true;
+}
+
+static void _latency_json(std::ostream& out,
+                          const std::string& name,
+                          const deepspeed_aio_latency_t& lat)
+{
+    out << "\"" << name << "_usec\": {\"min\": " << lat._min_usec << ", \"avg\": " << lat._avg_usec
+        << ", \"p50\": " << lat._p50_usec << ", \"p99\": " << lat._p99_usec
+        << ", \"max\": " << lat._max_usec << "}";
+}
+
+static void _write_json(std::ostream& out,
+                        const ds_io_args_t& args,
+                        const std::vector<ds_io_result_t>& results)
+{
+    out << "[" << std::endl;
+    for (size_t i = 0; i < results.size(); ++i) {
+        const auto& r = results[i];
+        const auto& c = r._config;
+        out << "  {\"op\": \"" << (c._read_op ? "read" : "write") << "\", \"io_size\": "
+            << args._io_size << ", \"block_size\": " << c._block_size
+            << ", \"queue_depth\": " << c._queue_depth << ", \"threads\": " << c._thread_count
+            << ", \"single_submit\": " << (c._single_submit ? "true" : "false")
+            << ", \"overlap_events\": " << (c._overlap_events ? "true" : "false")
+            << ", \"o_direct\": " << (c._o_direct ? "true" : "false")
+            << ", \"loops\": " << args._loops << ", \"GB_per_sec\": {\"min\": " << r._min_GB
+            << ", \"avg\": " << r._avg_GB << ", \"max\": " << r._max_GB << "}, ";
+        _latency_json(out, "e2e", r._e2e);
+        out << ", ";
+        _latency_json(out, "submit", r._submit);
+        out << ", ";
+        _latency_json(out, "complete", r._complete);
+        out << "}" << (i + 1 < results.size() ? "," : "") << std::endl;
+    }
+    out << "]" << std::endl;
+}
+
+static void _latency_csv(std::ostream& out, const deepspeed_aio_latency_t& lat)
+{
+    out << "," << lat._min_usec << "," << lat._avg_usec << "," << lat._p50_usec << ","
+        << lat._p99_usec << "," << lat._max_usec;
+}
+
+static void _write_csv(std::ostream& out,
+                       const ds_io_args_t& args,
+                       const std::vector<ds_io_result_t>& results)
+{
+    out << "op,io_size,block_size,queue_depth,threads,single_submit,overlap_events,o_direct,loops,"
+        << "min_GB_per_sec,avg_GB_per_sec,max_GB_per_sec";
+    for (const auto name : {"e2e", "submit", "complete"}) {
+        for (const auto stat : {"min", "avg", "p50", "p99", "max"}) {
+            out << "," << name << "_" << stat << "_usec";
+        }
+    }
+    out << std::endl;
+
+    for (const auto& r : results) {
+        const auto& c = r._config;
+        out << (c._read_op ? "read" : "write") << "," << args._io_size << "," << c._block_size << ","
+            << c._queue_depth << "," << c._thread_count << "," << c._single_submit << ","
+            << c._overlap_events << "," << c._o_direct << "," << args._loops << "," << r._min_GB
+            << "," << r._avg_GB << "," << r._max_GB;
+        _latency_csv(out, r._e2e);
+        _latency_csv(out, r._submit);
+        _latency_csv(out, r._complete);
+        out << std::endl;
+    }
+}
+
+int main(int argc, char** argv)
+{
+    ds_io_args_t args;
+    try {
+        if (!_parse_args(argc, argv, args)) {
+            _usage();
+            return 1;
+        }
+    } catch (const std::exception& e) {
+        std::cerr << c_tool_name << ": invalid argument: " << e.what() << std::endl;
+        _usage();
+        return 1;
+    }
+
+    const auto filename = _get_io_filename(args._path);
+    const auto remove_file = (filename != args._path);
+    const auto has_reads =
+        std::find(args._read_ops.begin(), args._read_ops.end(), true) != args._read_ops.end();
+    if (has_reads && !_prepare_read_file(filename, args._io_size)) { return 1; }
+
+    auto buffer = (char*)ds_page_aligned_alloc(args._io_size);
+    if (buffer == nullptr) {
+        std::cerr << c_tool_name << ": failed to allocate " << args._io_size << " bytes"
+                  << std::endl;
+        return 1;
+    }
+    for (long long int i = 0; i < args._io_size; ++i) { buffer[i] = static_cast<char>(i); }
+
+    std::vector<ds_io_result_t> results;
+    // Writes first so that a freshly created file is fully populated before it is read.
+    for (const auto read_op : {false, true}) {
+        if (std::find(args._read_ops.begin(), args._read_ops.end(), read_op) ==
+            args._read_ops.end()) {
+            continue;
+        }
+        for (const auto o_direct : args._o_directs) {
+            for (const auto single_submit : args._single_submits) {
+                for (const auto overlap_events : args._overlap_events) {
+                    for (const auto thread_count : args._thread_counts) {
+                        for (const auto queue_depth : args._queue_depths) {
+                            for (const auto block_size : args._block_sizes) {
+                                ds_io_config_t config = {read_op,
+                                                         block_size,
+                                                         queue_depth,
+                                                         thread_count,
+                                                         single_submit,
+                                                         overlap_events,
+                                                         o_direct};
+                                if (!_is_valid_config(args, config)) {
+                                    std::cerr << c_tool_name << ": skipping unaligned config"
+                                              << " block_size=" << block_size
+                                              << " threads=" << thread_count << std::endl;
+                                    continue;
+                                }
+                                ds_io_result_t result;
+                                if (!_run_config(args, filename, config, buffer, result)) {
+                                    free(buffer);
+                                    return 1;
+                                }
+                                results.push_back(result);
+                            }
+                        }
+                    }
+                }
+            }
+        }
+    }
+    free(buffer);
+    if (remove_file) { unlink(filename.c_str()); }
+
+    std::ofstream out_file;
+    if (!args._output.empty()) { out_file.open(args._output); }
+    std::ostream& out = args._output.empty() ? std::cout : out_file;
+    if (args._format == "json") {
+        _write_json(out, args, results);
+    } else {
+        _write_csv(out, args, results);
+    }
+    return 0;
+}
@@ -21,13 +21,26 @@ io_op_desc_t::io_op_desc_t(const bool read_op,
                            const int fd,
                            const char* filename,
                            const long long int num_bytes,
-                           const bool validate)
+                           const bool validate,
+                           const int priority,
+                           const long long int deadline_usec,
+                           const at::ScalarType file_dtype,
+                           const long long int file_offset)
     : _read_op(read_op),
       _buffer(buffer),
       _fd(fd),
       _filename(filename),
       _num_bytes(num_bytes),
-      _validate(validate)
+      _file_offset(file_offset),
+      _validate(validate),
+      _priority(priority),
+      _deadline(deadline_usec > 0
+                    ? std::chrono::steady_clock::now() + std::chrono::microseconds(deadline_usec)
+                    : std::chrono::steady_clock::time_point::max()),
+      _file_dtype(file_dtype),
+      _convert(file_dtype != buffer.scalar_type()),
+      _sequence(0),
+      _num_completed_threads(0)
 {
     _cpu_buffer = (_buffer.is_cuda() || _buffer.is_xpu()
 #if defined(__ENABLE_CANN__)
@@ -53,50 +66,254 @@ void io_op_desc_t::fini()
 #endif
 }
 
+void io_op_desc_t::convert(const bool to_buffer,
+                           char* staging_buffer,
+                           const long long int file_offset,
+                           const long long int num_bytes)
+{
+    const auto file_elem_size = static_cast<long long int>(c10::elementSize(_file_dtype));
+    const auto num_elems = num_bytes / file_elem_size;
+    const auto elem_offset = file_offset / file_elem_size;
+
+    auto file_elems = torch::from_blob(
+        staging_buffer, {num_elems}, torch::TensorOptions().dtype(_file_dtype));
+    auto buffer_elems =
+        torch::from_blob(data_ptr() + elem_offset * _contiguous_buffer.element_size(),
+                         {num_elems},
+                         torch::TensorOptions().dtype(_contiguous_buffer.scalar_type()));
+    if (to_buffer) {
+        buffer_elems.copy_(file_elems);
+    } else {
+        file_elems.copy_(buffer_elems);
+    }
+}
+
+io_work_t::io_work_t(const std::shared_ptr<struct io_op_desc_t>& op)
+    : _op(op), _completed_bytes(0)
+{
+}
+
+bool io_work_compare_t::operator()(const io_work_t& lhs, const io_work_t& rhs) const
+{
+    if (lhs._op->_priority != rhs._op->_priority) {
+        return lhs._op->_priority > rhs._op->_priority;
+    }
+    if (lhs._op->_deadline != rhs._op->_deadline) {
+        return lhs._op->_deadline > rhs._op->_deadline;
+    }
+    return lhs._op->_sequence > rhs._op->_sequence;
+}
+
+// Relative bandwidth change below which two queue depths are considered equivalent.
+static const double c_queue_depth_tolerance = 0.05;
+// Number of ops to stay at a depth after a change made bandwidth worse.
+static const int c_queue_depth_hold_ops = 8;
+
+aio_queue_depth_tuner_t::aio_queue_depth_tuner_t(const int max_queue_depth)
+    : _max_queue_depth(max_queue_depth),
+      _queue_depth(max_queue_depth),
+      _direction(-1),
+      _hold(0),
+      _last_rate_GB(0)
+{
+}
+
+int aio_queue_depth_tuner_t::update(const double rate_GB)
+{
+    if (_hold > 0) {
+        --_hold;
+        _last_rate_GB = rate_GB;
+        return _queue_depth;
+    }
+
+    if (_last_rate_GB > 0) {
+        if (rate_GB < _last_rate_GB * (1 - c_queue_depth_tolerance)) {
+            // The last move hurt: undo it and stay there for a while.
+            _direction = -_direction;
+            _hold = c_queue_depth_hold_ops;
+        } else if (rate_GB < _last_rate_GB * (1 + c_queue_depth_tolerance)) {
+            _direction = -1;
+        }
+    }
+    _last_rate_GB = rate_GB;
+
+    const auto next_depth = (_direction > 0) ? (_queue_depth * 2) : (_queue_depth / 2);
+    _queue_depth = std::max(1, std::min(_max_queue_depth, next_depth));
+    return _queue_depth;
+}
+
 deepspeed_aio_thread_t::deepspeed_aio_thread_t(const int tid, deepspeed_aio_config_t& aio_config)
     : _tid(tid),
       _aio_config(aio_config),
+      _adaptive_queue_depth(false),
+      _queue_depth_tuner(aio_config._queue_depth),
+      _low_priority_bytes_per_sec(0),
+      _convert_buffer(nullptr),
+      _queued_priority(c_io_priority_none),
       _aio_ctxt(new aio_context(aio_config._block_size, aio_config._queue_depth)),
       _time_to_exit(false)
 {
 }
 
-deepspeed_aio_thread_t::~deepspeed_aio_thread_t() {}
+deepspeed_aio_thread_t::~deepspeed_aio_thread_t()
+{
+    if (_convert_buffer) { free(_convert_buffer); }
+}
+
+// Staging buffer for converting ops, sized to one full queue of blocks. It is allocated by the
+// caller before the first converting op is queued, so a failure can be reported to it.
+bool deepspeed_aio_thread_t::alloc_convert_buffer()
+{
+    if (!_convert_buffer) {
+        _convert_buffer = (char*)ds_page_aligned_alloc(
+            static_cast<size_t>(_aio_config._queue_depth) * _aio_config._block_size);
+    }
+    return _convert_buffer != nullptr;
+}
+
+void deepspeed_aio_thread_t::enqueue(const io_work_t& work)
+{
+    {
+        std::lock_guard<std::mutex> lock(_work_sync._mutex);
+        _work_queue.push(work);
+        _update_queued_priority();
+    }
+    _work_sync._cond_var.notify_one();
+}
+
+// Must be called with the work mutex held.
+void deepspeed_aio_thread_t::_update_queued_priority()
+{
+    _queued_priority =
+        _work_queue.empty() ? c_io_priority_none : _work_queue.top()._op->_priority;
+}
+
+bool deepspeed_aio_thread_t::_has_more_urgent_work(const io_work_t& work)
+{
+    // Called after every reap, so skip the lock unless something at least as urgent is queued.
+    if (_queued_priority.load() > work._op->_priority) { return false; }
+
+    std::lock_guard<std::mutex> lock(_work_sync._mutex);
+    return !_work_queue.empty() && io_work_compare_t()(work, _work_queue.top());
+}
+
+// Sleep long enough to keep a low priority op under its bandwidth cap. Returns false if more
+// urgent work arrived in the meantime.
+bool deepspeed_aio_thread_t::_throttle(const io_work_t& work,
+                                       const double elapsed_sec,
+                                       const long long int num_bytes)
+{
+    const auto bytes_per_sec = _low_priority_bytes_per_sec.load();
+    if (work._op->_priority != c_io_priority_low || bytes_per_sec <= 0) { return true; }
+
+    const auto delay_sec = (num_bytes / bytes_per_sec) - elapsed_sec;
+    if (delay_sec <= 0) { return true; }
+
+    std::unique_lock<std::mutex> lock(_work_sync._mutex);
+    return !_work_sync._cond_var.wait_for(
+        lock, std::chrono::duration<double>(delay_sec), [this, &work] {
+            return _time_to_exit ||
+                   (!_work_queue.empty() && io_work_compare_t()(work, _work_queue.top()));
+        });
+}
+
+// Process the calling thread's slice of an op in a single overlapped submission loop. Ops below
+// high priority check for more urgent work each time blocks complete; when there is some, they
+// stop submitting and return once the blocks in flight have completed. Converting ops go through
+// a staging buffer of one full queue of blocks, so they are issued in such chunks and each chunk
+// is converted while it is still in cache. Returns true once the slice is complete, or false if
+// the op was preempted and must be requeued.
+bool deepspeed_aio_thread_t::_run_work(io_work_t& work)
+{
+    const auto& op = work._op;
+    const auto base_offset = op->_num_bytes * _tid;
+    const auto adaptive = _adaptive_queue_depth.load();
+    if (!adaptive) { _aio_ctxt->_queue_depth = _aio_config._queue_depth; }
+
+    const auto chunk_bytes = op->_convert ? static_cast<long long int>(_aio_config._queue_depth) *
+                                                _aio_config._block_size
+                                          : op->_num_bytes;
+    char* staging_buffer = op->_convert ? _convert_buffer : nullptr;
+
+    const auto start_time = std::chrono::steady_clock::now();
+    long long int active_bytes = 0;
+    io_preempt_fn_t preempt = nullptr;
+    if (op->_priority != c_io_priority_high) {
+        preempt = [&](const long long int chunk_completed_bytes) {
+            if (_has_more_urgent_work(work)) { return true; }
+            const std::chrono::duration<double> elapsed =
+                std::chrono::steady_clock::now() - start_time;
+            return !_throttle(work, elapsed.count(), active_bytes + chunk_completed_bytes);
+        };
+    }
+
+    while (work._completed_bytes < op->_num_bytes) {
+        const auto num_bytes = std::min(chunk_bytes, op->_num_bytes - work._completed_bytes);
+        const auto file_offset = base_offset + work._completed_bytes;
+        if (op->_convert && !op->_read_op) {
+            op->convert(false, staging_buffer, file_offset, num_bytes);
+        }
+        // Offsets within the op are relative to where it starts in the file.
+        const auto fd_offset = op->_file_offset + file_offset;
+        std::unique_ptr<io_xfer_ctxt> xfer_ctxt(
+            op->_convert
+                ? new io_xfer_ctxt(op->_fd, fd_offset, 0, num_bytes, staging_buffer)
+                : new io_xfer_ctxt(op->_fd, fd_offset, file_offset, num_bytes, op->data_ptr()));
+
+        const auto xfer_bytes =
+            _aio_config._overlap_events
+                ? do_aio_operation_overlap(
+                      op->_read_op, _aio_ctxt, xfer_ctxt, &_aio_config, nullptr, preempt)
+                : do_aio_operation_sequential(
+                      op->_read_op, _aio_ctxt, xfer_ctxt, &_aio_config, nullptr, preempt);
+        if (op->_convert && op->_read_op) {
+            op->convert(true, staging_buffer, file_offset, xfer_bytes);
+        }
+        work._completed_bytes += xfer_bytes;
+        active_bytes += xfer_bytes;
+        if (xfer_bytes < num_bytes) { return false; }
+    }
+
+    // Ops too small to fill the deepest queue twice say little about the device, and capped ops
+    // run below its bandwidth on purpose.
+    const std::chrono::duration<double> active_sec = std::chrono::steady_clock::now() - start_time;
+    const auto min_adaptive_bytes = 2LL * _aio_config._queue_depth * _aio_config._block_size;
+    const auto capped =
+        op->_priority == c_io_priority_low && _low_priority_bytes_per_sec.load() > 0;
+    if (adaptive && !capped && op->_num_bytes >= min_adaptive_bytes &&
+        active_bytes == op->_num_bytes && active_sec.count() > 0) {
+        _aio_ctxt->_queue_depth =
+            _queue_depth_tuner.update(active_bytes / active_sec.count() / 1e9);
+    }
+    return true;
+}
 
 void deepspeed_aio_thread_t::run()
 {
     while (true) {
-        std::shared_ptr<struct io_op_desc_t> next_io_op = nullptr;
+        std::unique_ptr<io_work_t> next_work;
 
         {
             std::unique_lock<std::mutex> lock(_work_sync._mutex);
             _work_sync._cond_var.wait(lock,
                                       [this] { return (!_work_queue.empty() || _time_to_exit); });
             if (!_work_queue.empty()) {
-                next_io_op = _work_queue.front();
+                next_work.reset(new io_work_t(_work_queue.top()));
                 _work_queue.pop();
+                _update_queued_priority();
             }
         }
 
-        if (next_io_op) {
-            const auto base_offset = next_io_op->_num_bytes * _tid;
-
-            std::unique_ptr<io_xfer_ctxt> xfer_ctxt(new io_xfer_ctxt(
-                next_io_op->_fd, base_offset, next_io_op->_num_bytes, next_io_op->data_ptr()));
-
-            if (_aio_config._overlap_events) {
-                do_aio_operation_overlap(
-                    next_io_op->_read_op, _aio_ctxt, xfer_ctxt, &_aio_config, nullptr);
+        if (next_work) {
+            if (_run_work(*next_work)) {
+                {
+                    std::lock_guard<std::mutex> lock(_complete_sync._mutex);
+                    _complete_queue.push(next_work->_op);
+                }
+                _complete_sync._cond_var.notify_one();
             } else {
-                do_aio_operation_sequential(
-                    next_io_op->_read_op, _aio_ctxt, xfer_ctxt, &_aio_config, nullptr);
-            }
-
-            {
-                std::lock_guard<std::mutex> lock(_complete_sync._mutex);
-                _complete_queue.push(next_io_op);
+                enqueue(*next_work);
             }
-            _complete_sync._cond_var.notify_one();
         }
 
         if (_time_to_exit) { break; }
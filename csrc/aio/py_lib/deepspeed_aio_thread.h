@@ -7,30 +7,74 @@
 Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 */
 
+#include <atomic>
+#include <chrono>
 #include <condition_variable>
 #include <memory>
 #include <queue>
 #include "deepspeed_py_aio.h"
 
+// Scheduling classes of queued ops; a lower value is more urgent. High priority ops (e.g.
+// parameter prefetch reads) run to completion, while normal and low priority ops stop submitting
+// blocks as soon as more urgent work is queued. Low priority ops may also be bandwidth capped.
+enum io_priority_t {
+    c_io_priority_high = 0,
+    c_io_priority_normal = 1,
+    c_io_priority_low = 2,
+    // Less urgent than any op, i.e. the queue is empty.
+    c_io_priority_none = 3,
+};
+
 struct io_op_desc_t {
     const bool _read_op;
     torch::Tensor _buffer;
     int _fd;
     const std::string _filename;
     const long long int _num_bytes;
+    const long long int _file_offset;
     torch::Tensor _cpu_buffer;
     torch::Tensor _contiguous_buffer;
     const bool _validate;
+    const int _priority;
+    const std::chrono::steady_clock::time_point _deadline;
+    const at::ScalarType _file_dtype;
+    const bool _convert;
+    long long int _sequence;
+    int _num_completed_threads;
 
     io_op_desc_t(const bool read_op,
                  const torch::Tensor& buffer,
                  const int fd,
                  const char* filename,
                  const long long int num_bytes,
-                 const bool validate);
+                 const bool validate,
+                 const int priority,
+                 const long long int deadline_usec,
+                 const at::ScalarType file_dtype,
+                 const long long int file_offset);
 
     char* data_ptr() const;
     void fini();
+
+    // Convert the file bytes [file_offset, file_offset + num_bytes) between the staging buffer
+    // and the matching elements of the op buffer.
+    void convert(const bool to_buffer,
+                 char* staging_buffer,
+                 const long long int file_offset,
+                 const long long int num_bytes);
+};
+
+// A thread's share of an op, with the progress made before it was last preempted.
+struct io_work_t {
+    std::shared_ptr<struct io_op_desc_t> _op;
+    long long int _completed_bytes;
+
+    io_work_t(const std::shared_ptr<struct io_op_desc_t>& op);
+};
+
+// Orders queued work by priority, then deadline, then submission order.
+struct io_work_compare_t {
+    bool operator()(const io_work_t& lhs, const io_work_t& rhs) const;
 };
 
 struct thread_sync_t {
@@ -38,12 +82,33 @@ struct thread_sync_t {
     std::condition_variable _cond_var;
 };
 
+// Adjusts the number of in-flight blocks from the observed bandwidth of completed ops. Depth
+// moves in powers of two within [1, max_queue_depth]; when a change does not buy bandwidth the
+// shallower queue is preferred since it has lower per-block completion latency.
+struct aio_queue_depth_tuner_t {
+    const int _max_queue_depth;
+    int _queue_depth;
+    int _direction;
+    int _hold;
+    double _last_rate_GB;
+
+    aio_queue_depth_tuner_t(const int max_queue_depth);
+
+    int update(const double rate_GB);
+};
+
 struct deepspeed_aio_thread_t {
     const int _tid;
     deepspeed_aio_config_t& _aio_config;
+    std::atomic<bool> _adaptive_queue_depth;
+    struct aio_queue_depth_tuner_t _queue_depth_tuner;
+    std::atomic<double> _low_priority_bytes_per_sec;
+    char* _convert_buffer;
+    // Priority of the most urgent queued work, readable without the work mutex.
+    std::atomic<int> _queued_priority;
 
     std::unique_ptr<struct aio_context> _aio_ctxt;
-    std::queue<std::shared_ptr<struct io_op_desc_t>> _work_queue;
+    std::priority_queue<io_work_t, std::vector<io_work_t>, io_work_compare_t> _work_queue;
     std::queue<std::shared_ptr<struct io_op_desc_t>> _complete_queue;
 
     bool _time_to_exit;
@@ -56,4 +121,17 @@ struct deepspeed_aio_thread_t {
     ~deepspeed_aio_thread_t();
 
     void run();
+
+    void enqueue(const io_work_t& work);
+
+    bool alloc_convert_buffer();
+
+    void _update_queued_priority();
+
+    bool _run_work(io_work_t& work);
+
+    bool _has_more_urgent_work(const io_work_t& work);
+
+
+    bool _throttle(const io_work_t& work, const double elapsed_sec, const long long int num_bytes);
 };
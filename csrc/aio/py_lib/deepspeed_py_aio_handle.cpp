@@ -27,6 +27,8 @@ deepspeed_aio_handle_t::deepspeed_aio_handle_t(const int block_size,
       _num_threads(num_threads),
       _aio_config(block_size, queue_depth, single_submit, overlap_events, false),
       _num_pending_ops(0),
+      _num_scheduled_ops(0),
+      _thread_completions(num_threads, 0),
       _pinned_tensor_mgr(new deepspeed_pin_tensor_t())
 {
     for (auto i = 0; i < num_threads; ++i) {
@@ -60,6 +62,31 @@ const bool deepspeed_aio_handle_t::get_overlap_events() const { return _overlap_
 
 const int deepspeed_aio_handle_t::get_thread_count() const { return _num_threads; }
 
+const bool deepspeed_aio_handle_t::get_adaptive_queue_depth() const
+{
+    return _thread_contexts.empty() ? false : _thread_contexts[0]->_adaptive_queue_depth.load();
+}
+
+const double deepspeed_aio_handle_t::get_low_priority_bandwidth() const
+{
+    return _thread_contexts.empty()
+               ? 0
+               : _thread_contexts[0]->_low_priority_bytes_per_sec.load() * _num_threads;
+}
+
+void deepspeed_aio_handle_t::set_adaptive_queue_depth(const bool enable)
+{
+    for (auto& ctxt : _thread_contexts) { ctxt->_adaptive_queue_depth = enable; }
+}
+
+void deepspeed_aio_handle_t::set_low_priority_bandwidth(const double bytes_per_sec)
+{
+    const auto thread_bytes_per_sec = (bytes_per_sec > 0) ? (bytes_per_sec / _num_threads) : 0;
+    for (auto& ctxt : _thread_contexts) {
+        ctxt->_low_priority_bytes_per_sec = thread_bytes_per_sec;
+    }
+}
+
 int deepspeed_aio_handle_t::read(torch::Tensor& buffer, const char* filename, const bool validate)
 {
     const auto start_time = std::chrono::high_resolution_clock::now();
@@ -136,26 +163,39 @@ int deepspeed_aio_handle_t::write(const torch::Tensor& buffer,
 
 void deepspeed_aio_handle_t::_schedule_aio_work(std::shared_ptr<struct io_op_desc_t> scheduled_op)
 {
-    for (auto& ctxt : _thread_contexts) {
-        {
-            std::lock_guard<std::mutex> lock(ctxt->_work_sync._mutex);
-            ctxt->_work_queue.push(scheduled_op);
-        }
-        ctxt->_work_sync._cond_var.notify_one();
-    }
+    scheduled_op->_sequence = _num_scheduled_ops++;
+    for (auto& ctxt : _thread_contexts) { ctxt->enqueue(io_work_t(scheduled_op)); }
     _num_pending_ops++;
 }
 
+// Threads may finish ops out of submission order (see io_work_compare_t), so an op is only
+// complete once every thread has reported it. Until then, block on the thread with the fewest
+// completions, which is guaranteed to have outstanding work.
 std::shared_ptr<struct io_op_desc_t> deepspeed_aio_handle_t::_wait_for_aio_work()
 {
-    std::shared_ptr<struct io_op_desc_t> completed_op = nullptr;
-    for (auto& ctxt : _thread_contexts) {
-        std::unique_lock<std::mutex> lock(ctxt->_complete_sync._mutex);
-        ctxt->_complete_sync._cond_var.wait(lock,
-                                            [ctxt] { return !ctxt->_complete_queue.empty(); });
-        completed_op = ctxt->_complete_queue.front();
-        ctxt->_complete_queue.pop();
+    while (_completed_ops.empty()) {
+        const auto tid = std::distance(
+            _thread_completions.begin(),
+            std::min_element(_thread_completions.begin(), _thread_completions.end()));
+        auto& ctxt = _thread_contexts[tid];
+
+        std::shared_ptr<struct io_op_desc_t> thread_op = nullptr;
+        {
+            std::unique_lock<std::mutex> lock(ctxt->_complete_sync._mutex);
+            ctxt->_complete_sync._cond_var.wait(
+                lock, [&ctxt] { return !ctxt->_complete_queue.empty(); });
+            thread_op = ctxt->_complete_queue.front();
+            ctxt->_complete_queue.pop();
+        }
+
+        ++_thread_completions[tid];
+        if (++thread_op->_num_completed_threads == _num_threads) {
+            _completed_ops.push(thread_op);
+        }
     }
+
+    auto completed_op = _completed_ops.front();
+    _completed_ops.pop();
     return completed_op;
 }
 
@@ -196,45 +236,49 @@ int deepspeed_aio_handle_t::wait()
     return num_completed_ops;
 }
 
-bool deepspeed_aio_handle_t::_is_valid_parallel_aio_op(const bool read_op,
-                                                       const long long int num_bytes)
+int deepspeed_aio_handle_t::_pread(const torch::Tensor& buffer,
+                                   const char* filename,
+                                   const at::ScalarType file_dtype,
+                                   const bool validate,
+                                   const bool async,
+                                   const int priority,
+                                   const long long int deadline_usec,
+                                   const long long int file_offset)
 {
-    const auto op_string = read_op ? "Read" : "Write";
-    if (num_bytes % get_thread_count()) {
-        std::cout << "deepspeed_aio failure: parallel " << op_string << " num_bytes = " << num_bytes
-                  << " not divisible by thread count = " << get_thread_count() << std::endl;
-        return false;
-    }
-
-    return true;
-}
+    if (!_is_valid_file_offset_aio_op(true, validate, file_offset)) { return -1; }
 
-int deepspeed_aio_handle_t::pread(const torch::Tensor& buffer,
-                                  const char* filename,
-                                  const bool validate,
-                                  const bool async)
-{
     long long num_file_bytes;
     if (-1 == get_file_size(filename, num_file_bytes)) {
         const auto error_code = errno;
         report_file_error(filename, " fstat for read", error_code);
         return -1;
     }
-    const auto buffer_bytes = static_cast<long long int>(buffer.nbytes());
-    if (buffer_bytes != num_file_bytes) {
-        std::cout << filename << ": buffer nbytes != file bytes " << buffer_bytes
-                  << " != " << num_file_bytes << std::endl;
+    const auto buffer_bytes =
+        static_cast<long long int>(buffer.numel() * c10::elementSize(file_dtype));
+    // The buffer is read from [file_offset, file_offset + buffer_bytes), which the file must hold.
+    if (file_offset + buffer_bytes > num_file_bytes) {
+        std::cout << filename << ": buffer nbytes past file bytes " << file_offset << " + "
+                  << buffer_bytes << " > " << num_file_bytes << std::endl;
+        return -1;
     }
-    assert(static_cast<long long int>(buffer.nbytes()) == num_file_bytes);
-    assert((num_file_bytes % _num_threads) == 0);
+    assert((buffer_bytes % _num_threads) == 0);
 
-    if (!_is_valid_parallel_aio_op(true, num_file_bytes)) { return -1; }
+    if (!_is_valid_parallel_aio_op(true, buffer_bytes)) { return -1; }
+    if (!_is_valid_convert_aio_op(true, buffer, file_dtype)) { return -1; }
 
     const auto fd = open_file(filename, true);
     if (fd == -1) { return -1; }
 
-    auto scheduled_op = std::make_shared<io_op_desc_t>(
-        true, buffer, fd, filename, (num_file_bytes / _num_threads), validate);
+    auto scheduled_op = std::make_shared<io_op_desc_t>(true,
+                                                       buffer,
+                                                       fd,
+                                                       filename,
+                                                       (buffer_bytes / _num_threads),
+                                                       validate,
+                                                       priority,
+                                                       deadline_usec,
+                                                       file_dtype,
+                                                       file_offset);
 
     _schedule_aio_work(scheduled_op);
 
@@ -243,21 +287,37 @@ int deepspeed_aio_handle_t::pread(const torch::Tensor& buffer,
     return wait();
 }
 
-int deepspeed_aio_handle_t::pwrite(const torch::Tensor& buffer,
-                                   const char* filename,
-                                   const bool validate,
-                                   const bool async)
+int deepspeed_aio_handle_t::_pwrite(const torch::Tensor& buffer,
+                                    const char* filename,
+                                    const at::ScalarType file_dtype,
+                                    const bool validate,
+                                    const bool async,
+                                    const int priority,
+                                    const long long int deadline_usec,
+                                    const long long int file_offset)
 {
-    const auto num_write_bytes = static_cast<long long int>(buffer.nbytes());
+    if (!_is_valid_file_offset_aio_op(false, validate, file_offset)) { return -1; }
+
+    const auto num_write_bytes =
+        static_cast<long long int>(buffer.numel() * c10::elementSize(file_dtype));
     assert((num_write_bytes % _num_threads) == 0);
 
     if (!_is_valid_parallel_aio_op(false, num_write_bytes)) { return -1; }
+    if (!_is_valid_convert_aio_op(false, buffer, file_dtype)) { return -1; }
 
     const auto fd = open_file(filename, false);
     if (fd == -1) { return -1; }
 
-    auto scheduled_op = std::make_shared<io_op_desc_t>(
-        false, buffer, fd, filename, (num_write_bytes / _num_threads), validate);
+    auto scheduled_op = std::make_shared<io_op_desc_t>(false,
+                                                       buffer,
+                                                       fd,
+                                                       filename,
+                                                       (num_write_bytes / _num_threads),
+                                                       validate,
+                                                       priority,
+                                                       deadline_usec,
+                                                       file_dtype,
+                                                       file_offset);
 
     _schedule_aio_work(scheduled_op);
 
@@ -266,24 +326,173 @@ int deepspeed_aio_handle_t::pwrite(const torch::Tensor& buffer,
     return wait();
 }
 
-int deepspeed_aio_handle_t::sync_pread(torch::Tensor& buffer, const char* filename)
+// Converting ops split the buffer by elements, so each thread must get a whole number of them.
+// Converting ops also need the threads' staging buffers, which are allocated here so that an
+// allocation failure fails the op on the calling thread.
+bool deepspeed_aio_handle_t::_is_valid_convert_aio_op(const bool read_op,
+                                                      const torch::Tensor& buffer,
+                                                      const at::ScalarType file_dtype)
+{
+    if (file_dtype == buffer.scalar_type()) { return true; }
+
+    const auto op_string = read_op ? "Read" : "Write";
+    if (buffer.numel() % get_thread_count()) {
+        std::cout << "deepspeed_aio failure: converting " << op_string
+                  << " numel = " << buffer.numel()
+                  << " not divisible by thread count = " << get_thread_count() << std::endl;
+        return false;
+    }
+
+    for (auto& ctxt : _thread_contexts) {
+        if (!ctxt->alloc_convert_buffer()) {
+            std::cout << "deepspeed_aio failure: converting " << op_string
+                      << " cannot allocate staging buffer" << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Validation compares the buffer against the whole file, so it is only defined at offset zero.
+bool deepspeed_aio_handle_t::_is_valid_file_offset_aio_op(const bool read_op,
+                                                          const bool validate,
+                                                          const long long int file_offset)
+{
+    const auto op_string = read_op ? "Read" : "Write";
+    if (file_offset < 0) {
+        std::cout << "deepspeed_aio failure: " << op_string << " file_offset = " << file_offset
+                  << " is negative" << std::endl;
+        return false;
+    }
+    if (validate && file_offset > 0) {
+        std::cout << "deepspeed_aio failure: " << op_string
+                  << " cannot validate at file_offset = " << file_offset << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool deepspeed_aio_handle_t::_is_valid_parallel_aio_op(const bool read_op,
+                                                       const long long int num_bytes)
+{
+    const auto op_string = read_op ? "Read" : "Write";
+    if (num_bytes % get_thread_count()) {
+        std::cout << "deepspeed_aio failure: parallel " << op_string << " num_bytes = " << num_bytes
+                  << " not divisible by thread count = " << get_thread_count() << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+int deepspeed_aio_handle_t::pread(const torch::Tensor& buffer,
+                                  const char* filename,
+                                  const bool validate,
+                                  const bool async,
+                                  const int priority,
+                                  const long long int deadline_usec,
+                                  const long long int file_offset)
+{
+    return _pread(buffer,
+                  filename,
+                  buffer.scalar_type(),
+                  validate,
+                  async,
+                  priority,
+                  deadline_usec,
+                  file_offset);
+}
+
+int deepspeed_aio_handle_t::pwrite(const torch::Tensor& buffer,
+                                   const char* filename,
+                                   const bool validate,
+                                   const bool async,
+                                   const int priority,
+                                   const long long int deadline_usec,
+                                   const long long int file_offset)
+{
+    return _pwrite(buffer,
+                   filename,
+                   buffer.scalar_type(),
+                   validate,
+                   async,
+                   priority,
+                   deadline_usec,
+                   file_offset);
+}
+
+int deepspeed_aio_handle_t::convert_pread(const torch::Tensor& buffer,
+                                          const char* filename,
+                                          const torch::Tensor& file_example_tensor,
+                                          const bool async,
+                                          const int priority,
+                                          const long long int deadline_usec,
+                                          const long long int file_offset)
+{
+    return _pread(buffer,
+                  filename,
+                  file_example_tensor.scalar_type(),
+                  false,
+                  async,
+                  priority,
+                  deadline_usec,
+                  file_offset);
+}
+
+int deepspeed_aio_handle_t::convert_pwrite(const torch::Tensor& buffer,
+                                           const char* filename,
+                                           const torch::Tensor& file_example_tensor,
+                                           const bool async,
+                                           const int priority,
+                                           const long long int deadline_usec,
+                                           const long long int file_offset)
+{
+    return _pwrite(buffer,
+                   filename,
+                   file_example_tensor.scalar_type(),
+                   false,
+                   async,
+                   priority,
+                   deadline_usec,
+                   file_offset);
+}
+
+int deepspeed_aio_handle_t::sync_pread(torch::Tensor& buffer,
+                                       const char* filename,
+                                       const int priority,
+                                       const long long int deadline_usec,
+                                       const long long int file_offset)
 {
-    return pread(buffer, filename, false, false);
+    return pread(buffer, filename, false, false, priority, deadline_usec, file_offset);
 }
 
-int deepspeed_aio_handle_t::sync_pwrite(const torch::Tensor& buffer, const char* filename)
+int deepspeed_aio_handle_t::sync_pwrite(const torch::Tensor& buffer,
+                                        const char* filename,
+                                        const int priority,
+                                        const long long int deadline_usec,
+                                        const long long int file_offset)
 {
-    return pwrite(buffer, filename, false, false);
+    return pwrite(buffer, filename, false, false, priority, deadline_usec, file_offset);
 }
 
-int deepspeed_aio_handle_t::async_pread(torch::Tensor& buffer, const char* filename)
+int deepspeed_aio_handle_t::async_pread(torch::Tensor& buffer,
+                                        const char* filename,
+                                        const int priority,
+                                        const long long int deadline_usec,
+                                        const long long int file_offset)
 {
-    return pread(buffer, filename, false, true);
+    return pread(buffer, filename, false, true, priority, deadline_usec, file_offset);
 }
 
-int deepspeed_aio_handle_t::async_pwrite(const torch::Tensor& buffer, const char* filename)
+int deepspeed_aio_handle_t::async_pwrite(const torch::Tensor& buffer,
+                                         const char* filename,
+                                         const int priority,
+                                         const long long int deadline_usec,
+                                         const long long int file_offset)
 {
-    return pwrite(buffer, filename, false, true);
+    return pwrite(buffer, filename, false, true, priority, deadline_usec, file_offset);
 }
 
 at::Tensor deepspeed_aio_handle_t::new_cpu_locked_tensor(const size_t num_elem,
@@ -9,6 +9,7 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 
 #include <condition_variable>
 #include <memory>
+#include <queue>
 #include "deepspeed_aio_thread.h"
 #include "deepspeed_pin_tensor.h"
 
@@ -22,6 +23,9 @@ struct deepspeed_aio_handle_t {
     std::vector<std::shared_ptr<struct deepspeed_aio_thread_t>> _thread_contexts;
     std::vector<std::thread> _threads;
     int _num_pending_ops;
+    long long int _num_scheduled_ops;
+    std::vector<long long int> _thread_completions;
+    std::queue<std::shared_ptr<struct io_op_desc_t>> _completed_ops;
     std::unique_ptr<struct deepspeed_pin_tensor_t> _pinned_tensor_mgr;
 
     deepspeed_aio_handle_t(const int block_size,
@@ -37,28 +41,77 @@ struct deepspeed_aio_handle_t {
     const bool get_single_submit() const;
     const bool get_overlap_events() const;
     const int get_thread_count() const;
+    const bool get_adaptive_queue_depth() const;
+    const double get_low_priority_bandwidth() const;
+
+    void set_adaptive_queue_depth(const bool enable);
+
+    // Cap the aggregate bandwidth of low priority ops, in bytes/sec; zero removes the cap.
+    void set_low_priority_bandwidth(const double bytes_per_sec);
 
     int read(torch::Tensor& buffer, const char* filename, const bool validate);
 
     int write(const torch::Tensor& buffer, const char* filename, const bool validate);
 
+    // A deadline_usec of zero means the op has no deadline. Ops transfer the bytes of buffer at
+    // file_offset in the file, which must be aligned like the buffer.
     int pread(const torch::Tensor& buffer,
               const char* filename,
               const bool validate,
-              const bool async);
+              const bool async,
+              const int priority = c_io_priority_normal,
+              const long long int deadline_usec = 0,
+              const long long int file_offset = 0);
 
     int pwrite(const torch::Tensor& buffer,
                const char* filename,
                const bool validate,
-               const bool async);
-
-    int sync_pread(torch::Tensor& buffer, const char* filename);
-
-    int sync_pwrite(const torch::Tensor& buffer, const char* filename);
-
-    int async_pread(torch::Tensor& buffer, const char* filename);
-
-    int async_pwrite(const torch::Tensor& buffer, const char* filename);
+               const bool async,
+               const int priority = c_io_priority_normal,
+               const long long int deadline_usec = 0,
+               const long long int file_offset = 0);
+
+    // Variants of pread/pwrite for files whose elements have the dtype of file_example_tensor
+    // rather than that of buffer. Each chunk is converted as it is transferred.
+    int convert_pread(const torch::Tensor& buffer,
+                      const char* filename,
+                      const torch::Tensor& file_example_tensor,
+                      const bool async,
+                      const int priority = c_io_priority_normal,
+                      const long long int deadline_usec = 0,
+                      const long long int file_offset = 0);
+
+    int convert_pwrite(const torch::Tensor& buffer,
+                       const char* filename,
+                       const torch::Tensor& file_example_tensor,
+                       const bool async,
+                       const int priority = c_io_priority_normal,
+                       const long long int deadline_usec = 0,
+                       const long long int file_offset = 0);
+
+    int sync_pread(torch::Tensor& buffer,
+                   const char* filename,
+                   const int priority = c_io_priority_normal,
+                   const long long int deadline_usec = 0,
+                   const long long int file_offset = 0);
+
+    int sync_pwrite(const torch::Tensor& buffer,
+                    const char* filename,
+                    const int priority = c_io_priority_normal,
+                    const long long int deadline_usec = 0,
+                    const long long int file_offset = 0);
+
+    int async_pread(torch::Tensor& buffer,
+                    const char* filename,
+                    const int priority = c_io_priority_normal,
+                    const long long int deadline_usec = 0,
+                    const long long int file_offset = 0);
+
+    int async_pwrite(const torch::Tensor& buffer,
+                     const char* filename,
+                     const int priority = c_io_priority_normal,
+                     const long long int deadline_usec = 0,
+                     const long long int file_offset = 0);
 
     // TODO: Make API's args to be shape and dtype.
     torch::Tensor new_cpu_locked_tensor(const size_t num_elem, const torch::Tensor& example_tensor);
@@ -73,5 +126,31 @@ struct deepspeed_aio_handle_t {
 
     std::shared_ptr<struct io_op_desc_t> _wait_for_aio_work();
 
+    int _pread(const torch::Tensor& buffer,
+               const char* filename,
+               const at::ScalarType file_dtype,
+               const bool validate,
+               const bool async,
+               const int priority,
+               const long long int deadline_usec,
+               const long long int file_offset);
+
+    int _pwrite(const torch::Tensor& buffer,
+                const char* filename,
+                const at::ScalarType file_dtype,
+                const bool validate,
+                const bool async,
+                const int priority,
+                const long long int deadline_usec,
+                const long long int file_offset);
+
+    bool _is_valid_file_offset_aio_op(const bool read_op,
+                                      const bool validate,
+                                      const long long int file_offset);
+
     bool _is_valid_parallel_aio_op(const bool read_op, const long long int num_bytes);
+
+    bool _is_valid_convert_aio_op(const bool read_op,
+                                  const torch::Tensor& buffer,
+                                  const at::ScalarType file_dtype);
 };
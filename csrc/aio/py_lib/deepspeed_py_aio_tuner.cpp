@@ -0,0 +1,115 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+/*
+Functionality for picking the asynchronous I/O configuration that performs best on the device
+backing a swap directory.
+*/
+
+#include "deepspeed_py_aio_tuner.h"
+
+using namespace std;
+
+static const long long int c_probe_alignment = 4096;
+
+deepspeed_aio_tuner_t::deepspeed_aio_tuner_t(const char* directory,
+                                             const long long int probe_bytes,
+                                             const std::vector<int>& block_sizes,
+                                             const std::vector<int>& queue_depths,
+                                             const std::vector<int>& thread_counts)
+    : _directory(directory),
+      _probe_bytes(probe_bytes),
+      _block_sizes(block_sizes),
+      _queue_depths(queue_depths),
+      _thread_counts(thread_counts),
+      _block_size(-1),
+      _queue_depth(-1),
+      _thread_count(-1),
+      _read_GB(0),
+      _write_GB(0)
+{
+}
+
+const int deepspeed_aio_tuner_t::get_block_size() const { return _block_size; }
+
+const int deepspeed_aio_tuner_t::get_queue_depth() const { return _queue_depth; }
+
+const int deepspeed_aio_tuner_t::get_thread_count() const { return _thread_count; }
+
+const double deepspeed_aio_tuner_t::get_read_GB() const { return _read_GB; }
+
+const double deepspeed_aio_tuner_t::get_write_GB() const { return _write_GB; }
+
+bool deepspeed_aio_tuner_t::_probe(const std::string& filename,
+                                   void* buffer,
+                                   const int block_size,
+                                   const int queue_depth,
+                                   const int thread_count,
+                                   double& read_GB,
+                                   double& write_GB)
+{
+    if ((_probe_bytes % (thread_count * c_probe_alignment)) || (block_size % c_probe_alignment)) {
+        return false;
+    }
+
+    deepspeed_aio_config_t config(block_size, queue_depth, false, true, false);
+    for (const auto read_op : {false, true}) {
+        const auto fd = open_file(filename.c_str(), read_op);
+        if (fd == -1) { return false; }
+        const auto elapsed = do_parallel_aio_operation(
+            read_op, fd, buffer, _probe_bytes, thread_count, &config, nullptr);
+        close(fd);
+        (read_op ? read_GB : write_GB) = _probe_bytes / elapsed / 1e9;
+    }
+    return true;
+}
+
+// Coordinate search: sweep block size, then queue depth, then thread count, each time keeping
+// the best value found so far. Candidates are scored by the time to write and then read back
+// the probe, i.e. the harmonic mean of the read and write bandwidths.
+bool deepspeed_aio_tuner_t::tune()
+{
+    if (_block_sizes.empty() || _queue_depths.empty() || _thread_counts.empty()) { return false; }
+
+    const auto filename = _directory + "/.ds_aio_tune_" + std::to_string(getpid()) + ".swp";
+    auto buffer = ds_page_aligned_alloc(_probe_bytes);
+    if (buffer == nullptr) { return false; }
+    memset(buffer, 0x5a, _probe_bytes);
+
+    int best[3] = {_block_sizes[_block_sizes.size() / 2],
+                   _queue_depths[_queue_depths.size() / 2],
+                   _thread_counts.front()};
+    const std::vector<int>* candidates[3] = {&_block_sizes, &_queue_depths, &_thread_counts};
+    double best_score = 0;
+
+    for (auto dim = 0; dim < 3; ++dim) {
+        auto trial = best[dim];
+        for (const auto value : *candidates[dim]) {
+            int config[3] = {best[0], best[1], best[2]};
+            config[dim] = value;
+            double read_GB = 0, write_GB = 0;
+            if (!_probe(filename, buffer, config[0], config[1], config[2], read_GB, write_GB)) {
+                continue;
+            }
+            const auto score = 2.0 / (1.0 / read_GB + 1.0 / write_GB);
+            if (score > best_score) {
+                best_score = score;
+                trial = value;
+                _read_GB = read_GB;
+                _write_GB = write_GB;
+            }
+        }
+        if (best_score > 0) { best[dim] = trial; }
+    }
+
+    free(buffer);
+    unlink(filename.c_str());
+
+    if (best_score == 0) { return false; }
+    _block_size = best[0];
+    _queue_depth = best[1];
+    _thread_count = best[2];
+    return true;
+}
@@ -0,0 +1,51 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+/*
+Functionality for picking the asynchronous I/O configuration that performs best on the device
+backing a swap directory.
+*/
+
+#pragma once
+
+#include <string>
+#include <vector>
+#include "deepspeed_py_aio.h"
+
+struct deepspeed_aio_tuner_t {
+    const std::string _directory;
+    const long long int _probe_bytes;
+    const std::vector<int> _block_sizes;
+    const std::vector<int> _queue_depths;
+    const std::vector<int> _thread_counts;
+
+    int _block_size;
+    int _queue_depth;
+    int _thread_count;
+    double _read_GB;
+    double _write_GB;
+
+    deepspeed_aio_tuner_t(const char* directory,
+                          const long long int probe_bytes,
+                          const std::vector<int>& block_sizes,
+                          const std::vector<int>& queue_depths,
+                          const std::vector<int>& thread_counts);
+
+    const int get_block_size() const;
+    const int get_queue_depth() const;
+    const int get_thread_count() const;
+    const double get_read_GB() const;
+    const double get_write_GB() const;
+
+    bool tune();
+
+    bool _probe(const std::string& filename,
+                void* buffer,
+                const int block_size,
+                const int queue_depth,
+                const int thread_count,
+                double& read_GB,
+                double& write_GB);
+};
@@ -9,127 +9,162 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 
 #include "deepspeed_py_copy.h"
 #include <omp.h>
+#include <algorithm>
+#include <cstring>
 
 #define ROUND_DOWN(size, step) ((size) & ~((step)-1))
-
-#if defined(__AVX512__) or defined(__AVX256__)
-union AVX_Data {
-#if defined(__AVX512__)
-    __m512 data;
-#else
-    __m256 data;
-#endif
+#define ROUND_UP(size, step) ROUND_DOWN((size) + (step)-1, step)
+
+// Smallest range worth handing to a thread of its own.
+static const size_t c_min_thread_bytes = 256 * 1024;
+// Copies at least this large bypass the cache, since the destination would not fit anyway and
+// is usually consumed by I/O or another device rather than by this core.
+static const size_t c_streaming_min_bytes = 8 * 1024 * 1024;
+static const size_t c_cache_line_bytes = 64;
+
+struct copy_segment_t {
+    char* _dest;
+    const char* _src;
+    size_t _num_bytes;
 };
-#endif
 
-static void helper_memcpy_1(float* dest, float* src, size_t param_size)
+static void copy_bytes(char* dest, const char* src, size_t num_bytes, const bool streaming)
 {
-    size_t rounded_size = 0;
-
 #if defined(__AVX512__) or defined(__AVX256__)
-
-    rounded_size = ROUND_DOWN(param_size, SIMD_WIDTH);
-
-    for (size_t t = 0; t < rounded_size; t += TILE) {
-        size_t copy_size = TILE;
-        if ((t + TILE) > rounded_size) copy_size = rounded_size - t;
-        size_t offset = copy_size + t;
-#pragma omp parallel for
-        for (size_t i = t; i < offset; i += SIMD_WIDTH) {
-            AVX_Data src_4;
-            src_4.data = SIMD_LOAD(src + i);
-
-            SIMD_STORE(dest + i, src_4.data);
+    if (streaming) {
+        // Non-temporal stores need an aligned destination.
+        const auto misalignment = reinterpret_cast<uintptr_t>(dest) % SIMD_BYTES;
+        const auto head_bytes = std::min(num_bytes, misalignment ? SIMD_BYTES - misalignment : 0);
+        memcpy(dest, src, head_bytes);
+        dest += head_bytes;
+        src += head_bytes;
+        num_bytes -= head_bytes;
+
+        const auto rounded_size = ROUND_DOWN(num_bytes, SIMD_BYTES);
+        for (size_t i = 0; i < rounded_size; i += SIMD_BYTES) {
+            SIMD_STREAM_BYTES(dest + i, SIMD_LOAD_BYTES(src + i));
         }
+        dest += rounded_size;
+        src += rounded_size;
+        num_bytes -= rounded_size;
     }
-
 #endif
+    memcpy(dest, src, num_bytes);
+}
 
-    if (param_size > rounded_size) {
-#pragma omp parallel for
-        for (size_t k = rounded_size; k < param_size; k++) { dest[k] = src[k]; }
+// Copy the concatenation of segments in parallel. Each thread owns one contiguous, cache line
+// aligned range of the concatenated bytes, so with OMP_PROC_BIND set a thread keeps touching the
+// same pages (and NUMA node) of a buffer that is staged through repeatedly.
+static void parallel_copy(const std::vector<copy_segment_t>& segments)
+{
+    size_t total_bytes = 0;
+    for (const auto& segment : segments) { total_bytes += segment._num_bytes; }
+    if (total_bytes == 0) { return; }
+
+    const auto streaming = total_bytes >= c_streaming_min_bytes;
+    const auto max_threads = static_cast<size_t>(omp_get_max_threads());
+    const auto num_threads = std::max<size_t>(
+        1, std::min(max_threads, total_bytes / c_min_thread_bytes));
+
+#pragma omp parallel num_threads(num_threads)
+    {
+        const auto thread_bytes =
+            ROUND_UP((total_bytes + omp_get_num_threads() - 1) / omp_get_num_threads(),
+                     c_cache_line_bytes);
+        const auto begin = std::min(total_bytes, omp_get_thread_num() * thread_bytes);
+        const auto end = std::min(total_bytes, begin + thread_bytes);
+
+        size_t segment_begin = 0;
+        for (const auto& segment : segments) {
+            const auto segment_end = segment_begin + segment._num_bytes;
+            if (segment_begin >= end) { break; }
+            if (segment_end > begin) {
+                const auto offset = std::max(begin, segment_begin) - segment_begin;
+                const auto num_bytes = std::min(end, segment_end) - segment_begin - offset;
+                copy_bytes(segment._dest + offset, segment._src + offset, num_bytes, streaming);
+            }
+            segment_begin = segment_end;
+        }
+#if defined(__AVX512__) or defined(__AVX256__)
+        if (streaming) { _mm_sfence(); }
+#endif
     }
 }
 
-static void helper_memcpy_4(float* dest, float* src, size_t param_size)
+static bool is_native_copy_tensor(const torch::Tensor& tensor)
 {
-    size_t rounded_size = 0;
+    return tensor.is_cpu() && tensor.is_contiguous();
+}
 
-#if defined(__AVX512__) or defined(__AVX256__)
+// A contiguous CPU view at ptr with the shape and dtype of like.
+static torch::Tensor byte_range_view(char* ptr, const torch::Tensor& like)
+{
+    return torch::from_blob(ptr, like.sizes(), torch::TensorOptions().dtype(like.scalar_type()));
+}
 
-    rounded_size = ROUND_DOWN(param_size, (SIMD_WIDTH << 2));
-
-    for (size_t t = 0; t < rounded_size; t += TILE) {
-        size_t copy_size = TILE;
-        if ((t + TILE) > rounded_size) copy_size = rounded_size - t;
-        size_t offset = copy_size + t;
-#pragma omp parallel for
-        for (size_t i = t; i < offset; i += (SIMD_WIDTH << 2)) {
-            AVX_Data src_4[4];
-            src_4[0].data = SIMD_LOAD(src + i);
-            src_4[1].data = SIMD_LOAD(src + i + SIMD_WIDTH);
-            src_4[2].data = SIMD_LOAD(src + i + (SIMD_WIDTH << 1));
-            src_4[3].data = SIMD_LOAD(src + i + SIMD_WIDTH * 3);
-
-            SIMD_STORE(dest + i, src_4[0].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH, src_4[1].data);
-            SIMD_STORE(dest + i + (SIMD_WIDTH << 1), src_4[2].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH * 3, src_4[3].data);
-        }
+int deepspeed_py_memcpy(torch::Tensor& dest, const torch::Tensor& src)
+{
+    if (dest.nbytes() != src.nbytes()) {
+        std::cout << "deepspeed_memcpy failure: dest nbytes = " << dest.nbytes()
+                  << " != src nbytes = " << src.nbytes() << std::endl;
+        return -1;
     }
-#endif
-    if (param_size > rounded_size)
-        helper_memcpy_1((dest + rounded_size), (src + rounded_size), (param_size - rounded_size));
+
+    if (is_native_copy_tensor(dest)) { return deepspeed_py_memcpy_gather(dest, {src}); }
+
+    std::vector<torch::Tensor> dests = {dest};
+    if (is_native_copy_tensor(src)) { return deepspeed_py_memcpy_scatter(dests, src); }
+
+    dest.copy_(src);
+    return 0;
 }
 
-static void helper_mempcy_8(float* dest, float* src, size_t param_size)
+int deepspeed_py_memcpy_gather(torch::Tensor& dest, const std::vector<torch::Tensor>& srcs)
 {
-    size_t rounded_size = 0;
-
-#if defined(__AVX512__) or defined(__AVX256__)
+    size_t total_bytes = 0;
+    for (const auto& src : srcs) { total_bytes += src.nbytes(); }
+    if (!is_native_copy_tensor(dest) || total_bytes > dest.nbytes()) {
+        std::cout << "deepspeed_memcpy_gather failure: dest must be a contiguous cpu tensor of at "
+                  << "least " << total_bytes << " bytes" << std::endl;
+        return -1;
+    }
 
-    rounded_size = ROUND_DOWN(param_size, (SIMD_WIDTH << 2));
-
-    for (size_t t = 0; t < rounded_size; t += TILE) {
-        size_t copy_size = TILE;
-        if ((t + TILE) > rounded_size) copy_size = rounded_size - t;
-        size_t offset = copy_size + t;
-#pragma omp parallel for
-        for (size_t i = t; i < offset; i += (SIMD_WIDTH << 3)) {
-            AVX_Data src_4[8];
-            src_4[0].data = SIMD_LOAD(src + i);
-            src_4[1].data = SIMD_LOAD(src + i + SIMD_WIDTH);
-            src_4[2].data = SIMD_LOAD(src + i + (SIMD_WIDTH << 1));
-            src_4[3].data = SIMD_LOAD(src + i + SIMD_WIDTH * 3);
-            src_4[4].data = SIMD_LOAD(src + i + (SIMD_WIDTH << 2));
-            src_4[5].data = SIMD_LOAD(src + i + SIMD_WIDTH * 5);
-            src_4[6].data = SIMD_LOAD(src + i + SIMD_WIDTH * 6);
-            src_4[7].data = SIMD_LOAD(src + i + SIMD_WIDTH * 7);
-
-            SIMD_STORE(dest + i, src_4[0].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH, src_4[1].data);
-            SIMD_STORE(dest + i + (SIMD_WIDTH << 1), src_4[2].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH * 3, src_4[3].data);
-            SIMD_STORE(dest + i + (SIMD_WIDTH << 2), src_4[4].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH * 5, src_4[5].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH * 6, src_4[6].data);
-            SIMD_STORE(dest + i + SIMD_WIDTH * 7, src_4[7].data);
+    auto dest_ptr = (char*)dest.data_ptr();
+    std::vector<copy_segment_t> segments;
+    for (const auto& src : srcs) {
+        if (is_native_copy_tensor(src)) {
+            segments.push_back({dest_ptr, (const char*)src.data_ptr(), src.nbytes()});
+        } else {
+            byte_range_view(dest_ptr, src).copy_(src);
         }
+        dest_ptr += src.nbytes();
     }
-#endif
-    if (param_size > rounded_size)
-        helper_memcpy_4((dest + rounded_size), (src + rounded_size), (param_size - rounded_size));
+    parallel_copy(segments);
+
+    return 0;
 }
 
-int deepspeed_py_memcpy(torch::Tensor& dest, const torch::Tensor& src)
+int deepspeed_py_memcpy_scatter(std::vector<torch::Tensor>& dests, const torch::Tensor& src)
 {
-    auto dest_c = dest.contiguous();
-    auto src_c = src.contiguous();
-
-    float* dest_ptr = (float*)dest_c.data_ptr();
-    float* src_ptr = (float*)src_c.data_ptr();
+    size_t total_bytes = 0;
+    for (const auto& dest : dests) { total_bytes += dest.nbytes(); }
+    if (!is_native_copy_tensor(src) || total_bytes > src.nbytes()) {
+        std::cout << "deepspeed_memcpy_scatter failure: src must be a contiguous cpu tensor of at "
+                  << "least " << total_bytes << " bytes" << std::endl;
+        return -1;
+    }
 
-    helper_mempcy_8(dest_ptr, src_ptr, dest_c.size(0));
+    auto src_ptr = (char*)src.data_ptr();
+    std::vector<copy_segment_t> segments;
+    for (auto& dest : dests) {
+        if (is_native_copy_tensor(dest)) {
+            segments.push_back({(char*)dest.data_ptr(), src_ptr, dest.nbytes()});
+        } else {
+            dest.copy_(byte_range_view(src_ptr, dest));
+        }
+        src_ptr += dest.nbytes();
+    }
+    parallel_copy(segments);
 
     return 0;
 }
@@ -18,8 +18,7 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 #include <deepspeed_aio_common.h>
 #include <stdlib.h>
 #include <torch/extension.h>
-
-#define TILE (1024 * 1024 * 1024)
+#include <vector>
 
 #if defined(__AVX512__)
 #define SIMD_STORE(a, d) _mm512_storeu_ps(a, d)
@@ -30,6 +29,9 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 #define SIMD_SQRT(x) _mm512_sqrt_ps(x)
 #define SIMD_DIV(x, y) _mm512_div_ps(x, y)
 #define SIMD_WIDTH 16
+#define SIMD_LOAD_BYTES(x) _mm512_loadu_si512((const void*)(x))
+#define SIMD_STREAM_BYTES(a, d) _mm512_stream_si512((__m512i*)(a), d)
+#define SIMD_BYTES 64
 #else
 #if defined(__AVX256__)
 #define SIMD_STORE(a, d) _mm256_storeu_ps(a, d)
@@ -40,7 +42,18 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 #define SIMD_SQRT(x) _mm256_sqrt_ps(x)
 #define SIMD_DIV(x, y) _mm256_div_ps(x, y)
 #define SIMD_WIDTH 8
+#define SIMD_LOAD_BYTES(x) _mm256_loadu_si256((const __m256i*)(x))
+#define SIMD_STREAM_BYTES(a, d) _mm256_stream_si256((__m256i*)(a), d)
+#define SIMD_BYTES 32
 #endif
 #endif
 
+// Byte copies between tensors of any dtype. CPU copies are split into contiguous per-thread
+// byte ranges and use non-temporal stores when large; other tensors fall back to copy_().
 int deepspeed_py_memcpy(torch::Tensor& dest, const torch::Tensor& src);
+
+// Copy the tensors of srcs back to back into the start of dest.
+int deepspeed_py_memcpy_gather(torch::Tensor& dest, const std::vector<torch::Tensor>& srcs);
+
+// Fill the tensors of dests back to back from the start of src.
+int deepspeed_py_memcpy_scatter(std::vector<torch::Tensor>& dests, const torch::Tensor& src);
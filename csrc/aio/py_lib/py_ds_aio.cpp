@@ -9,6 +9,7 @@ Functionality for swapping optimizer tensors to/from (NVMe) storage devices.
 
 #include <torch/extension.h>
 #include "deepspeed_py_aio_handle.h"
+#include "deepspeed_py_aio_tuner.h"
 #include "deepspeed_py_copy.h"
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
@@ -19,6 +20,14 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 
     m.def("deepspeed_memcpy", &deepspeed_py_memcpy, "DeepSpeed Memory Copy");
 
+    m.def("deepspeed_memcpy_gather",
+          &deepspeed_py_memcpy_gather,
+          "DeepSpeed Memory Copy from a list of tensors");
+
+    m.def("deepspeed_memcpy_scatter",
+          &deepspeed_py_memcpy_scatter,
+          "DeepSpeed Memory Copy to a list of tensors");
+
     py::class_<deepspeed_aio_handle_t>(m, "aio_handle")
         .def(py::init<const int, const int, const bool, const bool, const int>())
 
@@ -27,20 +36,99 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
         .def("get_single_submit", &deepspeed_aio_handle_t::get_single_submit)
         .def("get_overlap_events", &deepspeed_aio_handle_t::get_overlap_events)
         .def("get_thread_count", &deepspeed_aio_handle_t::get_thread_count)
+        .def("get_adaptive_queue_depth", &deepspeed_aio_handle_t::get_adaptive_queue_depth)
+        .def("get_low_priority_bandwidth", &deepspeed_aio_handle_t::get_low_priority_bandwidth)
+
+        .def("set_adaptive_queue_depth", &deepspeed_aio_handle_t::set_adaptive_queue_depth)
+        .def("set_low_priority_bandwidth", &deepspeed_aio_handle_t::set_low_priority_bandwidth)
 
         .def("read", &deepspeed_aio_handle_t::read)
         .def("write", &deepspeed_aio_handle_t::write)
 
-        .def("pread", &deepspeed_aio_handle_t::pread)
-        .def("pwrite", &deepspeed_aio_handle_t::pwrite)
+        .def("pread",
+             &deepspeed_aio_handle_t::pread,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("validate"),
+             py::arg("async_op"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+        .def("pwrite",
+             &deepspeed_aio_handle_t::pwrite,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("validate"),
+             py::arg("async_op"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+
+        .def("convert_pread",
+             &deepspeed_aio_handle_t::convert_pread,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("file_example_tensor"),
+             py::arg("async_op"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+        .def("convert_pwrite",
+             &deepspeed_aio_handle_t::convert_pwrite,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("file_example_tensor"),
+             py::arg("async_op"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
 
-        .def("sync_pread", &deepspeed_aio_handle_t::sync_pread)
-        .def("sync_pwrite", &deepspeed_aio_handle_t::sync_pwrite)
-        .def("async_pread", &deepspeed_aio_handle_t::async_pread)
-        .def("async_pwrite", &deepspeed_aio_handle_t::async_pwrite)
+        .def("sync_pread",
+             &deepspeed_aio_handle_t::sync_pread,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+        .def("sync_pwrite",
+             &deepspeed_aio_handle_t::sync_pwrite,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+        .def("async_pread",
+             &deepspeed_aio_handle_t::async_pread,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
+        .def("async_pwrite",
+             &deepspeed_aio_handle_t::async_pwrite,
+             py::arg("buffer"),
+             py::arg("filename"),
+             py::arg("priority") = static_cast<int>(c_io_priority_normal),
+             py::arg("deadline_usec") = 0,
+             py::arg("file_offset") = 0)
 
         .def("new_cpu_locked_tensor", &deepspeed_aio_handle_t::new_cpu_locked_tensor)
         .def("free_cpu_locked_tensor", &deepspeed_aio_handle_t::free_cpu_locked_tensor)
 
         .def("wait", &deepspeed_aio_handle_t::wait);
+
+    py::class_<deepspeed_aio_tuner_t>(m, "aio_tuner")
+        .def(py::init<const char*,
+                      const long long int,
+                      const std::vector<int>&,
+                      const std::vector<int>&,
+                      const std::vector<int>&>())
+
+        .def("tune", &deepspeed_aio_tuner_t::tune)
+
+        .def("get_block_size", &deepspeed_aio_tuner_t::get_block_size)
+        .def("get_queue_depth", &deepspeed_aio_tuner_t::get_queue_depth)
+        .def("get_thread_count", &deepspeed_aio_tuner_t::get_thread_count)
+        .def("get_read_GB", &deepspeed_aio_tuner_t::get_read_GB)
+        .def("get_write_GB", &deepspeed_aio_tuner_t::get_write_GB);
 }
@@ -7,23 +7,40 @@
 
 #include <fcntl.h>
 #include <immintrin.h>
+#include <linux/futex.h>
+#include <linux/mempolicy.h>
 #include <math.h>
 #include <omp.h>
+#include <sched.h>
 #include <sys/mman.h>
 #include <sys/stat.h>
+#include <sys/syscall.h>
 #include <unistd.h>
+#include <chrono>
+#include <climits>
 #include <atomic>
+#include <condition_variable>
 #include <cstdlib>
+#include <deque>
+#include <functional>
+#include <future>
 #include <iostream>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <thread>
 #include <oneapi/ccl.hpp>
 
 // states for collectives
 enum coll_state {
     coll_begin = 0,
-    // coll states for naive allreduce
-    coll_allreduce_naive__copy_in_done,   // this state is for rank != 0
-    coll_allreduce_naive__reduce_done,    // this state is for rank == 0
-    coll_allreduce_naive__copy_out_done,  // this state is for rank != 0
+    // coll states for SHM collective steps, every rank cycles through them in order.
+    // Consecutive steps alternate between the two sets so that a rank which already moved on
+    // to the next step can be told apart from one that has not started the current one.
+    coll_allreduce_naive__copy_in_done,
+    coll_allreduce_naive__reduce_done,
+    coll_alt_allreduce_naive__copy_in_done,
+    coll_alt_allreduce_naive__reduce_done,
 };
 
 // SHM building blocks
@@ -70,31 +87,153 @@ void shared_close(SharedData* data)
 // SHM based allreduce helper functions
 // buffer that holds shm name
 #define NAME_BUF_SIZE 1000
-#define MAX_BUF_SIZE 1048576
+#define DEFAULT_SHM_CHUNK_SIZE 1048576
+#define SHM_CHUNK_ALIGNMENT 4096
+// Consecutive SHM collective steps use alternating buffers, so the copy-in of a step does not
+// have to wait for the other ranks to finish copying out the previous one.
+#define NUM_SHM_BUFFERS 2
 #define SHM_BUFFER_NAME "deepspeed_allreduce_buffer"
-SharedData allreduce_buffer;
+// Per-rank control block, on a cache line of its own so that ranks do not false share states.
+// Every rank of a group has an SHM region of its own, bound to the NUMA node the rank runs on,
+// which holds its control block followed by its NUM_SHM_BUFFERS buffers of shm_chunk_size bytes.
 struct allreduce_workspace {
-    enum coll_state state;
-    char buffer[MAX_BUF_SIZE];
+    alignas(64) enum coll_state state;
+    // number of ranks sleeping on a futex until state changes
+    std::atomic<int> num_sleepers;
 };
-struct allreduce_workspace* workspace;
+// SHM workspace of a group of local ranks. Ranks are indexed by their rank within the group.
+struct shm_group_t {
+    // SHM region of each group rank
+    std::vector<SharedData> rank_buffers;
+    // workspace[r] is the control block of group rank r
+    std::vector<struct allreduce_workspace*> workspace;
+    // buffers[b][r] is where buffer b of group rank r is mapped in this process
+    std::vector<char*> buffers[NUM_SHM_BUFFERS];
+    // Buffer used by the next SHM collective step of this group. All SHM collectives share it,
+    // so they can be issued in any order as long as every rank issues the same sequence.
+    int current_buffer;
+    int rank;
+    int size;
+    // Slices this rank owns in a hierarchical allreduce, kept across calls so that they are not
+    // reallocated every time.
+    std::vector<char> hierarchy_slices;
+};
+// SHM workspaces keyed by the world ranks of the group, in group rank order, like
+// group_to_comm_id
+std::map<std::vector<int>, shm_group_t> shm_groups;
+// Size of each SHM buffer, which is also the allreduce chunk size. It can be set at init time
+// through the DS_SHM_ALLREDUCE_CHUNK_SIZE environment variable.
+size_t shm_chunk_size = DEFAULT_SHM_CHUNK_SIZE;
+// How long a rank waiting on another rank's state busy-spins, then yields its core, before it
+// goes to sleep on a futex. It can be set at init time through the DS_SHM_SPIN_BUDGET_US
+// environment variable: a large budget keeps latency low when every rank has a core of its own,
+// a small one frees the cores when ranks share them with each other or with compute threads.
+#define DEFAULT_SHM_SPIN_BUDGET_US 100
+long long shm_spin_budget_us = DEFAULT_SHM_SPIN_BUDGET_US;
+
+size_t shm_rank_workspace_size()
+{
+    return sizeof(struct allreduce_workspace) + NUM_SHM_BUFFERS * shm_chunk_size;
+}
 
-void wait_buffer_state_until(int index, enum coll_state state)
+// Map the SHM region of group rank r, mapped at shm_bytes in this process.
+void map_shm_rank_buffers(shm_group_t* group, int r, void* shm_bytes)
 {
-    volatile enum coll_state* state_ptr = &(workspace[index].state);
+    group->workspace.resize(group->size);
+    group->workspace[r] = (struct allreduce_workspace*)shm_bytes;
+    char* buffer_bytes = (char*)shm_bytes + sizeof(struct allreduce_workspace);
+    for (int b = 0; b < NUM_SHM_BUFFERS; b++) {
+        group->buffers[b].resize(group->size);
+        group->buffers[b][r] = buffer_bytes + b * shm_chunk_size;
+    }
+}
 
-    while (*state_ptr != state)
-        ;
+// Bind an SHM region to the NUMA node this rank runs on and move pages that were allocated on
+// another node. Best effort: the region stays usable when the kernel lacks NUMA support.
+static void bind_to_local_numa_node(void* bytes, size_t nbytes)
+{
+    unsigned cpu, node;
+    if (syscall(SYS_getcpu, &cpu, &node, NULL) != 0) return;
+    const size_t bits_per_word = 8 * sizeof(unsigned long);
+    std::vector<unsigned long> nodemask(node / bits_per_word + 1, 0);
+    nodemask[node / bits_per_word] |= 1ul << (node % bits_per_word);
+    syscall(SYS_mbind,
+            bytes,
+            nbytes,
+            MPOL_PREFERRED,
+            nodemask.data(),
+            nodemask.size() * bits_per_word,
+            MPOL_MF_MOVE);
 }
 
-void wait_buffer_state_until_not(int index, enum coll_state state)
+static long futex(void* addr, int op, int val)
 {
-    volatile enum coll_state* state_ptr = &(workspace[index].state);
+    return syscall(SYS_futex, addr, op, val, NULL, NULL, 0);
+}
 
-    while (*state_ptr == state)
-        ;
+void set_buffer_state(shm_group_t* group, int index, enum coll_state state)
+{
+    auto workspace = group->workspace.data();
+    // seq_cst so that either a rank about to sleep sees the new state, or we see it sleeping
+    __atomic_store_n(&(workspace[index]->state), state, __ATOMIC_SEQ_CST);
+    if (workspace[index]->num_sleepers.load() > 0) {
+        futex(&(workspace[index]->state), FUTEX_WAKE, INT_MAX);
+    }
 }
 
+// Wait until a rank reaches state0, or has already moved on to the state that follows it.
+// Spins with pause for shm_spin_budget_us, then yields for as long again, then sleeps on a futex.
+void wait_buffer_state_until_2(shm_group_t* group,
+                               int index,
+                               enum coll_state state0,
+                               enum coll_state state1)
+{
+    auto workspace = group->workspace.data();
+    volatile enum coll_state* state_ptr = &(workspace[index]->state);
+    auto state_reached = [&]() {
+        enum coll_state cur_state = *state_ptr;
+        return cur_state == state0 || cur_state == state1;
+    };
+
+    if (state_reached()) return;
+
+    auto start = std::chrono::steady_clock::now();
+    auto budget = std::chrono::microseconds(shm_spin_budget_us);
+    while (std::chrono::steady_clock::now() - start < budget) {
+        // check the clock only every so often, it costs more than a pause
+        for (int i = 0; i < 64; i++) {
+            if (state_reached()) return;
+            _mm_pause();
+        }
+    }
+    while (std::chrono::steady_clock::now() - start < 2 * budget) {
+        if (state_reached()) return;
+        sched_yield();
+    }
+
+    workspace[index]->num_sleepers++;
+    while (true) {
+        auto cur_state = __atomic_load_n(&(workspace[index]->state), __ATOMIC_SEQ_CST);
+        if (cur_state == state0 || cur_state == state1) break;
+        // returns right away if the state already changed from cur_state
+        futex(&(workspace[index]->state), FUTEX_WAIT, cur_state);
+    }
+    workspace[index]->num_sleepers--;
+}
+
+// Instruction sets the SHM kernels can use. The best one the CPU supports is picked at load time,
+// DS_SHM_ISA=avx2 or DS_SHM_ISA=scalar forces a lower one.
+enum shm_isa_t { shm_isa_scalar, shm_isa_avx2, shm_isa_avx512 };
+
+static shm_isa_t detect_shm_isa()
+{
+    if (__builtin_cpu_supports("avx512bw")) return shm_isa_avx512;
+    if (__builtin_cpu_supports("avx2") && __builtin_cpu_supports("f16c")) return shm_isa_avx2;
+    return shm_isa_scalar;
+}
+
+shm_isa_t shm_isa = detect_shm_isa();
+
 __m512 cvt_bf16_to_fp32(const __m256i src) __attribute__((target("avx512bw")));
 inline __m512 cvt_bf16_to_fp32(const __m256i src)
 {
@@ -123,151 +262,328 @@ inline __m256i cvt_fp32_to_bf16(const __m512 src)
     return _mm512_cvtusepi32_epi16(t_value);
 }
 
-void reduce_2_bf16_buffers(int num_elements, void* in_out, void* in)
-    __attribute__((target("avx512bw")));
+inline __m256 cvt_bf16_to_fp32_avx2(const __m128i src) __attribute__((target("avx2")));
+inline __m256 cvt_bf16_to_fp32_avx2(const __m128i src)
+{
+    auto y = _mm256_cvtepu16_epi32(src);
+    return _mm256_castsi256_ps(_mm256_slli_epi32(y, 16));
+}
 
-void reduce_bf16_buffers(int num_elements, int num_buffers, struct allreduce_workspace* workspace)
-    __attribute__((target("avx512bw")));
+inline __m128i cvt_fp32_to_bf16_avx2(const __m256 src) __attribute__((target("avx2")));
+inline __m128i cvt_fp32_to_bf16_avx2(const __m256 src)
+{
+    // same rounding as cvt_fp32_to_bf16
+    __m256i value = _mm256_castps_si256(src);
+    __m256i nan = _mm256_set1_epi32(0xffff);
+    __m256i mask_value = _mm256_castps_si256(_mm256_cmp_ps(src, src, _CMP_ORD_Q));
+    __m256i ones = _mm256_set1_epi32(0x1);
+    __m256i vec_bias = _mm256_set1_epi32(0x7fff);
+    auto t_value = _mm256_and_si256(_mm256_srli_epi32(value, 16), ones);
+    t_value = _mm256_add_epi32(t_value, vec_bias);
+    t_value = _mm256_add_epi32(t_value, value);
+    t_value = _mm256_srli_epi32(t_value, 16);
+    t_value = _mm256_blendv_epi8(nan, t_value, mask_value);
+    // packus packs within 128-bit lanes, gather the low 64 bits of both lanes
+    t_value = _mm256_packus_epi32(t_value, t_value);
+    t_value = _mm256_permute4x64_epi64(t_value, 0xd8);
+    return _mm256_castsi256_si128(t_value);
+}
 
-void reduce_2_fp32_buffers(int num_elements, void* in_out, void* in)
+void reduce_bf16_buffers_avx512(int start_offset,
+                                int num_bytes,
+                                int num_buffers,
+                                int to_buffer_idx,
+                                char** buffers)
     __attribute__((target("avx512bw")));
 
-void reduce_fp32_buffers(int num_elements, int num_buffers, struct allreduce_workspace* workspace)
+void reduce_fp16_buffers_avx512(int start_offset,
+                                int num_bytes,
+                                int num_buffers,
+                                int to_buffer_idx,
+                                char** buffers)
     __attribute__((target("avx512bw")));
 
-// N_REDUCE_LIMIT is the number of buffers that can be reduced together in one shot.
-// Compared with do N-1 2-reduces which needs 2*(N-1) read and N-1 write,
-// N-reduce only needs N read and 1 write, this saves 2/3 memory bandwidth.
-// When increase N_REDUCE_LIMIT to a bigger number, do the following steps
-// 1. Extend REPEAT_<X> macros list down below
-// 2. Extend switch cases which call "REPEAT(X, ...)" down below
-#define N_REDUCE_LIMIT 8
+void reduce_bf16_buffers_avx2(int start_offset,
+                              int num_bytes,
+                              int num_buffers,
+                              int to_buffer_idx,
+                              char** buffers)
+    __attribute__((target("avx2")));
+
+void reduce_fp16_buffers_avx2(int start_offset,
+                              int num_bytes,
+                              int num_buffers,
+                              int to_buffer_idx,
+                              char** buffers)
+    __attribute__((target("avx2,f16c")));
+
+// The fp32 and integer kernels only need 256-bit vectors, so AVX-512 CPUs use them as well
+void reduce_fp32_buffers(int start_offset,
+                         int num_bytes,
+                         int num_buffers,
+                         int to_buffer_idx,
+                         char** buffers)
+    __attribute__((target("avx2")));
+
+void reduce_int32_buffers(int start_offset,
+                          int num_bytes,
+                          int num_buffers,
+                          int to_buffer_idx,
+                          char** buffers)
+    __attribute__((target("avx2")));
+
+void reduce_int64_buffers(int start_offset,
+                          int num_bytes,
+                          int num_buffers,
+                          int to_buffer_idx,
+                          char** buffers)
+    __attribute__((target("avx2")));
 
-void reduce_all_buffers(struct allreduce_workspace* workspace,
-                        int num_elements,
-                        c10::ScalarType scalar_type,
-                        int num_buffers)
+// Reduce functions down below use vectorized algorithm, the number of bytes processed each
+// iteration depends on vector length.  256bit vector ==> 32 bytes, 512bit vector ==> 64 bytes
+// If you change implementation of reduce_bf16_buffers or reduce_fp32_buffers, check
+// whether this number needs to be changed
+#define VECTOR_LENGTH_IN_BYTES 32
+
+// Data types the SHM collectives can reduce
+bool is_shm_reduce_type(c10::ScalarType scalar_type)
 {
     switch (scalar_type) {
         case c10::ScalarType::BFloat16:
-            if (num_buffers > 2 && num_buffers <= N_REDUCE_LIMIT) {
-                reduce_bf16_buffers(num_elements, num_buffers, workspace);
-            } else {
-                for (int i = 1; i < num_buffers; i++) {
-                    reduce_2_bf16_buffers(num_elements, workspace[0].buffer, workspace[i].buffer);
+        case c10::ScalarType::Half:
+        case c10::ScalarType::Float:
+        case c10::ScalarType::Int:
+        case c10::ScalarType::Long: return true;
+        default: return false;
+    }
+}
+
+// Reduce the bytes that do not fill a whole vector one element at a time, accumulating in
+// acc_t like the vector kernels do
+template <typename scalar_t, typename acc_t>
+void reduce_tail(int start_offset,
+                 int num_bytes,
+                 int num_buffers,
+                 int to_buffer_idx,
+                 char** buffers)
+{
+    for (int i = start_offset; i < start_offset + num_bytes; i += sizeof(scalar_t)) {
+        acc_t sum = *(scalar_t*)(buffers[0] + i);
+        for (int j = 1; j < num_buffers; j++) { sum += *(scalar_t*)(buffers[j] + i); }
+        *(scalar_t*)(buffers[to_buffer_idx] + i) = sum;
+    }
+}
+
+// Reduce bytes [start_offset, start_offset + num_bytes) of all buffers into the same range of
+// buffers[to_buffer_idx]. num_bytes needs to be a multiple of the element size only, bytes past
+// the last whole vector are reduced by scalar code.
+// All buffers are reduced in one pass whatever their number: N reads and 1 write per vector,
+// where N-1 2-way reduces would need 2*(N-1) reads and N-1 writes.
+void reduce_all_buffers(char** buffers,
+                        int start_offset,
+                        int num_bytes,
+                        c10::ScalarType scalar_type,
+                        int num_buffers,
+                        int to_buffer_idx)
+{
+    // without AVX2 the scalar code reduces everything. The vector kernels are only called with
+    // work to do, as their prologue may already use instructions this CPU does not have.
+    const int vector_bytes = shm_isa == shm_isa_scalar
+                                 ? 0
+                                 : num_bytes / VECTOR_LENGTH_IN_BYTES * VECTOR_LENGTH_IN_BYTES;
+    const int tail_offset = start_offset + vector_bytes;
+    const int tail_bytes = num_bytes - vector_bytes;
+    const bool avx512 = shm_isa == shm_isa_avx512;
+    if (vector_bytes > 0) {
+        switch (scalar_type) {
+            case c10::ScalarType::BFloat16:
+                if (avx512) {
+                    reduce_bf16_buffers_avx512(
+                        start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                } else {
+                    reduce_bf16_buffers_avx2(
+                        start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
                 }
-            }
+                break;
+            case c10::ScalarType::Half:
+                if (avx512) {
+                    reduce_fp16_buffers_avx512(
+                        start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                } else {
+                    reduce_fp16_buffers_avx2(
+                        start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                }
+                break;
+            case c10::ScalarType::Float:
+                reduce_fp32_buffers(
+                    start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                break;
+            case c10::ScalarType::Int:
+                reduce_int32_buffers(
+                    start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                break;
+            case c10::ScalarType::Long:
+                reduce_int64_buffers(
+                    start_offset, vector_bytes, num_buffers, to_buffer_idx, buffers);
+                break;
+            default: assert(!"Should not get here");
+        }
+    }
+    switch (scalar_type) {
+        case c10::ScalarType::BFloat16:
+            reduce_tail<c10::BFloat16, float>(
+                tail_offset, tail_bytes, num_buffers, to_buffer_idx, buffers);
+            break;
+        case c10::ScalarType::Half:
+            reduce_tail<c10::Half, float>(
+                tail_offset, tail_bytes, num_buffers, to_buffer_idx, buffers);
             break;
         case c10::ScalarType::Float:
-            if (num_buffers > 2 && num_buffers <= N_REDUCE_LIMIT) {
-                reduce_fp32_buffers(num_elements, num_buffers, workspace);
-            } else {
-                for (int i = 1; i < num_buffers; i++) {
-                    reduce_2_fp32_buffers(num_elements, workspace[0].buffer, workspace[i].buffer);
-                }
-            }
+            reduce_tail<float, float>(tail_offset, tail_bytes, num_buffers, to_buffer_idx, buffers);
+            break;
+        case c10::ScalarType::Int:
+            reduce_tail<int32_t, int32_t>(
+                tail_offset, tail_bytes, num_buffers, to_buffer_idx, buffers);
+            break;
+        case c10::ScalarType::Long:
+            reduce_tail<int64_t, int64_t>(
+                tail_offset, tail_bytes, num_buffers, to_buffer_idx, buffers);
             break;
         default: assert(!"Should not get here");
     }
 }
 
-#define REPEAT(N, x) REPEAT_##N(x)
-#define REPEAT_1(x) x(1)
-#define REPEAT_2(x) \
-    REPEAT_1(x);    \
-    x(2)
-#define REPEAT_3(x) \
-    REPEAT_2(x);    \
-    x(3)
-#define REPEAT_4(x) \
-    REPEAT_3(x);    \
-    x(4)
-#define REPEAT_5(x) \
-    REPEAT_4(x);    \
-    x(5)
-#define REPEAT_6(x) \
-    REPEAT_5(x);    \
-    x(6)
-#define REPEAT_7(x) \
-    REPEAT_6(x);    \
-    x(7)
-
-#define CVT_ADD_BF16(x)                                                                \
-    do {                                                                               \
-        auto in##x##_val =                                                             \
-            cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)(workspace[x].buffer + i))); \
-        inout_val = _mm512_add_ps(inout_val, in##x##_val);                             \
-    } while (0)
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_bf16_buffers_avx512(int start_offset,
+                                int num_bytes,
+                                int num_buffers,
+                                int to_buffer_idx,
+                                char** buffers)
+{
+#pragma omp parallel for
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        auto inout_val = cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)(buffers[0] + i)));
+        for (int j = 1; j < num_buffers; j++) {
+            auto in_val = cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)(buffers[j] + i)));
+            inout_val = _mm512_add_ps(inout_val, in_val);
+        }
+        _mm256_storeu_si256((__m256i*)(buffers[to_buffer_idx] + i), cvt_fp32_to_bf16(inout_val));
+    }
+}
 
-// Reduce functions down below use vectorized algorithm, the number of bytes processed each
-// iteration depends on vector length.  256bit vector ==> 32 bytes, 512bit vector ==> 64 bytes
-// If you change implementation of reduce_2_bf16_buffers or reduce_2_fp32_buffers, check
-// whether this number needs to be changed
-#define VECTOR_LENGTH_IN_BYTES 32
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_fp16_buffers_avx512(int start_offset,
+                                int num_bytes,
+                                int num_buffers,
+                                int to_buffer_idx,
+                                char** buffers)
+{
+#pragma omp parallel for
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        auto inout_val = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i*)(buffers[0] + i)));
+        for (int j = 1; j < num_buffers; j++) {
+            auto in_val = _mm512_cvtph_ps(_mm256_loadu_si256((__m256i*)(buffers[j] + i)));
+            inout_val = _mm512_add_ps(inout_val, in_val);
+        }
+        _mm256_storeu_si256((__m256i*)(buffers[to_buffer_idx] + i),
+                            _mm512_cvtps_ph(inout_val, _MM_FROUND_TO_NEAREST_INT));
+    }
+}
 
-// num_elements must be divisible by 16 (caller check)
-void reduce_bf16_buffers(int num_elements, int num_buffers, struct allreduce_workspace* workspace)
+// AVX2 versions of the 16-bit kernels handle a vector as two halves of 8 elements.
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_bf16_buffers_avx2(int start_offset,
+                              int num_bytes,
+                              int num_buffers,
+                              int to_buffer_idx,
+                              char** buffers)
 {
 #pragma omp parallel for
-    for (int i = 0; i < num_elements * 2; i += VECTOR_LENGTH_IN_BYTES) {
-        auto inout_val = cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)(workspace[0].buffer + i)));
-        switch (num_buffers) {
-            case 8: REPEAT(7, CVT_ADD_BF16); break;
-            case 7: REPEAT(6, CVT_ADD_BF16); break;
-            case 6: REPEAT(5, CVT_ADD_BF16); break;
-            case 5: REPEAT(4, CVT_ADD_BF16); break;
-            case 4: REPEAT(3, CVT_ADD_BF16); break;
-            case 3: REPEAT(2, CVT_ADD_BF16); break;
-            default: assert(!"Should not get here.");
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        for (int half = i; half < i + VECTOR_LENGTH_IN_BYTES; half += 16) {
+            auto inout_val = cvt_bf16_to_fp32_avx2(_mm_loadu_si128((__m128i*)(buffers[0] + half)));
+            for (int j = 1; j < num_buffers; j++) {
+                auto in_val = cvt_bf16_to_fp32_avx2(_mm_loadu_si128((__m128i*)(buffers[j] + half)));
+                inout_val = _mm256_add_ps(inout_val, in_val);
+            }
+            _mm_storeu_si128((__m128i*)(buffers[to_buffer_idx] + half),
+                             cvt_fp32_to_bf16_avx2(inout_val));
         }
-        _mm256_storeu_si256((__m256i*)(workspace[0].buffer + i), cvt_fp32_to_bf16(inout_val));
     }
 }
 
-void reduce_2_bf16_buffers(int num_elements, void* in_out, void* in1)
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_fp16_buffers_avx2(int start_offset,
+                              int num_bytes,
+                              int num_buffers,
+                              int to_buffer_idx,
+                              char** buffers)
 {
 #pragma omp parallel for
-    for (int i = 0; i < num_elements * 2; i += VECTOR_LENGTH_IN_BYTES) {
-        auto inout_val = cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)((char*)in_out + i)));
-        auto in1_val = cvt_bf16_to_fp32(_mm256_loadu_si256((__m256i*)((char*)in1 + i)));
-        inout_val = _mm512_add_ps(inout_val, in1_val);
-        _mm256_storeu_si256((__m256i*)((char*)in_out + i), cvt_fp32_to_bf16(inout_val));
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        for (int half = i; half < i + VECTOR_LENGTH_IN_BYTES; half += 16) {
+            auto inout_val = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(buffers[0] + half)));
+            for (int j = 1; j < num_buffers; j++) {
+                auto in_val = _mm256_cvtph_ps(_mm_loadu_si128((__m128i*)(buffers[j] + half)));
+                inout_val = _mm256_add_ps(inout_val, in_val);
+            }
+            _mm_storeu_si128((__m128i*)(buffers[to_buffer_idx] + half),
+                             _mm256_cvtps_ph(inout_val, _MM_FROUND_TO_NEAREST_INT));
+        }
     }
 }
 
-#define CVT_ADD_F32(x)                                                         \
-    do {                                                                       \
-        auto in##x##_val = _mm256_loadu_ps((float*)(workspace[x].buffer + i)); \
-        inout_val = _mm256_add_ps(inout_val, in##x##_val);                     \
-    } while (0)
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_fp32_buffers(int start_offset,
+                         int num_bytes,
+                         int num_buffers,
+                         int to_buffer_idx,
+                         char** buffers)
+{
+#pragma omp parallel for
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        auto inout_val = _mm256_loadu_ps((float*)(buffers[0] + i));
+        for (int j = 1; j < num_buffers; j++) {
+            auto in_val = _mm256_loadu_ps((float*)(buffers[j] + i));
+            inout_val = _mm256_add_ps(inout_val, in_val);
+        }
+        _mm256_storeu_ps((float*)(buffers[to_buffer_idx] + i), inout_val);
+    }
+}
 
-// num_elements must be divisible by 16 (caller check)
-void reduce_fp32_buffers(int num_elements, int num_buffers, struct allreduce_workspace* workspace)
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_int32_buffers(int start_offset,
+                          int num_bytes,
+                          int num_buffers,
+                          int to_buffer_idx,
+                          char** buffers)
 {
 #pragma omp parallel for
-    for (int i = 0; i < num_elements * 4; i += VECTOR_LENGTH_IN_BYTES) {
-        auto inout_val = _mm256_loadu_ps((float*)(workspace[0].buffer + i));
-        switch (num_buffers) {
-            case 8: REPEAT(7, CVT_ADD_F32); break;
-            case 7: REPEAT(6, CVT_ADD_F32); break;
-            case 6: REPEAT(5, CVT_ADD_F32); break;
-            case 5: REPEAT(4, CVT_ADD_F32); break;
-            case 4: REPEAT(3, CVT_ADD_F32); break;
-            case 3: REPEAT(2, CVT_ADD_F32); break;
-            default: assert(!"Should not get here.");
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        auto inout_val = _mm256_loadu_si256((__m256i*)(buffers[0] + i));
+        for (int j = 1; j < num_buffers; j++) {
+            auto in_val = _mm256_loadu_si256((__m256i*)(buffers[j] + i));
+            inout_val = _mm256_add_epi32(inout_val, in_val);
         }
-        _mm256_storeu_ps((float*)(workspace[0].buffer + i), inout_val);
+        _mm256_storeu_si256((__m256i*)(buffers[to_buffer_idx] + i), inout_val);
     }
 }
 
-void reduce_2_fp32_buffers(int num_elements, void* in_out, void* in1)
+// num_bytes must be divisible by VECTOR_LENGTH_IN_BYTES (caller check)
+void reduce_int64_buffers(int start_offset,
+                          int num_bytes,
+                          int num_buffers,
+                          int to_buffer_idx,
+                          char** buffers)
 {
 #pragma omp parallel for
-    for (int i = 0; i < num_elements * 4; i += VECTOR_LENGTH_IN_BYTES) {
-        auto inout_val = _mm256_loadu_ps((float*)((char*)in_out + i));
-        auto in1_val = _mm256_loadu_ps((float*)((char*)in1 + i));
-        inout_val = _mm256_add_ps(inout_val, in1_val);
-        _mm256_storeu_ps((float*)((char*)in_out + i), inout_val);
+    for (int i = start_offset; i < start_offset + num_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+        auto inout_val = _mm256_loadu_si256((__m256i*)(buffers[0] + i));
+        for (int j = 1; j < num_buffers; j++) {
+            auto in_val = _mm256_loadu_si256((__m256i*)(buffers[j] + i));
+            inout_val = _mm256_add_epi64(inout_val, in_val);
+        }
+        _mm256_storeu_si256((__m256i*)(buffers[to_buffer_idx] + i), inout_val);
     }
 }
 
@@ -306,6 +622,66 @@ ccl::shared_ptr_class<ccl::kvs> kvs;
 
 bool all_ranks_local_p = false;
 
+// Multi-node jobs: SHM workspace of this node's ranks, and the ranks with the same local rank on
+// every node. Set by initialize_hierarchy().
+shm_group_t* node_shm_group = nullptr;
+std::vector<int> node_peer_ranks;
+
+// FNV-1a hash of an ordered list of ranks, short enough to go in names of any group size
+static uint64_t hash_ranks(const std::vector<int>& ranks)
+{
+    uint64_t ranks_hash = 14695981039346656037ull;
+    for (int r : ranks) { ranks_hash = (ranks_hash ^ (uint64_t)r) * 1099511628211ull; }
+    return ranks_hash;
+}
+
+// Create the SHM workspace of a group of local ranks. Every rank creates its own SHM region, so its
+// pages are allocated on the rank's NUMA node, then opens the other ranks' regions once comm's
+// barrier says they exist. Each rank copies into and reduces into its own region, so cross-socket
+// traffic is limited to reading the other ranks' slices once per collective step.
+void create_shm_group(const std::vector<int>& ranks, int rank, ccl::communicator& comm)
+{
+    auto addr_string = std::getenv("MASTER_ADDR");
+    if (addr_string == NULL) { addr_string = ""; }
+    auto port_string = std::getenv("MASTER_PORT");
+    if (port_string == NULL) { port_string = ""; }
+    // Groups are named after their ordered ranks so that every member opens the same region, and
+    // groups of the same ranks in another order, whose group ranks differ, do not.
+    char name_suffix[32];
+    snprintf(name_suffix, sizeof(name_suffix), "_%016llx", (unsigned long long)hash_ranks(ranks));
+    char shm_name[NAME_BUF_SIZE];
+    snprintf(shm_name,
+             NAME_BUF_SIZE,
+             "%s_%d_%s_%s%s",
+             SHM_BUFFER_NAME,
+             getuid(),
+             addr_string,
+             port_string,
+             name_suffix);
+
+    auto& group = shm_groups[ranks];
+    group.current_buffer = 0;
+    group.rank = rank;
+    group.size = ranks.size();
+    group.rank_buffers.resize(group.size);
+    const size_t nbytes = shm_rank_workspace_size();
+    char rank_shm_name[NAME_BUF_SIZE];
+    snprintf(rank_shm_name, NAME_BUF_SIZE, "%s_%d", shm_name, rank);
+    auto shm_bytes = calloc(1, nbytes);
+    shared_create(&group.rank_buffers[rank], rank_shm_name, shm_bytes, nbytes);
+    free(shm_bytes);
+    bind_to_local_numa_node(group.rank_buffers[rank].bytes, nbytes);
+    ((struct allreduce_workspace*)group.rank_buffers[rank].bytes)->state = coll_begin;
+    CCLCHECK(ccl::barrier(comm).wait());
+    for (int r = 0; r < group.size; r++) {
+        if (r != rank) {
+            snprintf(rank_shm_name, NAME_BUF_SIZE, "%s_%d", shm_name, r);
+            shared_open(&group.rank_buffers[r], rank_shm_name, nbytes);
+        }
+        map_shm_rank_buffers(&group, r, group.rank_buffers[r].bytes);
+    }
+}
+
 void initialize(int size, int rank, torch::Tensor& kvs_data)
 {
     if (is_initialized) return;
@@ -319,6 +695,27 @@ void initialize(int size, int rank, torch::Tensor& kvs_data)
 
     if (size >= 1 && size == ls) { all_ranks_local_p = true; }
 
+    auto spin_budget_string = std::getenv("DS_SHM_SPIN_BUDGET_US");
+    if (spin_budget_string != NULL) { shm_spin_budget_us = std::stoll(spin_budget_string); }
+
+    auto chunk_size_string = std::getenv("DS_SHM_ALLREDUCE_CHUNK_SIZE");
+    if (chunk_size_string != NULL) {
+        auto chunk_size = std::stoll(chunk_size_string);
+        shm_chunk_size = std::max<long long>(
+            SHM_CHUNK_ALIGNMENT, chunk_size / SHM_CHUNK_ALIGNMENT * SHM_CHUNK_ALIGNMENT);
+    }
+
+    // can only lower the detected instruction set
+    auto isa_string = std::getenv("DS_SHM_ISA");
+    if (isa_string != NULL) {
+        std::string isa(isa_string);
+        if (isa == "scalar") {
+            shm_isa = shm_isa_scalar;
+        } else if (isa == "avx2") {
+            shm_isa = std::min(shm_isa, shm_isa_avx2);
+        }
+    }
+
     world_size = size;
     world_rank = rank;
     is_initialized = 1;
@@ -332,33 +729,11 @@ void initialize(int size, int rank, torch::Tensor& kvs_data)
 
     _ccl_comms.emplace_back(ccl::create_communicator(size, rank, kvs));
 
-    auto addr_string = std::getenv("MASTER_ADDR");
-    if (addr_string == NULL) { addr_string = ""; }
-    auto port_string = std::getenv("MASTER_PORT");
-    if (port_string == NULL) { port_string = ""; }
-    char shm_name[NAME_BUF_SIZE];
-    snprintf(shm_name,
-             NAME_BUF_SIZE,
-             "%s_%d_%s_%s",
-             SHM_BUFFER_NAME,
-             getuid(),
-             addr_string,
-             port_string);
     // create shared workspace for SHM based allreduce
     if (all_ranks_local_p) {
-        if (rank == 0) {
-            workspace =
-                (struct allreduce_workspace*)malloc(size * sizeof(struct allreduce_workspace));
-            shared_create(
-                &allreduce_buffer, shm_name, workspace, size * sizeof(struct allreduce_workspace));
-            workspace = (struct allreduce_workspace*)allreduce_buffer.bytes;
-            for (int i = 0; i < size; i++) { workspace[i].state = coll_begin; }
-        }
-        CCLCHECK(ccl::barrier(_get_comm_from_group()).wait());
-        if (rank != 0) {
-            shared_open(&allreduce_buffer, shm_name, size * sizeof(struct allreduce_workspace));
-        }
-        workspace = (struct allreduce_workspace*)allreduce_buffer.bytes;
+        std::vector<int> ranks(size);
+        for (int i = 0; i < size; i++) { ranks[i] = i; }
+        create_shm_group(ranks, rank, _get_comm_from_group());
     }
 }
 
@@ -427,6 +802,29 @@ void initialize_sub_comm(int size, int rank, torch::Tensor& kvs_data, std::vecto
     }
     _ccl_comms.push_back(ccl::create_communicator(size, rank, sub_kvs));
     group_to_comm_id[ranks] = _ccl_comms.size() - 1;
+
+    // sub-groups of local ranks get SHM workspaces of their own
+    if (all_ranks_local_p) { create_shm_group(ranks, rank, _ccl_comms.back()); }
+}
+
+/*
+    Multi-node jobs: node_ranks are the ranks on this node and peer_ranks the ranks at the same
+    position in their node's ranks on every node, as found from where the ranks run. Both groups
+    must already have communicators from initialize_sub_comm. The world allreduce then reduces
+    within the node over SHM and only sends 1/local_size of the data over the network.
+*/
+void initialize_hierarchy(std::vector<int> node_ranks, std::vector<int> peer_ranks)
+{
+    if (all_ranks_local_p) return;
+    if (std::find(node_ranks.begin(), node_ranks.end(), world_rank) == node_ranks.end() ||
+        std::find(peer_ranks.begin(), peer_ranks.end(), world_rank) == peer_ranks.end()) {
+        return;
+    }
+
+    int rank = std::find(node_ranks.begin(), node_ranks.end(), world_rank) - node_ranks.begin();
+    create_shm_group(node_ranks, rank, _get_comm_from_group(node_ranks));
+    node_shm_group = &shm_groups[node_ranks];
+    node_peer_ranks = peer_ranks;
 }
 
 ccl::datatype get_ccl_datatype(c10::ScalarType type)
@@ -479,70 +877,715 @@ ccl::reduction get_ccl_reduce_op(py::object op, at::Tensor& input)
     return ccl_op;
 }
 
-void broadcast(torch::Tensor& data, int src, std::vector<int> group, bool async_op)
+// Collective statistics and tracing, both off until enabled. With statistics on, every collective
+// counts its calls, bytes and latency per path (SHM or oneCCL). SHM collectives also histogram the
+// time their steps spend copying in, waiting for the other ranks, reducing and copying out.
+// Latency runs from the call until the collective completes, or is waited on for asynchronous
+// oneCCL collectives. Histogram bucket i counts times below 2^i microseconds that do not fit in
+// bucket i - 1.
+#define COLL_HIST_BUCKETS 32
+// trace events kept until dump_trace, further ones are dropped
+#define MAX_TRACE_EVENTS (1 << 20)
+// first Chrome trace row of in-flight asynchronous oneCCL collectives, threads use the rows below
+#define ASYNC_TRACE_TID_BASE 1000
+
+enum coll_id_t {
+    coll_all_reduce,
+    coll_all_reduce_caching,
+    coll_inference_all_reduce,
+    coll_all_reduce_coalesced,
+    coll_broadcast,
+    coll_all_gather,
+    coll_all_gather_into_tensor,
+    coll_reduce_scatter_tensor,
+    coll_all_to_all_single,
+    coll_barrier,
+    num_colls
+};
+static const char* coll_names[num_colls] = {"all_reduce",
+                                            "all_reduce_caching",
+                                            "inference_all_reduce",
+                                            "all_reduce_coalesced",
+                                            "broadcast",
+                                            "all_gather",
+                                            "all_gather_into_tensor",
+                                            "reduce_scatter_tensor",
+                                            "all_to_all_single",
+                                            "barrier"};
+
+enum coll_path_t { coll_path_shm, coll_path_ccl, num_coll_paths };
+enum shm_phase_t {
+    shm_phase_copy_in,
+    shm_phase_wait,
+    shm_phase_reduce,
+    shm_phase_copy_out,
+    num_shm_phases
+};
+static const char* coll_path_names[num_coll_paths] = {"shm", "ccl"};
+static const char* shm_phase_names[num_shm_phases] = {"copy_in", "wait", "reduce", "copy_out"};
+
+struct coll_stats_t {
+    uint64_t count[num_coll_paths] = {};
+    uint64_t bytes[num_coll_paths] = {};
+    uint64_t latency_hist[num_coll_paths][COLL_HIST_BUCKETS] = {};
+    uint64_t phase_hist[num_shm_phases][COLL_HIST_BUCKETS] = {};
+};
+
+// start_ns is 0 when neither statistics nor tracing were on as the collective started
+struct coll_trace_t {
+    coll_id_t coll;
+    size_t bytes;
+    uint64_t start_ns;
+};
+
+struct trace_event_t {
+    coll_trace_t trace;
+    coll_path_t path;
+    int tid;
+    uint64_t duration_ns;
+    uint64_t phase_ns[num_shm_phases];
+};
+
+static std::atomic<bool> stats_enabled(false);
+static std::atomic<bool> trace_enabled(false);
+static std::mutex coll_stats_mutex;
+static coll_stats_t coll_stats[num_colls];
+static std::vector<trace_event_t> trace_events;
+static uint64_t dropped_trace_events = 0;
+// Chrome trace rows. Collectives that complete on a thread go on its row. Asynchronous oneCCL
+// collectives overlap on the thread that waits for them, so each takes a free row of its own
+// while in flight.
+static std::atomic<int> next_thread_trace_tid(0);
+static thread_local int thread_trace_tid = next_thread_trace_tid++;
+static std::vector<int> free_async_trace_tids;
+static int num_async_trace_tids = 0;
+
+// Time the SHM collective running on this thread spent in each phase of its steps
+static thread_local uint64_t shm_phase_ns[num_shm_phases];
+
+static uint64_t now_ns()
 {
-    CCLCHECK(ccl::broadcast(data.data_ptr(),
-                            data.numel(),
-                            get_ccl_datatype(data.scalar_type()),
-                            src,
-                            _get_comm_from_group(group))
-                 .wait());
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(
+               std::chrono::steady_clock::now().time_since_epoch())
+        .count();
 }
 
-// TODO: implement torch's async_op behavior, document it.
-void all_reduce(torch::Tensor& data, py::object op, std::vector<int> group, bool async_op)
+static int hist_bucket(uint64_t ns)
 {
-    CCLCHECK(ccl::allreduce(data.data_ptr(),
-                            data.data_ptr(),
-                            data.numel(),
-                            get_ccl_datatype(data.scalar_type()),
-                            get_ccl_reduce_op(op, data),
-                            _get_comm_from_group(group))
-                 .wait());
+    uint64_t us = ns / 1000;
+    int bucket = us == 0 ? 0 : 64 - __builtin_clzll(us);
+    return std::min(bucket, COLL_HIST_BUCKETS - 1);
+}
+
+// Whether collectives are timed, which only statistics and traces need
+static bool coll_timing_enabled()
+{
+    return stats_enabled.load(std::memory_order_relaxed) ||
+           trace_enabled.load(std::memory_order_relaxed);
 }
 
-void all_reduce_caching(torch::Tensor& data,
-                        py::object op,
-                        std::string match_id,
-                        std::vector<int> group,
-                        bool async_op)
+static coll_trace_t coll_trace_begin(coll_id_t coll, size_t bytes)
 {
+    return {coll, bytes, coll_timing_enabled() ? now_ns() : 0};
+}
+
+// Chrome trace row for an asynchronous oneCCL collective, -1 if it is not traced
+static int acquire_async_trace_tid(const coll_trace_t& trace)
+{
+    if (trace.start_ns == 0 || !trace_enabled.load(std::memory_order_relaxed)) return -1;
+    std::lock_guard<std::mutex> lock(coll_stats_mutex);
+    if (free_async_trace_tids.empty()) {
+        return ASYNC_TRACE_TID_BASE + num_async_trace_tids++;
+    }
+    int tid = free_async_trace_tids.back();
+    free_async_trace_tids.pop_back();
+    return tid;
+}
+
+// tid is the collective's trace row, -1 for the row of the calling thread
+static void coll_trace_end(const coll_trace_t& trace,
+                           coll_path_t path,
+                           const uint64_t* phase_ns = nullptr,
+                           int tid = -1)
+{
+    if (trace.start_ns == 0) return;
+    uint64_t duration_ns = now_ns() - trace.start_ns;
+    std::lock_guard<std::mutex> lock(coll_stats_mutex);
+    if (tid >= ASYNC_TRACE_TID_BASE) { free_async_trace_tids.push_back(tid); }
+    if (stats_enabled.load(std::memory_order_relaxed)) {
+        auto& stats = coll_stats[trace.coll];
+        stats.count[path]++;
+        stats.bytes[path] += trace.bytes;
+        stats.latency_hist[path][hist_bucket(duration_ns)]++;
+        if (phase_ns) {
+            for (int phase = 0; phase < num_shm_phases; phase++) {
+                stats.phase_hist[phase][hist_bucket(phase_ns[phase])]++;
+            }
+        }
+    }
+    if (trace_enabled.load(std::memory_order_relaxed)) {
+        if (trace_events.size() < MAX_TRACE_EVENTS) {
+            trace_event_t event = {trace, path, tid < 0 ? thread_trace_tid : tid, duration_ns, {}};
+            if (phase_ns) { std::copy(phase_ns, phase_ns + num_shm_phases, event.phase_ns); }
+            trace_events.push_back(event);
+        } else {
+            dropped_trace_events++;
+        }
+    }
+}
+
+// Handle returned by collectives called with async_op=True. oneCCL collectives complete through
+// their events, SHM collectives through the SHM progress thread. oneCCL only sees the data
+// pointers of its tensors, so the handle holds them until the collective is done.
+class ccl_work_t {
+public:
+    ccl_work_t(coll_trace_t trace,
+               ccl::event&& event,
+               std::vector<torch::Tensor>&& tensors,
+               std::function<void()> on_complete = nullptr)
+        : _trace(trace),
+          _trace_tid(acquire_async_trace_tid(trace)),
+          _tensors(std::move(tensors)),
+          _on_complete(on_complete),
+          _completed(false)
+    {
+        _events.push_back(std::move(event));
+    }
+
+    ccl_work_t(coll_trace_t trace,
+               std::vector<ccl::event>&& events,
+               std::vector<torch::Tensor>&& tensors,
+               std::function<void()> on_complete = nullptr)
+        : _trace(trace),
+          _trace_tid(acquire_async_trace_tid(trace)),
+          _events(std::move(events)),
+          _tensors(std::move(tensors)),
+          _on_complete(on_complete),
+          _completed(false)
+    {
+    }
+
+    ccl_work_t(std::shared_future<void> shm_done)
+        : _trace_tid(-1), _shm_done(shm_done), _completed(false)
+    {
+    }
+
+    void wait()
+    {
+        if (_completed) return;
+        for (auto& event : _events) { CCLCHECK(event.wait()); }
+        if (_shm_done.valid()) { _shm_done.get(); }
+        if (_on_complete) { _on_complete(); }
+        // SHM collectives record themselves when they finish on the progress thread
+        if (!_events.empty()) { coll_trace_end(_trace, coll_path_ccl, nullptr, _trace_tid); }
+        _tensors.clear();
+        _completed = true;
+    }
+
+    bool is_completed()
+    {
+        if (_completed) return true;
+        for (auto& event : _events) {
+            if (!event.test()) return false;
+        }
+        if (_shm_done.valid() &&
+            _shm_done.wait_for(std::chrono::seconds(0)) != std::future_status::ready) {
+            return false;
+        }
+        wait();
+        return true;
+    }
+
+private:
+    coll_trace_t _trace;
+    int _trace_tid;
+    std::vector<ccl::event> _events;
+    std::vector<torch::Tensor> _tensors;
+    std::shared_future<void> _shm_done;
+    std::function<void()> _on_complete;
+    bool _completed;
+};
+
+// SHM collectives started with async_op=True run on this thread in the order they were issued.
+// Every rank issues SHM collectives in the same order, so the ranks stay in step.
+class shm_progress_thread_t {
+public:
+    std::shared_future<void> submit(std::function<void()> collective)
+    {
+        std::packaged_task<void()> task(collective);
+        auto done = task.get_future().share();
+        {
+            std::lock_guard<std::mutex> lock(_mutex);
+            if (!_started) {
+                std::thread(&shm_progress_thread_t::_run, this).detach();
+                _started = true;
+            }
+            _queue.push_back(std::move(task));
+            _num_pending++;
+        }
+        _cond.notify_one();
+        return done;
+    }
+
+    bool is_idle()
+    {
+        std::lock_guard<std::mutex> lock(_mutex);
+        return _num_pending == 0;
+    }
+
+private:
+    void _run()
+    {
+        while (true) {
+            std::packaged_task<void()> task;
+            {
+                std::unique_lock<std::mutex> lock(_mutex);
+                _cond.wait(lock, [this] { return !_queue.empty(); });
+                task = std::move(_queue.front());
+                _queue.pop_front();
+            }
+            task();
+            std::lock_guard<std::mutex> lock(_mutex);
+            _num_pending--;
+        }
+    }
+
+    std::mutex _mutex;
+    std::condition_variable _cond;
+    std::deque<std::packaged_task<void()>> _queue;
+    int _num_pending = 0;
+    bool _started = false;
+};
+
+// Never destroyed: the detached progress thread may still be waiting on it at exit
+shm_progress_thread_t& get_shm_progress_thread()
+{
+    static auto progress_thread = new shm_progress_thread_t();
+    return *progress_thread;
+}
+
+// Returns a work handle for the oneCCL collective behind event if async_op, otherwise waits for
+// it. tensors are the ones the collective reads or writes, on_complete runs once it is done.
+static std::shared_ptr<ccl_work_t> ccl_collective_work(coll_trace_t trace,
+                                                       ccl::event&& event,
+                                                       bool async_op,
+                                                       std::vector<torch::Tensor> tensors,
+                                                       std::function<void()> on_complete = nullptr)
+{
+    if (async_op) {
+        return std::make_shared<ccl_work_t>(
+            trace, std::move(event), std::move(tensors), on_complete);
+    }
+    CCLCHECK(event.wait());
+    if (on_complete) { on_complete(); }
+    coll_trace_end(trace, coll_path_ccl);
+    return nullptr;
+}
+
+// Same for several oneCCL collectives that complete together.
+static std::shared_ptr<ccl_work_t> ccl_collective_work(coll_trace_t trace,
+                                                       std::vector<ccl::event>&& events,
+                                                       bool async_op,
+                                                       std::vector<torch::Tensor> tensors,
+                                                       std::function<void()> on_complete = nullptr)
+{
+    if (async_op) {
+        return std::make_shared<ccl_work_t>(
+            trace, std::move(events), std::move(tensors), on_complete);
+    }
+    for (auto& event : events) { CCLCHECK(event.wait()); }
+    if (on_complete) { on_complete(); }
+    coll_trace_end(trace, coll_path_ccl);
+    return nullptr;
+}
+
+// Runs an SHM collective on the progress thread if async_op. Synchronous collectives run inline,
+// unless asynchronous ones are still pending, in which case they queue behind them.
+static std::shared_ptr<ccl_work_t> shm_collective_work(coll_trace_t trace,
+                                                       std::function<void()> collective,
+                                                       bool async_op)
+{
+    auto traced_collective = [=]() {
+        std::fill(shm_phase_ns, shm_phase_ns + num_shm_phases, 0);
+        collective();
+        coll_trace_end(trace, coll_path_shm, shm_phase_ns);
+    };
+    auto& progress_thread = get_shm_progress_thread();
+    if (!async_op && progress_thread.is_idle()) {
+        traced_collective();
+        return nullptr;
+    }
+    auto work = std::make_shared<ccl_work_t>(progress_thread.submit(traced_collective));
+    if (async_op) { return work; }
+    work->wait();
+    return nullptr;
+}
+
+// Persistent communication arena. Buffers mapped into it by name keep their address for the life
+// of the process, so gradient buckets can live in them and be reduced in place, and the plans
+// oneCCL caches for them stay valid from one iteration to the next.
+struct comm_buffer_t {
+    size_t offset;
+    size_t nbytes;
+};
+char* comm_arena = nullptr;
+size_t comm_arena_bytes = 0;
+size_t comm_arena_used = 0;
+std::map<std::string, comm_buffer_t> comm_buffers;
+// start address of each buffer -> its name
+std::map<void*, std::string> comm_buffer_names;
+
+static size_t round_to_pages(size_t nbytes)
+{
+    return (nbytes + SHM_CHUNK_ALIGNMENT - 1) / SHM_CHUNK_ALIGNMENT * SHM_CHUNK_ALIGNMENT;
+}
+
+// Allocate the arena. Its pages are faulted in now rather than by the first collectives.
+void register_comm_arena(int64_t nbytes)
+{
+    TORCH_CHECK(comm_arena == nullptr, "the communication arena is already registered");
+    comm_arena_bytes = round_to_pages(nbytes);
+    void* arena = mmap(NULL,
+                       comm_arena_bytes,
+                       PROT_READ | PROT_WRITE,
+                       MAP_PRIVATE | MAP_ANONYMOUS | MAP_POPULATE,
+                       -1,
+                       0);
+    TORCH_CHECK(arena != MAP_FAILED, "could not allocate the communication arena");
+    comm_arena = (char*)arena;
+}
+
+// Tensor with the shape and dtype of like in the arena buffer called name. The first call for a
+// name carves a page aligned buffer out of the arena, later calls return the same memory with its
+// content. Allreduces of the buffer let oneCCL cache their plans under its name.
+torch::Tensor map_comm_buffer(std::string name, torch::Tensor& like)
+{
+    TORCH_CHECK(comm_arena != nullptr, "register_comm_arena has to be called first");
+    const size_t nbytes = like.numel() * like.element_size();
+    auto buffer = comm_buffers.find(name);
+    if (buffer == comm_buffers.end()) {
+        const size_t buffer_bytes = round_to_pages(std::max<size_t>(nbytes, 1));
+        TORCH_CHECK(comm_arena_used + buffer_bytes <= comm_arena_bytes,
+                    "the communication arena is full");
+        buffer = comm_buffers.emplace(name, comm_buffer_t{comm_arena_used, nbytes}).first;
+        comm_buffer_names[comm_arena + comm_arena_used] = name;
+        comm_arena_used += buffer_bytes;
+    }
+    TORCH_CHECK(buffer->second.nbytes == nbytes, "comm buffer mapped again with another size");
+    return torch::from_blob(comm_arena + buffer->second.offset, like.sizes(), like.options());
+}
+
+// Name of the arena buffer that data covers exactly, nullptr if there is none.
+static const std::string* find_comm_buffer(torch::Tensor& data)
+{
+    auto name = comm_buffer_names.find(data.data_ptr());
+    if (name == comm_buffer_names.end()) return nullptr;
+    const size_t nbytes = data.numel() * data.element_size();
+    return comm_buffers[name->second].nbytes == nbytes ? &name->second : nullptr;
+}
+
+std::shared_ptr<ccl_work_t> all_reduce_caching(torch::Tensor& data,
+                                               py::object op,
+                                               std::string match_id,
+                                               std::vector<int> group,
+                                               bool async_op);
+
+std::shared_ptr<ccl_work_t> all_reduce(torch::Tensor& data,
+                                       py::object op,
+                                       std::vector<int> group,
+                                       bool async_op)
+{
+    // arena buffers have a stable address, so oneCCL can cache their plans
+    if (auto name = find_comm_buffer(data)) {
+        return all_reduce_caching(data, op, *name, group, async_op);
+    }
+    auto trace = coll_trace_begin(coll_all_reduce, data.numel() * data.element_size());
+    return ccl_collective_work(trace,
+                               ccl::allreduce(data.data_ptr(),
+                                              data.data_ptr(),
+                                              data.numel(),
+                                              get_ccl_datatype(data.scalar_type()),
+                                              get_ccl_reduce_op(op, data),
+                                              _get_comm_from_group(group)),
+                               async_op,
+                               {data});
+}
+
+std::shared_ptr<ccl_work_t> all_reduce_caching(torch::Tensor& data,
+                                               py::object op,
+                                               std::string match_id,
+                                               std::vector<int> group,
+                                               bool async_op)
+{
+    auto trace = coll_trace_begin(coll_all_reduce_caching, data.numel() * data.element_size());
+    // oneCCL reuses the plan cached for a match_id whatever the operation it is given, so the
+    // group, dtype and reduce op are made part of it. The same buffer may then be reduced over
+    // several groups or with several ops.
+    auto reduce_op = get_ccl_reduce_op(op, data);
+    std::vector<int> ranks = group;
+    if (ranks.empty()) {
+        for (int i = 0; i < world_size; i++) { ranks.push_back(i); }
+    }
+    char plan_key[64];
+    snprintf(plan_key,
+             sizeof(plan_key),
+             "@%016llx_%d_%d",
+             (unsigned long long)hash_ranks(ranks),
+             (int)data.scalar_type(),
+             (int)reduce_op);
     ccl::allreduce_attr attr = ccl::default_allreduce_attr;
-    auto match_str = ccl::v1::string(match_id);
+    auto match_str = ccl::v1::string(match_id + plan_key);
     attr.template set<ccl::operation_attr_id::to_cache>(true);
     attr.template set<ccl::operation_attr_id::match_id>(match_str);
-    // To control this, use operation attribute and set true value for to_cache field and unique
-    // string (for example, tensor name) for match_id field. Note that:
-    //   match_id should be the same for a specific communication operation across all ranks.
-    //   If the same tensor is a part of different communication operations, match_id should have
-    //   different values for each of these operations.
-    CCLCHECK(ccl::allreduce(data.data_ptr(),
-                            data.data_ptr(),
-                            data.numel(),
-                            get_ccl_datatype(data.scalar_type()),
-                            get_ccl_reduce_op(op, data),
-                            _get_comm_from_group(group),
-                            attr)
-                 .wait());
+    return ccl_collective_work(trace,
+                               ccl::allreduce(data.data_ptr(),
+                                              data.data_ptr(),
+                                              data.numel(),
+                                              get_ccl_datatype(data.scalar_type()),
+                                              reduce_op,
+                                              _get_comm_from_group(group),
+                                              attr),
+                               async_op,
+                               {data});
 }
 
-static void parallel_memcpy(void* to, void* from, size_t n_bytes)
-    __attribute__((target("avx512bw")));
-static void parallel_memcpy(void* to, void* from, size_t n_bytes)
+// vector_bytes is a multiple of VECTOR_LENGTH_IN_BYTES
+static void parallel_memcpy_avx2(void* to, void* from, size_t vector_bytes)
+    __attribute__((target("avx2")));
+static void parallel_memcpy_avx2(void* to, void* from, size_t vector_bytes)
 {
 #pragma omp parallel for
-    for (int i = 0; i < n_bytes; i += VECTOR_LENGTH_IN_BYTES) {
+    for (int i = 0; i < vector_bytes; i += VECTOR_LENGTH_IN_BYTES) {
         auto val = _mm256_loadu_si256((__m256i*)((char*)from + i));
         _mm256_storeu_si256((__m256i*)((char*)to + i), val);
     }
 }
 
-void inference_all_reduce(torch::Tensor& data, py::object op, bool async_op)
+static void parallel_memcpy(void* to, void* from, size_t n_bytes)
+{
+    const size_t vector_bytes = shm_isa == shm_isa_scalar
+                                    ? 0
+                                    : n_bytes / VECTOR_LENGTH_IN_BYTES * VECTOR_LENGTH_IN_BYTES;
+    if (vector_bytes > 0) { parallel_memcpy_avx2(to, from, vector_bytes); }
+    // bytes that do not fill a whole vector
+    memcpy((char*)to + vector_bytes, (char*)from + vector_bytes, n_bytes - vector_bytes);
+}
+
+// Each rank reduces its own slice of a chunk. Slices are whole vectors, except that the last one
+// also takes the bytes past the last whole vector.
+static int slice_start(size_t chunk_size, int slice_idx, int num_slices)
+{
+    const int num_vectors = chunk_size / VECTOR_LENGTH_IN_BYTES;
+    const int base = num_vectors / num_slices;
+    const int remainder = num_vectors % num_slices;
+    return (slice_idx * base + std::min(slice_idx, remainder)) * VECTOR_LENGTH_IN_BYTES;
+}
+
+static int slice_size(size_t chunk_size, int slice_idx, int num_slices)
+{
+    const int num_vectors = chunk_size / VECTOR_LENGTH_IN_BYTES;
+    const int base = num_vectors / num_slices;
+    const int remainder = num_vectors % num_slices;
+    const int tail = slice_idx == num_slices - 1 ? chunk_size % VECTOR_LENGTH_IN_BYTES : 0;
+    return (base + (slice_idx < remainder ? 1 : 0)) * VECTOR_LENGTH_IN_BYTES + tail;
+}
+
+// One step of an SHM collective. Every rank copies its input into its own buffer, then works on
+// the buffers of all ranks (e.g. reduces its slice of them), then reads its output from them.
+// Steps alternate between two buffers and two sets of states: the reduce barrier of a step also
+// proves every rank finished reading the previous step, so no copy-out barrier is needed and a
+// rank may copy in the next step while slower ranks still read the current one.
+template <typename CopyIn, typename Reduce, typename CopyOut>
+static void shm_collective_step(shm_group_t* group, CopyIn copy_in, Reduce reduce, CopyOut copy_out)
+{
+    const int current_buffer = group->current_buffer;
+    const auto copy_current = current_buffer ? coll_alt_allreduce_naive__copy_in_done
+                                             : coll_allreduce_naive__copy_in_done;
+    const auto reduce_current = current_buffer ? coll_alt_allreduce_naive__reduce_done
+                                               : coll_allreduce_naive__reduce_done;
+    const auto copy_next = current_buffer ? coll_allreduce_naive__copy_in_done
+                                          : coll_alt_allreduce_naive__copy_in_done;
+    char** buffers = group->buffers[current_buffer].data();
+    const bool timed = coll_timing_enabled();
+    auto stamp = [timed]() { return timed ? now_ns() : 0; };
+
+    uint64_t t0 = stamp();
+    copy_in(buffers[group->rank]);
+    set_buffer_state(group, group->rank, copy_current);
+    uint64_t t1 = stamp();
+
+    for (int i = 0; i < group->size; i++) {
+        // wait until the other ranks copy their buffers in
+        if (i != group->rank) { wait_buffer_state_until_2(group, i, copy_current, reduce_current); }
+    }
+    uint64_t t2 = stamp();
+
+    reduce(buffers);
+    set_buffer_state(group, group->rank, reduce_current);
+    uint64_t t3 = stamp();
+
+    for (int i = 0; i < group->size; i++) {
+        // wait until the other ranks are done with their part of the buffers
+        if (i != group->rank) { wait_buffer_state_until_2(group, i, reduce_current, copy_next); }
+    }
+    uint64_t t4 = stamp();
+
+    copy_out(buffers);
+    uint64_t t5 = stamp();
+
+    if (timed) {
+        shm_phase_ns[shm_phase_copy_in] += t1 - t0;
+        shm_phase_ns[shm_phase_wait] += (t2 - t1) + (t4 - t3);
+        shm_phase_ns[shm_phase_reduce] += t3 - t2;
+        shm_phase_ns[shm_phase_copy_out] += t5 - t4;
+    }
+
+    group->current_buffer = 1 - current_buffer;
+}
+
+static void shm_no_reduce(char** buffers) {}
+
+// Reduce-scatter followed by all-gather through the SHM workspace, so that every rank's threads
+// take part in the reduction instead of rank 0 reducing the whole chunk while the others spin.
+static void distributed_naive_reduce(shm_group_t* group,
+                                     char* data_ptr,
+                                     c10::ScalarType scalar_type,
+                                     size_t chunk_size)
+{
+    shm_collective_step(
+        group,
+        [&](char* buffer) { parallel_memcpy(buffer, data_ptr, chunk_size); },
+        [&](char** buffers) {
+            // reduce scatter
+            reduce_all_buffers(buffers,
+                               slice_start(chunk_size, group->rank, group->size),
+                               slice_size(chunk_size, group->rank, group->size),
+                               scalar_type,
+                               group->size,
+                               group->rank);
+        },
+        [&](char** buffers) {
+            // all gather, starting from a different rank on each rank to spread the reads
+            for (int i = 0; i < group->size; i++) {
+                int rank = (i + group->rank) % group->size;
+                parallel_memcpy(data_ptr + slice_start(chunk_size, rank, group->size),
+                                buffers[rank] + slice_start(chunk_size, rank, group->size),
+                                slice_size(chunk_size, rank, group->size));
+            }
+        });
+}
+
+// SHM workspace of a group given by its world ranks, empty for the whole world. nullptr if the
+// group has none and has to use oneCCL. Only groups of local ranks have one.
+static shm_group_t* get_shm_group(const std::vector<int>& group)
+{
+    if (group.empty()) {
+        std::vector<int> ranks(world_size);
+        for (int i = 0; i < world_size; i++) { ranks[i] = i; }
+        return get_shm_group(ranks);
+    }
+    auto shm_group = shm_groups.find(group);
+    return shm_group == shm_groups.end() ? nullptr : &shm_group->second;
+}
+
+static void shm_all_reduce(shm_group_t* group, torch::Tensor data, int data_size)
+{
+    for (int offset = 0; offset < data_size; offset += shm_chunk_size) {
+        auto data_ptr = ((char*)(data.data_ptr()) + offset);
+        size_t chunk_size =
+            data_size - offset > shm_chunk_size ? shm_chunk_size : data_size - offset;
+
+        distributed_naive_reduce(group, data_ptr, data.scalar_type(), chunk_size);
+    }
+}
+
+// Reduce-scatter each chunk within the node, allreduce the slices this rank owns with its peers
+// on the other nodes, then all-gather the chunks within the node.
+static void shm_hierarchical_all_reduce(shm_group_t* group, torch::Tensor data, size_t data_size)
+{
+    auto data_ptr = (char*)data.data_ptr();
+    // the slices this rank owns, packed so that a single oneCCL allreduce covers all of them
+    auto& slices = group->hierarchy_slices;
+    size_t slices_size = 0;
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        slices_size += slice_size(chunk_size, group->rank, group->size);
+    }
+    if (slices.size() < slices_size) { slices.resize(slices_size); }
+
+    size_t slices_offset = 0;
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        size_t start = slice_start(chunk_size, group->rank, group->size);
+        size_t size = slice_size(chunk_size, group->rank, group->size);
+        shm_collective_step(
+            group,
+            [&](char* buffer) { parallel_memcpy(buffer, data_ptr + offset, chunk_size); },
+            [&](char** buffers) {
+                reduce_all_buffers(
+                    buffers, start, size, data.scalar_type(), group->size, group->rank);
+            },
+            [&](char** buffers) {
+                parallel_memcpy(slices.data() + slices_offset, buffers[group->rank] + start, size);
+            });
+        slices_offset += size;
+    }
+
+    CCLCHECK(ccl::allreduce(slices.data(),
+                            slices.data(),
+                            slices_size / data.element_size(),
+                            get_ccl_datatype(data.scalar_type()),
+                            ccl::reduction::sum,
+                            _get_comm_from_group(node_peer_ranks))
+                 .wait());
+
+    slices_offset = 0;
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        size_t start = slice_start(chunk_size, group->rank, group->size);
+        size_t size = slice_size(chunk_size, group->rank, group->size);
+        shm_collective_step(
+            group,
+            [&](char* buffer) {
+                parallel_memcpy(buffer + start, slices.data() + slices_offset, size);
+            },
+            shm_no_reduce,
+            [&](char** buffers) {
+                for (int i = 0; i < group->size; i++) {
+                    int rank = (i + group->rank) % group->size;
+                    parallel_memcpy(data_ptr + offset + slice_start(chunk_size, rank, group->size),
+                                    buffers[rank] + slice_start(chunk_size, rank, group->size),
+                                    slice_size(chunk_size, rank, group->size));
+                }
+            });
+        slices_offset += size;
+    }
+}
+
+static bool is_reduce_op_sum(py::object op)
 {
     static py::object ReduceOp = py::module_::import("deepspeed.comm").attr("ReduceOp");
     static auto ReduceOpSum = (int)py::int_(ReduceOp.attr("SUM").attr("value"));
 
-    assert(py::int_(op.attr("value")) == ReduceOpSum);
+    return (int)py::int_(op.attr("value")) == ReduceOpSum;
+}
+
+static bool is_world_group(const std::vector<int>& group)
+{
+    if (group.empty()) return true;
+    if ((int)group.size() != world_size) return false;
+    for (int i = 0; i < world_size; i++) {
+        if (group[i] != i) return false;
+    }
+    return true;
+}
+
+std::shared_ptr<ccl_work_t> inference_all_reduce(torch::Tensor& data,
+                                                 py::object op,
+                                                 std::vector<int> group,
+                                                 bool async_op)
+{
+    auto trace = coll_trace_begin(coll_inference_all_reduce, data.numel() * data.element_size());
 
     auto numel = data.numel();
 
@@ -551,79 +1594,782 @@ void inference_all_reduce(torch::Tensor& data, py::object op, bool async_op)
 
     switch (data.scalar_type()) {
         case c10::ScalarType::BFloat16: data_size = numel * 2; break;
+        case c10::ScalarType::Half: data_size = numel * 2; break;
         case c10::ScalarType::Float: data_size = numel * 4; break;
+        case c10::ScalarType::Int: data_size = numel * 4; break;
+        case c10::ScalarType::Long: data_size = numel * 8; break;
         default: data_type_fallback = true;
     }
+    // the SHM paths only sum
+    bool op_fallback = !is_reduce_op_sum(op);
+
+    auto shm_group = get_shm_group(group);
+    if (!data_type_fallback && !op_fallback && shm_group == nullptr && node_shm_group != nullptr &&
+        is_world_group(group)) {
+        return shm_collective_work(
+            trace,
+            [=]() { shm_hierarchical_all_reduce(node_shm_group, data, data_size); },
+            async_op);
+    }
 
-    if (data_type_fallback || (data_size % VECTOR_LENGTH_IN_BYTES) != 0 || !all_ranks_local_p) {
+    if (data_type_fallback || op_fallback || shm_group == nullptr) {
         // fallback to oneccl allreduce
-        CCLCHECK(ccl::allreduce(data.data_ptr(),
-                                data.data_ptr(),
-                                data.numel(),
-                                get_ccl_datatype(data.scalar_type()),
-                                get_ccl_reduce_op(op, data),
-                                _get_comm_from_group())
-                     .wait());
-        return;
+        return ccl_collective_work(trace,
+                                   ccl::allreduce(data.data_ptr(),
+                                                  data.data_ptr(),
+                                                  data.numel(),
+                                                  get_ccl_datatype(data.scalar_type()),
+                                                  get_ccl_reduce_op(op, data),
+                                                  _get_comm_from_group(group)),
+                                   async_op,
+                                   {data});
     }
 
-    for (int offset = 0; offset < data_size; offset += MAX_BUF_SIZE) {
-        auto data_ptr = ((char*)(data.data_ptr()) + offset);
-        size_t chunk_size = data_size - offset > MAX_BUF_SIZE ? MAX_BUF_SIZE : data_size - offset;
-        size_t chunk_el = chunk_size / (data_size / numel);
-
-        parallel_memcpy(workspace[world_rank].buffer, data_ptr, chunk_size);
-        std::atomic_thread_fence(std::memory_order_release);
-        workspace[world_rank].state = coll_allreduce_naive__copy_in_done;
-
-        if (world_rank == 0) {
-            // compute allreduce result on rank 0
-            for (int i = 1; i < world_size; i++) {
-                // wait until the other rank copy the buffer
-                wait_buffer_state_until(i, coll_allreduce_naive__copy_in_done);
-            }
-            reduce_all_buffers(workspace, chunk_el, data.scalar_type(), world_size);
-            std::atomic_thread_fence(std::memory_order_release);
-            workspace[world_rank].state = coll_allreduce_naive__reduce_done;
-            parallel_memcpy(data_ptr, workspace[0].buffer, chunk_size);
+    return shm_collective_work(
+        trace, [=]() { shm_all_reduce(shm_group, data, data_size); }, async_op);
+}
+
+static int get_group_size(const std::vector<int>& group)
+{
+    return group.empty() ? world_size : group.size();
+}
+
+// Copies n_bytes at offset of the tensors laid end to end, where tensor_ends[i] is the end offset
+// of tensor i, to buffer, or from buffer if to_buffer is false.
+static void copy_tensor_bytes(const std::vector<char*>& tensor_ptrs,
+                              const std::vector<size_t>& tensor_ends,
+                              size_t offset,
+                              char* buffer,
+                              size_t n_bytes,
+                              bool to_buffer)
+{
+    int i = std::upper_bound(tensor_ends.begin(), tensor_ends.end(), offset) - tensor_ends.begin();
+    while (n_bytes > 0) {
+        size_t tensor_start = i == 0 ? 0 : tensor_ends[i - 1];
+        size_t copy_size = std::min(n_bytes, tensor_ends[i] - offset);
+        char* tensor_ptr = tensor_ptrs[i] + (offset - tensor_start);
+        if (to_buffer) {
+            parallel_memcpy(buffer, tensor_ptr, copy_size);
+        } else {
+            parallel_memcpy(tensor_ptr, buffer, copy_size);
         }
-        if (world_rank != 0) {
-            wait_buffer_state_until(0, coll_allreduce_naive__reduce_done);
-            parallel_memcpy(data_ptr, workspace[0].buffer, chunk_size);
-            std::atomic_thread_fence(std::memory_order_release);
-            workspace[world_rank].state = coll_allreduce_naive__copy_out_done;
+        buffer += copy_size;
+        offset += copy_size;
+        n_bytes -= copy_size;
+        i++;
+    }
+}
+
+// Reduces the tensors as if they were laid end to end. Chunks are packed straight from the
+// tensors into the SHM buffers and the results are copied back in place, without a flattened
+// copy of the tensors.
+static void shm_all_reduce_coalesced(shm_group_t* group, std::vector<torch::Tensor> tensors)
+{
+    std::vector<char*> tensor_ptrs;
+    std::vector<size_t> tensor_ends;
+    size_t data_size = 0;
+    for (auto& tensor : tensors) {
+        tensor_ptrs.push_back((char*)tensor.data_ptr());
+        data_size += tensor.numel() * tensor.element_size();
+        tensor_ends.push_back(data_size);
+    }
+    auto scalar_type = tensors[0].scalar_type();
+
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        shm_collective_step(
+            group,
+            [&](char* buffer) {
+                copy_tensor_bytes(tensor_ptrs, tensor_ends, offset, buffer, chunk_size, true);
+            },
+            [&](char** buffers) {
+                reduce_all_buffers(buffers,
+                                   slice_start(chunk_size, group->rank, group->size),
+                                   slice_size(chunk_size, group->rank, group->size),
+                                   scalar_type,
+                                   group->size,
+                                   group->rank);
+            },
+            [&](char** buffers) {
+                for (int i = 0; i < group->size; i++) {
+                    int rank = (i + group->rank) % group->size;
+                    size_t start = slice_start(chunk_size, rank, group->size);
+                    size_t size = slice_size(chunk_size, rank, group->size);
+                    if (size == 0) continue;
+                    copy_tensor_bytes(tensor_ptrs,
+                                      tensor_ends,
+                                      offset + start,
+                                      buffers[rank] + start,
+                                      size,
+                                      false);
+                }
+            });
+    }
+}
+
+std::shared_ptr<ccl_work_t> all_reduce_coalesced(std::vector<torch::Tensor> tensors,
+                                                 py::object op,
+                                                 std::vector<int> group,
+                                                 bool async_op)
+{
+    if (tensors.empty()) return nullptr;
+    size_t bytes = 0;
+    for (auto& tensor : tensors) { bytes += tensor.numel() * tensor.element_size(); }
+    auto trace = coll_trace_begin(coll_all_reduce_coalesced, bytes);
+
+    auto shm_group = get_shm_group(group);
+    bool shm_p = shm_group != nullptr && is_reduce_op_sum(op) &&
+                 is_shm_reduce_type(tensors[0].scalar_type());
+    for (auto& tensor : tensors) {
+        shm_p = shm_p && tensor.is_contiguous() && tensor.scalar_type() == tensors[0].scalar_type();
+    }
+
+    if (!shm_p) {
+        // One oneCCL allreduce per dtype, over its tensors packed end to end. Every rank walks
+        // the dtypes in the same order, so the allreduces match up.
+        std::map<c10::ScalarType, std::vector<torch::Tensor>> tensors_by_type;
+        for (auto& tensor : tensors) { tensors_by_type[tensor.scalar_type()].push_back(tensor); }
+
+        std::vector<ccl::event> events;
+        std::vector<torch::Tensor> held_tensors = tensors;
+        std::vector<std::pair<torch::Tensor, std::vector<torch::Tensor>>> packed;
+        for (auto& type_tensors : tensors_by_type) {
+            auto& members = type_tensors.second;
+            torch::Tensor buffer;
+            if (members.size() == 1 && members[0].is_contiguous()) {
+                buffer = members[0];
+            } else {
+                std::vector<torch::Tensor> flat_members;
+                for (auto& tensor : members) { flat_members.push_back(tensor.reshape({-1})); }
+                buffer = torch::cat(flat_members);
+                packed.emplace_back(buffer, members);
+                held_tensors.push_back(buffer);
+            }
+            events.push_back(ccl::allreduce(buffer.data_ptr(),
+                                            buffer.data_ptr(),
+                                            buffer.numel(),
+                                            get_ccl_datatype(type_tensors.first),
+                                            get_ccl_reduce_op(op, buffer),
+                                            _get_comm_from_group(group)));
         }
-        if (world_rank == 0) {
-            for (int i = 1; i < world_size; i++) {
-                wait_buffer_state_until(i, coll_allreduce_naive__copy_out_done);
+
+        auto unpack = [packed]() mutable {
+            for (auto& buffer_members : packed) {
+                int64_t offset = 0;
+                for (auto& tensor : buffer_members.second) {
+                    auto packed_tensor = buffer_members.first.narrow(0, offset, tensor.numel());
+                    tensor.copy_(packed_tensor.view_as(tensor));
+                    offset += tensor.numel();
+                }
             }
-            std::atomic_thread_fence(std::memory_order_release);
-            workspace[world_rank].state = coll_begin;
+        };
+        return ccl_collective_work(trace, std::move(events), async_op, held_tensors, unpack);
+    }
+
+    return shm_collective_work(
+        trace, [=]() { shm_all_reduce_coalesced(shm_group, tensors); }, async_op);
+}
+
+static void shm_broadcast(shm_group_t* group, torch::Tensor data, int src)
+{
+    auto data_ptr = (char*)data.data_ptr();
+    size_t data_size = data.numel() * data.element_size();
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        shm_collective_step(
+            group,
+            [&](char* buffer) {
+                if (group->rank == src) { parallel_memcpy(buffer, data_ptr + offset, chunk_size); }
+            },
+            shm_no_reduce,
+            [&](char** buffers) {
+                if (group->rank != src) {
+                    parallel_memcpy(data_ptr + offset, buffers[src], chunk_size);
+                }
+            });
+    }
+}
+
+std::shared_ptr<ccl_work_t> broadcast(torch::Tensor& data,
+                                      int src,
+                                      std::vector<int> group,
+                                      bool async_op)
+{
+    auto trace = coll_trace_begin(coll_broadcast, data.numel() * data.element_size());
+    auto shm_group = get_shm_group(group);
+    if (shm_group == nullptr || !data.is_contiguous()) {
+        return ccl_collective_work(trace,
+                                   ccl::broadcast(data.data_ptr(),
+                                                  data.numel(),
+                                                  get_ccl_datatype(data.scalar_type()),
+                                                  src,
+                                                  _get_comm_from_group(group)),
+                                   async_op,
+                                   {data});
+    }
+
+    return shm_collective_work(trace, [=]() { shm_broadcast(shm_group, data, src); }, async_op);
+}
+
+// Every rank copies a chunk of its input in, then gathers the same chunk of every rank's input
+// into outputs[rank]. The tensors are held so they outlive an asynchronous collective.
+static void shm_all_gather(shm_group_t* group,
+                           std::vector<torch::Tensor> outputs,
+                           std::vector<size_t> output_offsets,
+                           torch::Tensor input)
+{
+    auto input_ptr = (char*)input.data_ptr();
+    size_t data_size = input.numel() * input.element_size();
+    std::vector<char*> output_ptrs;
+    for (int rank = 0; rank < group->size; rank++) {
+        output_ptrs.push_back((char*)outputs[rank].data_ptr() + output_offsets[rank]);
+    }
+
+    for (size_t offset = 0; offset < data_size; offset += shm_chunk_size) {
+        size_t chunk_size = std::min(shm_chunk_size, data_size - offset);
+        shm_collective_step(
+            group,
+            [&](char* buffer) { parallel_memcpy(buffer, input_ptr + offset, chunk_size); },
+            shm_no_reduce,
+            [&](char** buffers) {
+                for (int i = 0; i < group->size; i++) {
+                    int rank = (i + group->rank) % group->size;
+                    if (output_ptrs[rank] == input_ptr) continue;
+                    parallel_memcpy(output_ptrs[rank] + offset, buffers[rank], chunk_size);
+                }
+            });
+    }
+}
+
+std::shared_ptr<ccl_work_t> all_gather(std::vector<torch::Tensor> tensor_list,
+                                       torch::Tensor& data,
+                                       std::vector<int> group,
+                                       bool async_op)
+{
+    auto trace = coll_trace_begin(coll_all_gather, data.numel() * data.element_size());
+    const int group_size = get_group_size(group);
+    TORCH_CHECK((int)tensor_list.size() == group_size,
+                "all_gather: tensor_list must have one tensor per rank");
+
+    auto shm_group = get_shm_group(group);
+    bool shm_p = shm_group != nullptr && data.is_contiguous();
+    for (auto& tensor : tensor_list) {
+        TORCH_CHECK(tensor.numel() == data.numel() && tensor.scalar_type() == data.scalar_type(),
+                    "all_gather: tensor_list tensors must match the input tensor");
+        shm_p = shm_p && tensor.is_contiguous();
+    }
+
+    if (!shm_p) {
+        auto input = data.contiguous();
+        auto flat = torch::empty({group_size * data.numel()}, data.options());
+        std::vector<size_t> recv_counts(group_size, data.numel());
+        return ccl_collective_work(
+            trace,
+            ccl::allgatherv(input.data_ptr(),
+                            data.numel(),
+                            flat.data_ptr(),
+                            recv_counts,
+                            get_ccl_datatype(data.scalar_type()),
+                            _get_comm_from_group(group)),
+            async_op,
+            {input, flat},
+            [=]() mutable {
+                for (int i = 0; i < group_size; i++) {
+                    tensor_list[i].copy_(
+                        flat.narrow(0, i * input.numel(), input.numel()).view_as(input));
+                }
+            });
+    }
+
+    std::vector<size_t> output_offsets(group_size, 0);
+    return shm_collective_work(
+        trace, [=]() { shm_all_gather(shm_group, tensor_list, output_offsets, data); }, async_op);
+}
+
+std::shared_ptr<ccl_work_t> all_gather_into_tensor(torch::Tensor& output,
+                                                   torch::Tensor& input,
+                                                   std::vector<int> group,
+                                                   bool async_op)
+{
+    auto trace = coll_trace_begin(coll_all_gather_into_tensor, input.numel() * input.element_size());
+    const int group_size = get_group_size(group);
+    TORCH_CHECK(output.numel() == group_size * input.numel(),
+                "all_gather_into_tensor: output must be world size times larger than input");
+
+    auto shm_group = get_shm_group(group);
+    if (shm_group == nullptr || !input.is_contiguous() || !output.is_contiguous()) {
+        std::vector<size_t> recv_counts(group_size, input.numel());
+        return ccl_collective_work(trace,
+                                   ccl::allgatherv(input.data_ptr(),
+                                                   input.numel(),
+                                                   output.data_ptr(),
+                                                   recv_counts,
+                                                   get_ccl_datatype(input.scalar_type()),
+                                                   _get_comm_from_group(group)),
+                                   async_op,
+                                   {input, output});
+    }
+
+    size_t data_size = input.numel() * input.element_size();
+    std::vector<torch::Tensor> outputs(group_size, output);
+    std::vector<size_t> output_offsets;
+    for (int rank = 0; rank < group_size; rank++) { output_offsets.push_back(rank * data_size); }
+    return shm_collective_work(
+        trace, [=]() { shm_all_gather(shm_group, outputs, output_offsets, input); }, async_op);
+}
+
+// Bytes of a buffer given to each rank by the slotted collectives. This is 0 when the group is
+// too large to give every rank a whole vector, and those collectives then go through oneCCL.
+static size_t shm_slot_size(shm_group_t* group)
+{
+    return shm_chunk_size / group->size / VECTOR_LENGTH_IN_BYTES * VECTOR_LENGTH_IN_BYTES;
+}
+
+static void shm_reduce_scatter(shm_group_t* group, torch::Tensor output, torch::Tensor input)
+{
+    // Each buffer holds one slot per rank. Every rank copies in the same chunk of all its input
+    // slices, then reduces its own slot across all buffers.
+    auto input_ptr = (char*)input.data_ptr();
+    auto output_ptr = (char*)output.data_ptr();
+    size_t data_size = output.numel() * output.element_size();
+    size_t slot_size = shm_slot_size(group);
+    for (size_t offset = 0; offset < data_size; offset += slot_size) {
+        size_t chunk_size = std::min(slot_size, data_size - offset);
+        shm_collective_step(
+            group,
+            [&](char* buffer) {
+                for (int rank = 0; rank < group->size; rank++) {
+                    parallel_memcpy(buffer + rank * slot_size,
+                                    input_ptr + rank * data_size + offset,
+                                    chunk_size);
+                }
+            },
+            [&](char** buffers) {
+                reduce_all_buffers(buffers,
+                                   group->rank * slot_size,
+                                   chunk_size,
+                                   input.scalar_type(),
+                                   group->size,
+                                   group->rank);
+            },
+            [&](char** buffers) {
+                parallel_memcpy(output_ptr + offset,
+                                buffers[group->rank] + group->rank * slot_size,
+                                chunk_size);
+            });
+    }
+}
+
+std::shared_ptr<ccl_work_t> reduce_scatter_tensor(torch::Tensor& output,
+                                                  torch::Tensor& input,
+                                                  py::object op,
+                                                  std::vector<int> group,
+                                                  bool async_op)
+{
+    auto trace = coll_trace_begin(coll_reduce_scatter_tensor, input.numel() * input.element_size());
+    const int group_size = get_group_size(group);
+    TORCH_CHECK(input.numel() == group_size * output.numel(),
+                "reduce_scatter_tensor: input must be world size times larger than output");
+
+    auto shm_group = get_shm_group(group);
+    if (!is_shm_reduce_type(input.scalar_type()) || shm_group == nullptr ||
+        shm_slot_size(shm_group) == 0 || !is_reduce_op_sum(op) || !input.is_contiguous() ||
+        !output.is_contiguous()) {
+        return ccl_collective_work(trace,
+                                   ccl::reduce_scatter(input.data_ptr(),
+                                                       output.data_ptr(),
+                                                       output.numel(),
+                                                       get_ccl_datatype(input.scalar_type()),
+                                                       get_ccl_reduce_op(op, input),
+                                                       _get_comm_from_group(group)),
+                                   async_op,
+                                   {input, output});
+    }
+
+    return shm_collective_work(
+        trace, [=]() { shm_reduce_scatter(shm_group, output, input); }, async_op);
+}
+
+// Byte counts of the slices of a tensor split along dim 0, split_sizes empty means equal slices
+static std::vector<size_t> get_split_bytes(torch::Tensor& data,
+                                           const std::vector<int64_t>& split_sizes,
+                                           int group_size)
+{
+    size_t data_size = data.numel() * data.element_size();
+    std::vector<size_t> split_bytes;
+    if (split_sizes.empty()) {
+        split_bytes.assign(group_size, data_size / group_size);
+    } else {
+        TORCH_CHECK((int)split_sizes.size() == group_size,
+                    "all_to_all_single: split sizes must have one entry per rank");
+        size_t row_size = data.size(0) == 0 ? 0 : data_size / data.size(0);
+        for (auto split_size : split_sizes) { split_bytes.push_back(split_size * row_size); }
+    }
+    return split_bytes;
+}
+
+static void shm_all_to_all(shm_group_t* group,
+                           torch::Tensor output,
+                           torch::Tensor input,
+                           std::vector<size_t> recv_bytes,
+                           std::vector<size_t> send_bytes)
+{
+    std::vector<size_t> send_offsets(group->size, 0), recv_offsets(group->size, 0);
+    for (int rank = 1; rank < group->size; rank++) {
+        send_offsets[rank] = send_offsets[rank - 1] + send_bytes[rank - 1];
+        recv_offsets[rank] = recv_offsets[rank - 1] + recv_bytes[rank - 1];
+    }
+
+    // Splits may be uneven, so first agree on the largest one to know how many steps to take.
+    size_t max_split_bytes = 0;
+    shm_collective_step(
+        group,
+        [&](char* buffer) { memcpy(buffer, send_bytes.data(), group->size * sizeof(size_t)); },
+        shm_no_reduce,
+        [&](char** buffers) {
+            for (int rank = 0; rank < group->size; rank++) {
+                auto rank_send_bytes = (size_t*)buffers[rank];
+                for (int i = 0; i < group->size; i++) {
+                    max_split_bytes = std::max(max_split_bytes, rank_send_bytes[i]);
+                }
+            }
+        });
+
+    // Each buffer holds one slot per destination rank
+    auto input_ptr = (char*)input.data_ptr();
+    auto output_ptr = (char*)output.data_ptr();
+    size_t slot_size = shm_slot_size(group);
+    for (size_t offset = 0; offset < max_split_bytes; offset += slot_size) {
+        shm_collective_step(
+            group,
+            [&](char* buffer) {
+                for (int rank = 0; rank < group->size; rank++) {
+                    if (offset >= send_bytes[rank]) continue;
+                    parallel_memcpy(buffer + rank * slot_size,
+                                    input_ptr + send_offsets[rank] + offset,
+                                    std::min(slot_size, send_bytes[rank] - offset));
+                }
+            },
+            shm_no_reduce,
+            [&](char** buffers) {
+                for (int i = 0; i < group->size; i++) {
+                    int rank = (i + group->rank) % group->size;
+                    if (offset >= recv_bytes[rank]) continue;
+                    parallel_memcpy(output_ptr + recv_offsets[rank] + offset,
+                                    buffers[rank] + group->rank * slot_size,
+                                    std::min(slot_size, recv_bytes[rank] - offset));
+                }
+            });
+    }
+}
+
+std::shared_ptr<ccl_work_t> all_to_all_single(torch::Tensor& output,
+                                              torch::Tensor& input,
+                                              std::vector<int64_t> output_split_sizes,
+                                              std::vector<int64_t> input_split_sizes,
+                                              std::vector<int> group,
+                                              bool async_op)
+{
+    auto trace = coll_trace_begin(coll_all_to_all_single, input.numel() * input.element_size());
+    const int group_size = get_group_size(group);
+    auto send_bytes = get_split_bytes(input, input_split_sizes, group_size);
+    auto recv_bytes = get_split_bytes(output, output_split_sizes, group_size);
+
+    auto shm_group = get_shm_group(group);
+    if (shm_group == nullptr || shm_slot_size(shm_group) == 0 || !input.is_contiguous() ||
+        !output.is_contiguous()) {
+        std::vector<size_t> send_counts, recv_counts;
+        for (auto bytes : send_bytes) { send_counts.push_back(bytes / input.element_size()); }
+        for (auto bytes : recv_bytes) { recv_counts.push_back(bytes / output.element_size()); }
+        return ccl_collective_work(trace,
+                                   ccl::alltoallv(input.data_ptr(),
+                                                  send_counts,
+                                                  output.data_ptr(),
+                                                  recv_counts,
+                                                  get_ccl_datatype(input.scalar_type()),
+                                                  _get_comm_from_group(group)),
+                                   async_op,
+                                   {input, output});
+    }
+
+    return shm_collective_work(
+        trace,
+        [=]() { shm_all_to_all(shm_group, output, input, recv_bytes, send_bytes); },
+        async_op);
+}
+
+std::shared_ptr<ccl_work_t> barrier(std::vector<int> group, bool async_op)
+{
+    auto trace = coll_trace_begin(coll_barrier, 0);
+    return ccl_collective_work(trace, ccl::barrier(_get_comm_from_group(group)), async_op, {});
+}
+
+// 1-bit compression for 1-bit Adam/LAMB. A sign bit is 1 for values >= 0 and bit i of a packed
+// buffer is bit i % 8 of byte i / 8, which is the bit order of an AVX-512 compare mask.
+
+// AVX-512 part of compress_signs, vector_numel is a multiple of 16.
+static void compress_signs_avx512(float* data,
+                                  float* error,
+                                  uint8_t* signs,
+                                  int64_t vector_numel,
+                                  float scale) __attribute__((target("avx512bw")));
+static void compress_signs_avx512(float* data,
+                                  float* error,
+                                  uint8_t* signs,
+                                  int64_t vector_numel,
+                                  float scale)
+{
+    const auto zero = _mm512_setzero_ps();
+    const auto plus_scale = _mm512_set1_ps(scale);
+    const auto minus_scale = _mm512_set1_ps(-scale);
+#pragma omp parallel for
+    for (int64_t i = 0; i < vector_numel; i += 16) {
+        auto value = _mm512_loadu_ps(data + i);
+        __mmask16 mask = _mm512_cmp_ps_mask(value, zero, _CMP_GE_OQ);
+        auto compressed = _mm512_mask_blend_ps(mask, minus_scale, plus_scale);
+        _mm512_storeu_ps(error + i, _mm512_sub_ps(value, compressed));
+        memcpy(signs + i / 8, &mask, sizeof(mask));
+    }
+}
+
+// Adds the error feedback to data, packs the signs of data into signs and leaves in error what
+// the compressed data misses. Returns the scale the signs stand for.
+static float compress_signs(float* data, float* error, uint8_t* signs, int64_t numel)
+{
+    double sum_of_squares = 0;
+#pragma omp parallel for reduction(+ : sum_of_squares)
+    for (int64_t i = 0; i < numel; i++) {
+        data[i] += error[i];
+        sum_of_squares += (double)data[i] * data[i];
+    }
+    const float scale = numel > 0 ? std::sqrt(sum_of_squares / numel) : 0;
+
+    // the mask packing needs AVX-512, other CPUs pack the signs one at a time
+    const int64_t vector_numel = shm_isa == shm_isa_avx512 ? numel / 16 * 16 : 0;
+    if (vector_numel > 0) { compress_signs_avx512(data, error, signs, vector_numel, scale); }
+    for (int64_t i = vector_numel; i < numel; i++) {
+        if (i % 8 == 0) { signs[i / 8] = 0; }
+        bool positive = data[i] >= 0;
+        signs[i / 8] |= positive << (i % 8);
+        error[i] = data[i] - (positive ? scale : -scale);
+    }
+    return scale;
+}
+
+// AVX-512 part of decompress_signs, vector_numel is a multiple of 16.
+static void decompress_signs_avx512(const uint8_t* signs,
+                                    float scale,
+                                    float* data,
+                                    int64_t vector_numel,
+                                    bool accumulate) __attribute__((target("avx512bw")));
+static void decompress_signs_avx512(const uint8_t* signs,
+                                    float scale,
+                                    float* data,
+                                    int64_t vector_numel,
+                                    bool accumulate)
+{
+    const auto plus_scale = _mm512_set1_ps(scale);
+    const auto minus_scale = _mm512_set1_ps(-scale);
+#pragma omp parallel for
+    for (int64_t i = 0; i < vector_numel; i += 16) {
+        __mmask16 mask;
+        memcpy(&mask, signs + i / 8, sizeof(mask));
+        auto value = _mm512_mask_blend_ps(mask, minus_scale, plus_scale);
+        if (accumulate) { value = _mm512_add_ps(value, _mm512_loadu_ps(data + i)); }
+        _mm512_storeu_ps(data + i, value);
+    }
+}
+
+// Writes (or adds if accumulate) +-scale for each of the numel packed signs to data.
+static void decompress_signs(const uint8_t* signs,
+                             float scale,
+                             float* data,
+                             int64_t numel,
+                             bool accumulate)
+{
+    const int64_t vector_numel = shm_isa == shm_isa_avx512 ? numel / 16 * 16 : 0;
+    if (vector_numel > 0) { decompress_signs_avx512(signs, scale, data, vector_numel, accumulate); }
+    for (int64_t i = vector_numel; i < numel; i++) {
+        float value = (signs[i / 8] >> (i % 8)) & 1 ? scale : -scale;
+        data[i] = accumulate ? data[i] + value : value;
+    }
+}
+
+/*
+    1-bit compressed allreduce with error feedback, as done by NcclBackend.compressed_allreduce.
+    Every rank compresses buffer and sends chunk r of the signs to rank r. Rank r averages its
+    chunk, compresses it again with server_error, and the compressed chunks are all-gathered back
+    into buffer. buffer and worker_error hold numel float32 values, numel a multiple of 8 times the
+    group size, and server_error holds numel / group size. The exchanges use the SHM collectives
+    when the group has a workspace and oneCCL otherwise.
+*/
+void compressed_all_reduce(torch::Tensor& buffer,
+                           torch::Tensor& worker_error,
+                           torch::Tensor& server_error,
+                           std::vector<int> group)
+{
+    const int group_size = get_group_size(group);
+    const int64_t numel = buffer.numel();
+    const int64_t chunk_numel = numel / group_size;
+    TORCH_CHECK(buffer.scalar_type() == c10::ScalarType::Float &&
+                    worker_error.scalar_type() == c10::ScalarType::Float &&
+                    server_error.scalar_type() == c10::ScalarType::Float,
+                "compressed_all_reduce: tensors must be float32");
+    TORCH_CHECK(buffer.is_contiguous() && worker_error.is_contiguous() &&
+                    server_error.is_contiguous(),
+                "compressed_all_reduce: tensors must be contiguous");
+    TORCH_CHECK(numel % (group_size * 8) == 0 && worker_error.numel() == numel &&
+                    server_error.numel() == chunk_numel,
+                "compressed_all_reduce: buffer size must be a multiple of 8 times the group size");
+
+    auto byte_options = buffer.options().dtype(torch::kByte);
+
+    // phase 1: send chunk r of the worker signs to rank r and gather all worker scales
+    auto worker_signs = torch::empty({numel / 8}, byte_options);
+    auto worker_scale = torch::empty({1}, buffer.options());
+    worker_scale.data_ptr<float>()[0] = compress_signs(buffer.data_ptr<float>(),
+                                                       worker_error.data_ptr<float>(),
+                                                       worker_signs.data_ptr<uint8_t>(),
+                                                       numel);
+    auto recv_signs = torch::empty({numel / 8}, byte_options);
+    auto worker_scales = torch::empty({group_size}, buffer.options());
+    all_to_all_single(recv_signs, worker_signs, {}, {}, group, false);
+    all_gather_into_tensor(worker_scales, worker_scale, group, false);
+
+    // average this rank's chunk and compress it again with the server error
+    auto server_m = torch::empty({chunk_numel}, buffer.options());
+    for (int rank = 0; rank < group_size; rank++) {
+        decompress_signs(recv_signs.data_ptr<uint8_t>() + rank * chunk_numel / 8,
+                         worker_scales.data_ptr<float>()[rank] / group_size,
+                         server_m.data_ptr<float>(),
+                         chunk_numel,
+                         rank > 0);
+    }
+    auto server_signs = torch::empty({chunk_numel / 8}, byte_options);
+    auto server_scale = torch::empty({1}, buffer.options());
+    server_scale.data_ptr<float>()[0] = compress_signs(server_m.data_ptr<float>(),
+                                                       server_error.data_ptr<float>(),
+                                                       server_signs.data_ptr<uint8_t>(),
+                                                       chunk_numel);
+
+    // phase 2: gather the compressed chunks of all ranks back into buffer
+    auto all_server_signs = torch::empty({numel / 8}, byte_options);
+    auto server_scales = torch::empty({group_size}, buffer.options());
+    all_gather_into_tensor(all_server_signs, server_signs, group, false);
+    all_gather_into_tensor(server_scales, server_scale, group, false);
+    for (int rank = 0; rank < group_size; rank++) {
+        decompress_signs(all_server_signs.data_ptr<uint8_t>() + rank * chunk_numel / 8,
+                         server_scales.data_ptr<float>()[rank],
+                         buffer.data_ptr<float>() + rank * chunk_numel,
+                         chunk_numel,
+                         false);
+    }
+}
+
+/*
+    Statistics of every collective called so far, by collective name:
+      count, bytes: [SHM, oneCCL] calls and input bytes of this rank
+      shm_latency_hist, ccl_latency_hist: latency of each path
+      copy_in_hist, wait_hist, reduce_hist, copy_out_hist: time SHM collectives spent in each
+      phase of their steps
+*/
+std::map<std::string, std::map<std::string, std::vector<uint64_t>>> get_coll_stats()
+{
+    std::lock_guard<std::mutex> lock(coll_stats_mutex);
+    std::map<std::string, std::map<std::string, std::vector<uint64_t>>> result;
+    for (int coll = 0; coll < num_colls; coll++) {
+        auto& stats = coll_stats[coll];
+        if (std::accumulate(stats.count, stats.count + num_coll_paths, (uint64_t)0) == 0) continue;
+        auto& out = result[coll_names[coll]];
+        out["count"] = std::vector<uint64_t>(stats.count, stats.count + num_coll_paths);
+        out["bytes"] = std::vector<uint64_t>(stats.bytes, stats.bytes + num_coll_paths);
+        for (int path = 0; path < num_coll_paths; path++) {
+            out[std::string(coll_path_names[path]) + "_latency_hist"] = std::vector<uint64_t>(
+                stats.latency_hist[path], stats.latency_hist[path] + COLL_HIST_BUCKETS);
         }
-        if (world_rank != 0) {
-            // if rank 0 spin too fast it could be in state 1 of next allreduce
-            // in this case wait_buffer_state_until(0, 0) may cause deadlock
-            // what we are certain is when rank 0 finishes the state won't be 2
-            wait_buffer_state_until_not(0, coll_allreduce_naive__reduce_done);
-            workspace[world_rank].state = coll_begin;
+        for (int phase = 0; phase < num_shm_phases; phase++) {
+            out[std::string(shm_phase_names[phase]) + "_hist"] = std::vector<uint64_t>(
+                stats.phase_hist[phase], stats.phase_hist[phase] + COLL_HIST_BUCKETS);
         }
     }
+    return result;
 }
 
-void barrier(std::vector<int> group, bool async_op)
+void reset_coll_stats()
 {
-    CCLCHECK(ccl::barrier(_get_comm_from_group(group)).wait());
+    std::lock_guard<std::mutex> lock(coll_stats_mutex);
+    std::fill(coll_stats, coll_stats + num_colls, coll_stats_t());
+}
+
+void enable_coll_stats(bool enabled) { stats_enabled = enabled; }
+
+void enable_trace(bool enabled) { trace_enabled = enabled; }
+
+// Writes the collectives traced since the last dump as Chrome trace events, one process per rank,
+// and clears them. Timestamps are wall clock so the traces of several ranks line up.
+void dump_trace(std::string path)
+{
+    std::lock_guard<std::mutex> lock(coll_stats_mutex);
+    FILE* file = fopen(path.c_str(), "w");
+    TORCH_CHECK(file != nullptr, "dump_trace: cannot open " + path);
+
+    const int64_t wall_offset_ns =
+        std::chrono::duration_cast<std::chrono::nanoseconds>(
+            std::chrono::system_clock::now().time_since_epoch())
+            .count() -
+        (int64_t)now_ns();
+    fprintf(file, "{\"traceEvents\": [");
+    for (size_t i = 0; i < trace_events.size(); i++) {
+        auto& event = trace_events[i];
+        fprintf(file,
+                "%s\n{\"name\": \"%s\", \"cat\": \"%s\", \"ph\": \"X\", \"pid\": %d, "
+                "\"tid\": %d, \"ts\": %.3f, \"dur\": %.3f, \"args\": {\"bytes\": %zu",
+                i == 0 ? "" : ",",
+                coll_names[event.trace.coll],
+                coll_path_names[event.path],
+                world_rank,
+                event.tid,
+                (event.trace.start_ns + wall_offset_ns) / 1e3,
+                event.duration_ns / 1e3,
+                event.trace.bytes);
+        if (event.path == coll_path_shm) {
+            for (int phase = 0; phase < num_shm_phases; phase++) {
+                fprintf(file,
+                        ", \"%s_us\": %.3f",
+                        shm_phase_names[phase],
+                        event.phase_ns[phase] / 1e3);
+            }
+        }
+        fprintf(file, "}}");
+    }
+    fprintf(file, "\n], \"otherData\": {\"dropped_events\": %lu}}\n", dropped_trace_events);
+    fclose(file);
+
+    trace_events.clear();
+    dropped_trace_events = 0;
 }
 
 std::vector<std::string> get_available_coll()
 {
-    std::vector<std::string> colls{
-        "broadcast", "all_reduce", "inference_all_reduce", "all_reduce_caching", "barrier"};
+    std::vector<std::string> colls{"broadcast",
+                                   "all_reduce",
+                                   "inference_all_reduce",
+                                   "all_reduce_caching",
+                                   "all_reduce_coalesced",
+                                   "barrier",
+                                   "all_gather",
+                                   "all_gather_into_tensor",
+                                   "reduce_scatter_tensor",
+                                   "all_to_all_single"};
     return colls;
 }
 
 PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
 {
+    py::class_<ccl_work_t, std::shared_ptr<ccl_work_t>>(m, "work")
+        .def("wait", &ccl_work_t::wait, py::call_guard<py::gil_scoped_release>())
+        .def("is_completed", &ccl_work_t::is_completed);
+
     m.def("get_kvs_addr", &get_kvs_addr, "create and get main kvs addr");
     m.def("initialize", &initialize, "ccl initialize");
     m.def("get_rank", &get_rank, "get rank");
@@ -632,8 +2378,30 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
     m.def("all_reduce", &all_reduce, "ccl all_reduce");
     m.def("inference_all_reduce", &inference_all_reduce, "low latency all_reduce implementation");
     m.def("all_reduce_caching", &all_reduce_caching, "ccl all_reduce with caching");
+    m.def("register_comm_arena", &register_comm_arena, "register_comm_arena");
+    m.def("map_comm_buffer", &map_comm_buffer, "map_comm_buffer");
+    m.def("compressed_all_reduce",
+          &compressed_all_reduce,
+          "1-bit compressed all_reduce with error feedback");
+    m.def("all_reduce_coalesced",
+          &all_reduce_coalesced,
+          "all_reduce of a list of tensors in one call with SHM fast path");
     m.def("barrier", &barrier, "barrier");
+    m.def("all_gather", &all_gather, "all_gather with SHM fast path");
+    m.def("all_gather_into_tensor",
+          &all_gather_into_tensor,
+          "all_gather_into_tensor with SHM fast path");
+    m.def("reduce_scatter_tensor",
+          &reduce_scatter_tensor,
+          "reduce_scatter_tensor with SHM fast path");
+    m.def("all_to_all_single", &all_to_all_single, "all_to_all_single with SHM fast path");
     m.def("initialize_sub_comm", &initialize_sub_comm, "initialize_sub_comm");
+    m.def("initialize_hierarchy", &initialize_hierarchy, "initialize_hierarchy");
     m.def("get_sub_kvs_addr", &get_sub_kvs_addr, "get_sub_kvs_addr");
     m.def("get_available_coll", &get_available_coll, "get_available_coll");
+    m.def("get_coll_stats", &get_coll_stats, "get_coll_stats");
+    m.def("reset_coll_stats", &reset_coll_stats, "reset_coll_stats");
+    m.def("enable_coll_stats", &enable_coll_stats, "enable_coll_stats");
+    m.def("enable_trace", &enable_trace, "enable_trace");
+    m.def("dump_trace", &dump_trace, "dump_trace");
 }
@@ -0,0 +1,377 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+#include <torch/extension.h>
+
+#include <immintrin.h>
+#include <omp.h>
+#include <algorithm>
+#include <cmath>
+#include <vector>
+
+/*
+CPU versions of the swizzled quantization and quantized reduction kernels of ZeRO++ quantized
+gradients (qgZ), with the data layout of csrc/quantization so that either side can read what the
+other wrote: int8 values, or int4 values packed two per byte with the first one in the high
+nibble, and per group the inverse scale (symmetric) or the inverse scale and the offset
+(asymmetric). Values are rounded to nearest even like __float2int_rn.
+*/
+
+namespace quantize {
+enum class Type { Symmetric, Asymmetric };
+
+inline int param_elems(Type quant_type) { return quant_type == Type::Asymmetric ? 2 : 1; }
+}  // namespace quantize
+
+static const bool use_avx512 = __builtin_cpu_supports("avx512bw");
+
+// scale multiplies a value, less offset, before it is rounded
+struct group_params_t {
+    float scale;
+    float offset;
+};
+
+static void find_min_max_avx512(const float* data, int64_t n, float* min_val, float* max_val)
+    __attribute__((target("avx512bw")));
+static void find_min_max_avx512(const float* data, int64_t n, float* min_val, float* max_val)
+{
+    auto vec_min = _mm512_set1_ps(*min_val);
+    auto vec_max = _mm512_set1_ps(*max_val);
+    for (int64_t i = 0; i < n; i += 16) {
+        auto value = _mm512_loadu_ps(data + i);
+        vec_min = _mm512_min_ps(vec_min, value);
+        vec_max = _mm512_max_ps(vec_max, value);
+    }
+    *min_val = _mm512_reduce_min_ps(vec_min);
+    *max_val = _mm512_reduce_max_ps(vec_max);
+}
+
+// Parameters of a group of n values, as quantize::GroupStats and quantize::Params compute them.
+static group_params_t get_group_params(const float* data,
+                                       int64_t n,
+                                       int num_bits,
+                                       quantize::Type quant_type)
+{
+    float min_val = INFINITY;
+    float max_val = -INFINITY;
+    const int64_t vector_n = use_avx512 ? n / 16 * 16 : 0;
+    if (vector_n > 0) { find_min_max_avx512(data, vector_n, &min_val, &max_val); }
+    for (int64_t i = vector_n; i < n; i++) {
+        min_val = std::min(min_val, data[i]);
+        max_val = std::max(max_val, data[i]);
+    }
+
+    group_params_t params;
+    if (quant_type == quantize::Type::Symmetric) {
+        const float abs_max = std::max(std::abs(min_val), std::abs(max_val));
+        params.scale = abs_max == 0 ? 1.0f : (1 << num_bits) / (2 * abs_max);
+        params.offset = 0;
+    } else {
+        params.scale = max_val == min_val ? 1.0f : (1 << num_bits) / (max_val - min_val);
+        params.offset = (max_val + min_val) / 2;
+    }
+    return params;
+}
+
+static void quantize_values_avx512(const float* data,
+                                   int8_t* output,
+                                   int64_t n,
+                                   int num_bits,
+                                   group_params_t params) __attribute__((target("avx512bw")));
+static void quantize_values_avx512(const float* data,
+                                   int8_t* output,
+                                   int64_t n,
+                                   int num_bits,
+                                   group_params_t params)
+{
+    const auto scale = _mm512_set1_ps(params.scale);
+    const auto offset = _mm512_set1_ps(params.offset);
+    const auto q_min = _mm512_set1_epi32(-(1 << (num_bits - 1)));
+    const auto q_max = _mm512_set1_epi32((1 << (num_bits - 1)) - 1);
+    for (int64_t i = 0; i < n; i += 16) {
+        auto value = _mm512_mul_ps(_mm512_sub_ps(_mm512_loadu_ps(data + i), offset), scale);
+        auto q = _mm512_cvtps_epi32(value);
+        q = _mm512_min_epi32(_mm512_max_epi32(q, q_min), q_max);
+        auto bytes = _mm512_cvtepi32_epi8(q);
+        if (num_bits == 8) {
+            _mm_storeu_si128((__m128i*)(output + i), bytes);
+        } else {
+            // every 16-bit lane holds a pair, first value in the low byte, which becomes the
+            // high nibble of the packed byte
+            auto high = _mm_and_si128(_mm_slli_epi16(bytes, 4), _mm_set1_epi16(0xf0));
+            auto low = _mm_and_si128(_mm_srli_epi16(bytes, 8), _mm_set1_epi16(0x0f));
+            auto packed = _mm_or_si128(high, low);
+            _mm_storel_epi64((__m128i*)(output + i / 2), _mm_packus_epi16(packed, packed));
+        }
+    }
+}
+
+// Quantize n values into output, n must be even for int4.
+static void quantize_values(const float* data,
+                            int8_t* output,
+                            int64_t n,
+                            int num_bits,
+                            group_params_t params)
+{
+    const int64_t vector_n = use_avx512 ? n / 16 * 16 : 0;
+    if (vector_n > 0) { quantize_values_avx512(data, output, vector_n, num_bits, params); }
+    const long q_min = -(1 << (num_bits - 1));
+    const long q_max = (1 << (num_bits - 1)) - 1;
+    for (int64_t i = vector_n; i < n; i++) {
+        long q = std::lrint((data[i] - params.offset) * params.scale);
+        q = std::min(std::max(q, q_min), q_max);
+        if (num_bits == 8) {
+            output[i] = (int8_t)q;
+        } else if (i % 2 == 0) {
+            output[i / 2] = (int8_t)(q << 4);
+        } else {
+            output[i / 2] = (int8_t)(output[i / 2] | (q & 0xf));
+        }
+    }
+}
+
+static void dequantize_values_avx512(const int8_t* input,
+                                     float* output,
+                                     int64_t n,
+                                     int num_bits,
+                                     float inv_scale,
+                                     float offset,
+                                     bool accumulate) __attribute__((target("avx512bw")));
+static void dequantize_values_avx512(const int8_t* input,
+                                     float* output,
+                                     int64_t n,
+                                     int num_bits,
+                                     float inv_scale,
+                                     float offset,
+                                     bool accumulate)
+{
+    const auto scale = _mm512_set1_ps(inv_scale);
+    const auto vec_offset = _mm512_set1_ps(offset);
+    for (int64_t i = 0; i < n; i += 16) {
+        __m128i bytes;
+        if (num_bits == 8) {
+            bytes = _mm_loadu_si128((const __m128i*)(input + i));
+        } else {
+            // sign extend both nibbles of every byte, high nibble first
+            auto packed = _mm_cvtepi8_epi16(_mm_loadl_epi64((const __m128i*)(input + i / 2)));
+            auto high = _mm_and_si128(_mm_srai_epi16(packed, 4), _mm_set1_epi16(0xff));
+            auto low = _mm_slli_epi16(_mm_srai_epi16(_mm_slli_epi16(packed, 12), 12), 8);
+            bytes = _mm_or_si128(high, low);
+        }
+        auto q = _mm512_cvtepi32_ps(_mm512_cvtepi8_epi32(bytes));
+        auto value = _mm512_fmadd_ps(q, scale, vec_offset);
+        if (accumulate) { value = _mm512_add_ps(value, _mm512_loadu_ps(output + i)); }
+        _mm512_storeu_ps(output + i, value);
+    }
+}
+
+// Write (or add if accumulate) the n values quantized in input to output.
+static void dequantize_values(const int8_t* input,
+                              float* output,
+                              int64_t n,
+                              int num_bits,
+                              float inv_scale,
+                              float offset,
+                              bool accumulate)
+{
+    const int64_t vector_n = use_avx512 ? n / 16 * 16 : 0;
+    if (vector_n > 0) {
+        dequantize_values_avx512(input, output, vector_n, num_bits, inv_scale, offset, accumulate);
+    }
+    for (int64_t i = vector_n; i < n; i++) {
+        int q;
+        if (num_bits == 8) {
+            q = input[i];
+        } else {
+            q = i % 2 == 0 ? input[i / 2] >> 4 : (int8_t)(input[i / 2] << 4) >> 4;
+        }
+        float value = std::fma((float)q, inv_scale, offset);
+        output[i] = accumulate ? output[i] + value : value;
+    }
+}
+
+static void store_params(float* scales, int group, group_params_t params, quantize::Type quant_type)
+{
+    const int param_elems = quantize::param_elems(quant_type);
+    scales[group * param_elems] = 1 / params.scale;
+    if (param_elems == 2) { scales[group * param_elems + 1] = params.offset; }
+}
+
+static float load_offset(const float* scales, int group, quantize::Type quant_type)
+{
+    return quant_type == quantize::Type::Asymmetric ? scales[2 * group + 1] : 0;
+}
+
+/*
+Quantize input_vals in groups and reorder the groups for the two all-to-all exchanges of qgZ. The
+groups of partition d * nodes + n of the output are those of partition n * devices_per_node + d
+of the input, so that after the intra-node exchange every device holds its share of the data of
+every node contiguously. With pipelining, the partitions are split into pipeline_size slices and
+the first slices of all partitions come first.
+*/
+std::vector<at::Tensor> ds_swizzle_quant(at::Tensor& input_vals,
+                                         int groups,
+                                         int num_bits,
+                                         quantize::Type quant_type,
+                                         int pipeline_size,
+                                         int nodes,
+                                         int devices_per_node)
+{
+    const int partitions = nodes * devices_per_node;
+    const int64_t numel = input_vals.numel();
+    TORCH_CHECK(num_bits == 4 || num_bits == 8, "swizzle_quant supports 4 and 8 bits");
+    TORCH_CHECK(numel % groups == 0 && groups % (partitions * pipeline_size) == 0,
+                "swizzle_quant needs groups dividing the input and divisible by partitions");
+    const int64_t elems_per_group = numel / groups;
+    const int values_per_byte = 8 / num_bits;
+    TORCH_CHECK(elems_per_group % values_per_byte == 0, "int4 groups must hold an even count");
+
+    auto input = input_vals.contiguous().to(at::kFloat);
+    auto scales = torch::empty({groups, quantize::param_elems(quant_type)},
+                               at::TensorOptions().dtype(at::kFloat));
+    auto output = torch::empty({numel / values_per_byte}, at::TensorOptions().dtype(at::kChar));
+    const float* input_ptr = input.data_ptr<float>();
+    int8_t* output_ptr = output.data_ptr<int8_t>();
+    float* scales_ptr = scales.data_ptr<float>();
+
+    const int groups_per_partition = groups / partitions;
+    const int contiguous_groups = groups_per_partition / pipeline_size;
+#pragma omp parallel for
+    for (int group = 0; group < groups; group++) {
+        const int partition = group / groups_per_partition;
+        const int pipeline = group % groups_per_partition / contiguous_groups;
+        const int output_partition = pipeline * partitions +
+                                     (partition % devices_per_node) * nodes +
+                                     partition / devices_per_node;
+        const int output_group = output_partition * contiguous_groups + group % contiguous_groups;
+
+        const float* data = input_ptr + group * elems_per_group;
+        auto params = get_group_params(data, elems_per_group, num_bits, quant_type);
+        quantize_values(data,
+                        output_ptr + output_group * elems_per_group / values_per_byte,
+                        elems_per_group,
+                        num_bits,
+                        params);
+        store_params(scales_ptr, output_group, params, quant_type);
+    }
+    return {output, scales};
+}
+
+/*
+Dequantize the devices_per_node quantized tensors that make up input_vals, sum them and quantize
+the sum again in out_groups groups. Each input tensor has in_groups / devices_per_node groups.
+*/
+std::vector<at::Tensor> quantized_reduction(at::Tensor& input_vals,
+                                            at::Tensor& input_scales,
+                                            int in_groups,
+                                            int out_groups,
+                                            int num_bits,
+                                            quantize::Type quant_type,
+                                            int devices_per_node)
+{
+    TORCH_CHECK(num_bits == 4 || num_bits == 8, "quantized_reduction supports 4 and 8 bits");
+    const int param_elems = quantize::param_elems(quant_type);
+    const int values_per_byte = 8 / num_bits;
+    const int64_t bytes_per_in_tensor = input_vals.numel() / devices_per_node;
+    const int groups_per_in_tensor = in_groups / devices_per_node;
+    const int64_t bytes_per_in_group = bytes_per_in_tensor / groups_per_in_tensor;
+    const int64_t bytes_per_out_group = bytes_per_in_tensor / out_groups;
+
+    auto sizes = input_vals.sizes().vec();
+    sizes.back() /= devices_per_node;
+    auto output = torch::empty(sizes, at::TensorOptions().dtype(at::kChar));
+    auto scales =
+        torch::empty({out_groups, param_elems}, at::TensorOptions().dtype(at::kFloat));
+    auto input = input_vals.contiguous();
+    auto in_scales = input_scales.contiguous();
+    const int8_t* input_ptr = input.data_ptr<int8_t>();
+    const float* in_scales_ptr = in_scales.data_ptr<float>();
+    int8_t* output_ptr = output.data_ptr<int8_t>();
+    float* scales_ptr = scales.data_ptr<float>();
+
+#pragma omp parallel
+    {
+        std::vector<float> sum(bytes_per_out_group * values_per_byte);
+#pragma omp for
+        for (int group = 0; group < out_groups; group++) {
+            const int64_t start = group * bytes_per_out_group;
+            const int64_t end = start + bytes_per_out_group;
+            for (int tensor = 0; tensor < devices_per_node; tensor++) {
+                const int8_t* tensor_ptr = input_ptr + tensor * bytes_per_in_tensor;
+                const float* tensor_scales =
+                    in_scales_ptr + tensor * groups_per_in_tensor * param_elems;
+                // an output group may span several input groups
+                for (int64_t offset = start; offset < end;) {
+                    const int in_group = offset / bytes_per_in_group;
+                    const int64_t segment_end = std::min(end, (in_group + 1) * bytes_per_in_group);
+                    dequantize_values(tensor_ptr + offset,
+                                      sum.data() + (offset - start) * values_per_byte,
+                                      (segment_end - offset) * values_per_byte,
+                                      num_bits,
+                                      tensor_scales[in_group * param_elems],
+                                      load_offset(tensor_scales, in_group, quant_type),
+                                      tensor > 0);
+                    offset = segment_end;
+                }
+            }
+            auto params = get_group_params(sum.data(), sum.size(), num_bits, quant_type);
+            quantize_values(sum.data(), output_ptr + start, sum.size(), num_bits, params);
+            store_params(scales_ptr, group, params, quant_type);
+        }
+    }
+    return {output, scales};
+}
+
+at::Tensor dequantize_fp32(at::Tensor& quantized_data,
+                           at::Tensor& params,
+                           int groups,
+                           int num_bits,
+                           quantize::Type quant_type)
+{
+    const int param_elems = quantize::param_elems(quant_type);
+    const int values_per_byte = 8 / num_bits;
+    auto sizes = quantized_data.sizes().vec();
+    sizes.back() *= values_per_byte;
+    auto output = torch::empty(sizes, at::TensorOptions().dtype(at::kFloat));
+    const int64_t elems_per_group = output.numel() / groups;
+    auto input = quantized_data.contiguous();
+    auto scales = params.contiguous();
+    const int8_t* input_ptr = input.data_ptr<int8_t>();
+    const float* scales_ptr = scales.data_ptr<float>();
+    float* output_ptr = output.data_ptr<float>();
+
+#pragma omp parallel for
+    for (int group = 0; group < groups; group++) {
+        dequantize_values(input_ptr + group * elems_per_group / values_per_byte,
+                          output_ptr + group * elems_per_group,
+                          elems_per_group,
+                          num_bits,
+                          scales_ptr[group * param_elems],
+                          load_offset(scales_ptr, group, quant_type),
+                          false);
+    }
+    return output;
+}
+
+at::Tensor dequantize(at::Tensor& quantized_data,
+                      at::Tensor& params,
+                      int groups,
+                      int num_bits,
+                      quantize::Type quant_type)
+{
+    return dequantize_fp32(quantized_data, params, groups, num_bits, quant_type).to(at::kHalf);
+}
+
+PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
+{
+    pybind11::enum_<quantize::Type>(m, "QuantizationType")
+        .value("Symmetric", quantize::Type::Symmetric)
+        .value("Asymmetric", quantize::Type::Asymmetric)
+        .export_values();
+    m.def("dequantize", &dequantize);
+    m.def("dequantize_fp32", &dequantize_fp32);
+    m.def("swizzle_quant", &ds_swizzle_quant);
+    m.def("quantized_reduction", &quantized_reduction);
+}
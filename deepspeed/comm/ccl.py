@@ -6,11 +6,16 @@
 Copyright 2021 The Microsoft DeepSpeed Team
 '''
 
+import os
+import socket
 import torch
 from deepspeed.accelerator import get_accelerator
 from .reduce_op import ReduceOp
 from .torch import TorchBackend
 
+# Host names are exchanged in buffers of this size, the longest Linux allows.
+MAX_NODE_NAME_BYTES = 64
+
 
 def build_ccl_op():
     builder = get_accelerator().create_op_builder("CCLCommBuilder")
@@ -23,12 +28,17 @@ def build_ccl_op():
 
 class CCLHandler():
 
-    def __init__(self, ccl_comm_op=None):
+    def __init__(self, ccl_comm_op=None, work=None):
         self.ccl_comm_op = ccl_comm_op
+        # work handle of an async_op collective, None if the collective already completed
+        self.work = work
 
     def wait(self):
-        # backend covered it
-        pass
+        if self.work is not None:
+            self.work.wait()
+
+    def is_completed(self):
+        return self.work is None or self.work.is_completed()
 
 
 class CCLBackend(TorchBackend):
@@ -55,10 +65,76 @@ class CCLBackend(TorchBackend):
         self.initialized = True
         self.groups = [tuple(range(self.get_world_size()))]
         self.available_coll = self.ccl_comm_op.get_available_coll()
+        self.has_all_reduce_coalesced = self.has_all_reduce_coalesced or "all_reduce_coalesced" in self.available_coll
+        self._init_hierarchy()
 
     def is_initialized(self):
         return self.initialized
 
+    def _node_name(self):
+        return socket.gethostname()
+
+    def _init_hierarchy(self):
+        # Multi-node jobs reduce within each node over SHM and only send 1/local_size of the data
+        # across nodes. Nodes are grouped by where the ranks actually run, in whatever order the
+        # launcher placed them.
+        size = self.get_world_size()
+        if size <= 1 or int(os.environ.get('LOCAL_SIZE', 0)) == size:
+            return
+        rank = self.get_rank()
+        device = get_accelerator().current_device_name()
+        name = torch.zeros(MAX_NODE_NAME_BYTES, dtype=torch.uint8)
+        name_bytes = self._node_name().encode()[:MAX_NODE_NAME_BYTES]
+        name[:len(name_bytes)] = torch.tensor(list(name_bytes), dtype=torch.uint8)
+        names = [torch.empty_like(name).to(device) for _ in range(size)]
+        super(CCLBackend, self).all_gather(names, name.to(device))
+        ranks_by_node = {}
+        for r, node_name in enumerate(names):
+            ranks_by_node.setdefault(bytes(node_name.cpu().tolist()), []).append(r)
+        node_groups = list(ranks_by_node.values())
+        local_size = len(node_groups[0])
+        # the peer groups need the same number of ranks on every node
+        if len(node_groups) <= 1 or local_size <= 1 or any(len(ranks) != local_size for ranks in node_groups):
+            return
+        peer_groups = [[ranks[local_rank] for ranks in node_groups] for local_rank in range(local_size)]
+        # every rank has to take part in creating every group
+        for ranks in node_groups + peer_groups:
+            group = self.new_group(ranks)
+            if rank in ranks:
+                self._new_group(ranks, group)
+        node_ranks = next(ranks for ranks in node_groups if rank in ranks)
+        self.ccl_comm_op.initialize_hierarchy(node_ranks, peer_groups[node_ranks.index(rank)])
+
+    def enable_coll_stats(self, enabled=True):
+        # statistics are off by default so that collectives do not pay for them
+        self.ccl_comm_op.enable_coll_stats(enabled)
+
+    def get_coll_stats(self):
+        """Per collective called since statistics were enabled: calls and bytes as [SHM, oneCCL], and
+        latency histograms of each path and of the SHM copy-in, wait, reduce and copy-out phases.
+        Bucket i counts times below 2^i us."""
+        return self.ccl_comm_op.get_coll_stats()
+
+    def reset_coll_stats(self):
+        self.ccl_comm_op.reset_coll_stats()
+
+    def enable_trace(self, enabled=True):
+        self.ccl_comm_op.enable_trace(enabled)
+
+    def dump_trace(self, path):
+        # Chrome trace (chrome://tracing, Perfetto) of the collectives traced since the last dump
+        self.ccl_comm_op.dump_trace(path)
+
+    def register_comm_arena(self, nbytes):
+        # persistent memory that map_comm_buffer carves named communication buffers from
+        self.ccl_comm_op.register_comm_arena(nbytes)
+
+    def map_comm_buffer(self, name, tensor):
+        """Tensor with the shape and dtype of tensor that lives in the arena buffer called name. The
+        same name always maps to the same memory, so a gradient bucket kept in it can be reduced in
+        place every iteration and all_reduce reuses the plan oneCCL cached for it the first time."""
+        return self.ccl_comm_op.map_comm_buffer(name, tensor)
+
     def run_collective(self, name, **kwargs):
         if name in self.available_coll:
             if 'group' in kwargs:
@@ -68,12 +144,10 @@ class CCLBackend(TorchBackend):
             if 'src' in kwargs:
                 kwargs['src'] = kwargs['group'].index(kwargs['src'])
             func = "self.ccl_comm_op." + name
-            eval(func)(*(kwargs.values()))
-            return CCLHandler(self.ccl_comm_op)
+            return CCLHandler(self.ccl_comm_op, eval(func)(*(kwargs.values())))
         else:
             func = "super(CCLBackend, self)." + name
-            eval(func)(*(kwargs.values()))
-            return CCLHandler(self.ccl_comm_op)
+            return CCLHandler(self.ccl_comm_op, eval(func)(*(kwargs.values())))
 
     def all_reduce(self, tensor, op=ReduceOp.SUM, group=None, async_op=False):
         use_caching = False
@@ -82,7 +156,8 @@ class CCLBackend(TorchBackend):
             name = "all_reduce_caching"
             if name in self.available_coll:
                 group = self.get_all_ranks_from_group(group)
-                return self.ccl_comm_op.all_reduce_caching(tensor, op, match_id, group, async_op)
+                return CCLHandler(self.ccl_comm_op,
+                                  self.ccl_comm_op.all_reduce_caching(tensor, op, match_id, group, async_op))
             else:
                 return self.run_collective(name=name,
                                            tensor=tensor,
@@ -94,16 +169,25 @@ class CCLBackend(TorchBackend):
             name = "all_reduce"
             if name in self.available_coll:
                 group = self.get_all_ranks_from_group(group)
-                return self.ccl_comm_op.all_reduce(tensor, op, group, async_op)
+                return CCLHandler(self.ccl_comm_op, self.ccl_comm_op.all_reduce(tensor, op, group, async_op))
             else:
                 return self.run_collective(name=name, tensor=tensor, op=op, group=group, async_op=async_op)
 
+    def all_reduce_coalesced(self, tensors, op=ReduceOp.SUM, group=None, async_op=False):
+        return self.run_collective(name="all_reduce_coalesced",
+                                   tensors=tensors,
+                                   op=op,
+                                   group=group,
+                                   async_op=async_op)
+
     def inference_all_reduce(self, tensor, op=ReduceOp.SUM, group=None, async_op=False):
         name = "inference_all_reduce"
         if name in self.available_coll:
-            return self.ccl_comm_op.inference_all_reduce(tensor, op, async_op)
+            return CCLHandler(
+                self.ccl_comm_op,
+                self.ccl_comm_op.inference_all_reduce(tensor, op, self.get_all_ranks_from_group(group), async_op))
         else:
-            return self.run_collective(name=name, tensor=tensor, op=op, group=None, async_op=async_op)
+            return self.run_collective(name=name, tensor=tensor, op=op, group=group, async_op=async_op)
 
     def broadcast(self, tensor, src, group=None, async_op=False):
         return self.run_collective(name="broadcast", tensor=tensor, src=src, group=group, async_op=async_op)
@@ -120,21 +204,25 @@ class CCLBackend(TorchBackend):
                                    output_tensor=output_tensor,
                                    input_tensor=input_tensor,
                                    op=op,
-                                   group=group)
+                                   group=group,
+                                   async_op=async_op)
 
     def all_gather_into_tensor(self, output_tensor, input_tensor, group=None, async_op=False):
         return self.run_collective(name="all_gather_into_tensor",
                                    output_tensor=output_tensor,
                                    input_tensor=input_tensor,
-                                   group=group)
+                                   group=group,
+                                   async_op=async_op)
 
     def all_to_all_single(self, output, input, output_split_sizes, input_split_sizes, group=None, async_op=False):
+        # the native op takes an empty list, not None, for equal splits
         return self.run_collective(name="all_to_all_single",
                                    output=output,
                                    input=input,
-                                   output_split_sizes=output_split_sizes,
-                                   input_split_sizes=input_split_sizes,
-                                   group=group)
+                                   output_split_sizes=output_split_sizes or [],
+                                   input_split_sizes=input_split_sizes or [],
+                                   group=group,
+                                   async_op=async_op)
 
     def send(self, tensor, dst, group=None, tag=0):
         return self.run_collective(name="send", tensor=tensor, dst=dst, group=group, tag=tag)
@@ -17,7 +17,7 @@ from deepspeed.comm.comm import init_distributed
 
 from .model_implementations import InferenceV2Policy
 from .logging import inference_logger
-from .ragged import DSStateManager, RaggedBatchWrapper, PlaceholderSequenceDescriptor
+from .ragged import DSSequenceDescriptor, DSStateManager, RaggedBatchWrapper, PlaceholderSequenceDescriptor
 from .scheduling_utils import SchedulingError, SchedulingResult
 from .model_implementations.flat_model_helpers import make_param_filename, make_metadata_filename
 from .model_implementations.inference_model_base import DSInferenceModelBase
@@ -121,9 +121,17 @@ class InferenceEngineV2:
             raise SchedulingError(schedule_check)
 
         self._batch.clear()
+        computed_tokens = []
         for uid, tokens in zip(batch_uids, batch_tokens):
 
             host_seq_desc = self._state_manager.get_or_create_sequence(uid)
+            if not host_seq_desc.is_resident:
+                self._state_manager.restore_sequence(uid)
+
+            # A prefix already in the prefix cache is not computed again.
+            tokens = self._state_manager.match_prefix(uid, tokens)
+            computed_tokens.append(tokens)
+
             self._model.maybe_allocate_kv(host_seq_desc, tokens.numel())
             host_seq_desc.pre_forward(tokens.numel())
 
@@ -143,10 +151,11 @@ class InferenceEngineV2:
         # We return one set of logits per sequence in the batch (saves cost on unembedding)
         assert logits.shape[0] == self._batch.current_sequences
 
-        for uid in batch_uids:
+        for uid, tokens in zip(batch_uids, computed_tokens):
             host_seq_desc = self._state_manager.get_sequence(uid)
             host_seq_desc.post_forward()  # Updates sequence metadata.
             self._model.maybe_free_kv(host_seq_desc)
+            self._state_manager.update_prefix_cache(uid, tokens)
 
         return logits
 
@@ -172,10 +181,25 @@ class InferenceEngineV2:
                 return (0, 0)
             seq_desc = PlaceholderSequenceDescriptor()
 
+        if not seq_desc.is_resident:
+            # An offloaded sequence first needs its blocks back on the accelerator.
+            restore_blocks = self._restore_blocks(seq_desc)
+            req_tokens, req_blocks = self._model.get_kv_requirements(seq_desc, max_request_tokens,
+                                                                     max_request_blocks - restore_blocks)
+            return (req_tokens, req_blocks + restore_blocks)
+
         req_tokens, req_blocks = self._model.get_kv_requirements(seq_desc, max_request_tokens, max_request_blocks)
 
         return (req_tokens, req_blocks)
 
+    def _restore_blocks(self, seq_desc: DSSequenceDescriptor) -> torch.Tensor:
+        """
+        Number of accelerator blocks an offloaded sequence needs back in each KV cache group.
+        """
+        n_groups = self._state_manager.n_kv_cache_groups
+        restore_blocks = [seq_desc.all_block_ids(cache_group=i, on_device=False).numel() for i in range(n_groups)]
+        return torch.tensor(restore_blocks, dtype=self._state_manager.free_blocks.dtype)
+
     def can_schedule(self, uids: Iterable[int], lengths: Iterable[int]) -> SchedulingResult:
         """
         Dry run a batch to determine if it can be scheduled. Placeholder sequences will be
@@ -205,6 +229,10 @@ class InferenceEngineV2:
             if seq_desc is None:
                 cur_seqs += 1
                 seq_desc = PlaceholderSequenceDescriptor()
+            elif not seq_desc.is_resident:
+                free_blocks = free_blocks - self._restore_blocks(seq_desc)
+                if (free_blocks < 0).any():
+                    return SchedulingResult.KVCacheLimitExceeded
 
             sched_len, sched_blocks = self._model.get_kv_requirements(seq_desc, length, free_blocks)
 
@@ -234,6 +262,28 @@ class InferenceEngineV2:
         """
         self._state_manager.flush_sequence(uid)
 
+    def offload(self, uid: int) -> None:
+        """
+        Preempt a sequence by moving its KV-cache to host memory, freeing its KV blocks for other
+        sequences. The sequence is restored the next time it is ``put`` and resumes without
+        recomputing its context. Requires ``offload`` in the state manager config.
+
+        Arguments:
+            uid (int): The UID of the sequence to offload.
+        """
+        self._state_manager.offload_sequence(uid)
+
+    def prefetch(self, batch_uids: Iterable[int]) -> None:
+        """
+        Hint the sequences of an upcoming batch. Offloaded sequences that were spilled to NVMe
+        start being read back into host memory, so the ``put`` that restores them need not wait
+        on storage. Only has an effect with ``offload_nvme_path`` in the state manager config.
+
+        Arguments:
+            batch_uids (Iterable[int]): The UIDs of the sequences in the upcoming batch.
+        """
+        self._state_manager.prefetch_sequences(batch_uids)
+
     def serialize(self, save_path: str) -> None:
         """
         Serialize the model to a file.
@@ -12,4 +12,4 @@ from .manager_configs import (
 )
 from .ragged_manager import DSStateManager
 from .ragged_wrapper import RaggedBatchWrapper
-from .sequence_descriptor import DSSequenceDescriptor, PlaceholderSequenceDescriptor
+from .sequence_descriptor import DSSequenceDescriptor, KVTier, PlaceholderSequenceDescriptor
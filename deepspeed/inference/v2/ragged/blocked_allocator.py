@@ -3,37 +3,30 @@
 
 # DeepSpeed Team
 
-from typing import Iterable, Union
+from typing import Iterable, Optional, Union
 
 import torch
 
+from deepspeed.ops.op_builder import RaggedUtilsBuilder
+
 
 class BlockedAllocator:
     """
     Allocator class for managing which blocks are free/used in the
-    blocked KV-cache. This is a simple allocator that uses a linked list
-    to keep track of which blocks are free/used. The cost of allocation/deallocation
-    is O(blocks), where blocks is the number of blocks to allocate/deallocate.
-
-    TODO(cmikeh2): Evaluate performance of this allocator and migrate
-    to C++ if necessary.
+    blocked KV-cache. The free blocks are kept on a stack in the native
+    ragged_ops module, so the cost of allocation/deallocation is O(1) per block
+    and a whole request is handled in a single call.
     """
     # Number of blocks in the KV-cache(s).
     _num_blocks: int
 
-    # Array of blocks, where each element is the next block in the linked list.
-    _blocks: torch.Tensor
-
-    # Index of the head of the linked list.
-    _head: int
-
-    # Number of free blocks in the KV-cache.
-    _free_blocks: int
+    # Native allocator holding the free list.
+    _allocator: object
 
     def __init__(self, num_blocks: int) -> None:
         """
         Initialize an allocator with `num_blocks` blocks. This requires at least
-        `num_blocks` * 4 bytes of host memory.
+        `num_blocks` * 5 bytes of host memory.
 
         Parameters:
             num_blocks (int): The number of blocks to allocate.
@@ -43,11 +36,9 @@ class BlockedAllocator:
             raise ValueError(f'Blocked KV-cache must have at least 1 block, provided {num_blocks}')
 
         self._num_blocks = num_blocks
-        self._blocks = torch.arange(1, num_blocks + 1, dtype=torch.int32, device='cpu', pin_memory=True)
-        self._head = 0
-        self._free_blocks = num_blocks
+        self._allocator = RaggedUtilsBuilder().load().BlockedAllocator(num_blocks)
 
-    def allocate(self, num_blocks: int) -> torch.Tensor:
+    def allocate(self, num_blocks: int, out: Optional[torch.Tensor] = None) -> torch.Tensor:
         """
         Allocate a list of blocks from the associated KV-caches. This will
         return `num_blocks` blocks from the KV-cache if they are available,
@@ -55,21 +46,19 @@ class BlockedAllocator:
 
         Parameters:
             num_blocks (int): The number of blocks to allocate.
+            out (Optional[torch.Tensor]): Contiguous int32 CPU tensor of `num_blocks` elements to
+                write the blocks into. A new tensor is created if not provided.
 
         Returns:
-            List[int]: The list of blocks allocated.
+            torch.Tensor: The blocks allocated.
         """
-        if num_blocks > self._free_blocks:
-            raise ValueError(f'Not enough free blocks in the KV-cache to allocate {num_blocks} blocks')
-
-        allocated_blocks = torch.zeros(num_blocks, dtype=torch.int32)
-        for i in range(num_blocks):
-            allocated_blocks[i] = self._head
-            self._head = self._blocks[self._head].item()
-            self._blocks[allocated_blocks[i]] = -1  # Mark as used
-            self._free_blocks -= 1
+        if out is None:
+            out = torch.empty(num_blocks, dtype=torch.int32)
+        elif out.numel() != num_blocks:
+            raise ValueError(f'Output tensor has {out.numel()} elements, expected {num_blocks}')
 
-        return allocated_blocks
+        self._allocator.allocate(out)
+        return out
 
     def free(self, blocks: Union[Iterable[int], int]) -> None:
         """
@@ -84,22 +73,16 @@ class BlockedAllocator:
         if isinstance(blocks, int):
             blocks = [blocks]
 
-        for block in blocks:
-            # Parse all blocks for validity before mutating the list.
-            if block < 0 or block >= self._num_blocks:
-                raise ValueError(f'Invalid block {block} provided to free')
-
-            if self._blocks[block] != -1:
-                raise ValueError(f'Block {block} is already free')
+        if not isinstance(blocks, torch.Tensor):
+            blocks = torch.tensor(list(blocks), dtype=torch.int64)
+        elif blocks.device.type != 'cpu':
+            blocks = blocks.cpu()
 
-        for block in blocks:
-            self._blocks[block] = self._head
-            self._head = block
-            self._free_blocks += 1
+        self._allocator.free(blocks)
 
     @property
     def free_blocks(self) -> int:
         """
         Return the number of free blocks in the KV-cache.
         """
-        return self._free_blocks
+        return self._allocator.free_blocks()
@@ -0,0 +1,81 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+#include "blocked_allocator.h"
+
+#include <stdexcept>
+#include <string>
+
+BlockedAllocator::BlockedAllocator(int32_t num_blocks)
+    : _num_blocks(num_blocks), _allocated(num_blocks > 0 ? num_blocks : 0, 0)
+{
+    if (num_blocks < 1) {
+        throw std::invalid_argument("Blocked KV-cache must have at least 1 block, provided " +
+                                    std::to_string(num_blocks));
+    }
+
+    // Hand out block 0 first, as the free list is popped from the back.
+    _free_list.resize(num_blocks);
+    for (int32_t i = 0; i < num_blocks; i++) { _free_list[i] = num_blocks - 1 - i; }
+}
+
+void BlockedAllocator::allocate(torch::Tensor& blocks)
+{
+    TORCH_CHECK(blocks.device().is_cpu(), "Allocated blocks must be written to a CPU tensor");
+    TORCH_CHECK(blocks.scalar_type() == torch::kInt32, "Allocated blocks must be int32");
+    TORCH_CHECK(blocks.is_contiguous(), "Allocated blocks must be written to a contiguous tensor");
+
+    const int64_t count = blocks.numel();
+    if (count > static_cast<int64_t>(_free_list.size())) {
+        throw std::invalid_argument("Not enough free blocks in the KV-cache to allocate " +
+                                    std::to_string(count) + " blocks");
+    }
+
+    int32_t* out = blocks.data_ptr<int32_t>();
+    const size_t remaining = _free_list.size() - count;
+    for (int64_t i = 0; i < count; i++) {
+        const int32_t block = _free_list[_free_list.size() - 1 - i];
+        _allocated[block] = 1;
+        out[i] = block;
+    }
+    _free_list.resize(remaining);
+}
+
+template <typename T>
+void BlockedAllocator::free_impl(const T* blocks, int64_t count)
+{
+    // Mark the blocks free while validating so repeats are caught, undoing it on failure.
+    for (int64_t i = 0; i < count; i++) {
+        const T block = blocks[i];
+        std::string error;
+        if (block < 0 || block >= _num_blocks) {
+            error = "Invalid block " + std::to_string(block) + " provided to free";
+        } else if (!_allocated[block]) {
+            error = "Block " + std::to_string(block) + " is already free";
+        }
+
+        if (!error.empty()) {
+            for (int64_t j = 0; j < i; j++) { _allocated[blocks[j]] = 1; }
+            throw std::invalid_argument(error);
+        }
+        _allocated[block] = 0;
+    }
+
+    for (int64_t i = 0; i < count; i++) { _free_list.push_back(static_cast<int32_t>(blocks[i])); }
+}
+
+void BlockedAllocator::free(torch::Tensor& blocks)
+{
+    TORCH_CHECK(blocks.device().is_cpu(), "Blocks to free must be in a CPU tensor");
+    auto contiguous = blocks.contiguous();
+
+    if (contiguous.scalar_type() == torch::kInt32) {
+        free_impl(contiguous.data_ptr<int32_t>(), contiguous.numel());
+    } else if (contiguous.scalar_type() == torch::kInt64) {
+        free_impl(contiguous.data_ptr<int64_t>(), contiguous.numel());
+    } else {
+        TORCH_CHECK(false, "Blocks to free must be int32 or int64");
+    }
+}
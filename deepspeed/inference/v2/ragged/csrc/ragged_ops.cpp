@@ -6,6 +6,7 @@
 #include <c10/cuda/CUDAStream.h>
 #include <torch/extension.h>
 
+#include "blocked_allocator.h"
 #include "fast_host_buffer.h"
 
 /*
@@ -73,4 +74,13 @@ PYBIND11_MODULE(TORCH_EXTENSION_NAME, m)
     m.def("allocate_view_like",
           &allocate_view_like,
           "Allocate a view on a Tensor on the same device as the input Tensor.");
+
+    py::class_<BlockedAllocator>(m, "BlockedAllocator")
+        .def(py::init<int32_t>())
+
+        .def("allocate", &BlockedAllocator::allocate)
+        .def("free", &BlockedAllocator::free)
+
+        .def("free_blocks", &BlockedAllocator::free_blocks)
+        .def("num_blocks", &BlockedAllocator::num_blocks);
 }
@@ -0,0 +1,48 @@
+// Copyright (c) Microsoft Corporation.
+// SPDX-License-Identifier: Apache-2.0
+
+// DeepSpeed Team
+
+#pragma once
+
+#include <torch/extension.h>
+#include <cstdint>
+#include <vector>
+
+/*
+Tracks which blocks of a blocked KV-cache are free. Free blocks are kept on a stack so both
+allocation and deallocation are O(1) per block, and the most recently freed blocks are handed
+out first. Invalid requests throw std::invalid_argument (ValueError in Python) without
+modifying the allocator.
+*/
+class BlockedAllocator {
+public:
+    BlockedAllocator(int32_t num_blocks);
+
+    /*
+    Fill `blocks`, a contiguous int32 CPU tensor, with `blocks.numel()` newly allocated block ids.
+    */
+    void allocate(torch::Tensor& blocks);
+
+    /*
+    Return the ids in `blocks` (an int32 or int64 CPU tensor) to the free pool. If any id is out
+    of range, already free, or repeated, no block is freed.
+    */
+    void free(torch::Tensor& blocks);
+
+    int32_t free_blocks() const { return static_cast<int32_t>(_free_list.size()); }
+
+    int32_t num_blocks() const { return _num_blocks; }
+
+private:
+    template <typename T>
+    void free_impl(const T* blocks, int64_t count);
+
+    int32_t _num_blocks;
+
+    // Stack of the free block ids, the back is allocated next.
+    std::vector<int32_t> _free_list;
+
+    // Whether each block is currently allocated.
+    std::vector<uint8_t> _allocated;
+};
@@ -4,7 +4,8 @@
 # DeepSpeed Team
 
 import operator
-from functools import reduce
+import os
+from functools import partial, reduce
 from typing import Any, Iterable, Optional, Tuple
 
 import torch
@@ -16,6 +17,8 @@ from deepspeed.accelerator import get_accelerator
 from ..inference_utils import elem_size
 from ..logging import inference_logger
 from .blocked_allocator import BlockedAllocator
+from .kv_copy_engine import KVCopyEngine
+from .kv_nvme_tier import KVNVMeTier
 from .manager_configs import AllocationMode, KVCacheConfig, MemoryConfig
 
 
@@ -50,6 +53,28 @@ class BlockedKVCache:
     Block allocator for tracking cache usage. This manages the GPU cache.
     """
 
+    _host_caches: Tuple[torch.Tensor, ...]
+    """
+    Pinned host pools that blocks are offloaded to when offloading is enabled. These are 6D tensors
+    with the following shape:
+        (num_host_blocks, num_caches, block_size, 2, num_heads, head_size)
+    """
+
+    _host_allocators: Tuple[BlockedAllocator, ...]
+    """
+    Block allocators for tracking usage of the host pools.
+    """
+
+    _host_tickets: Tuple[torch.Tensor, ...]
+    """
+    Ticket of the last copy between the accelerator and each block of the host pools.
+    """
+
+    _nvme_tiers: Tuple[KVNVMeTier, ...]
+    """
+    NVMe storage that blocks of the host pools are spilled to, empty unless an NVMe path is given.
+    """
+
     _configs: Tuple[KVCacheConfig, ...]
     """
     Configuration of the KV cache(s). See ``KVCacheConfig`` for more details. This enables the support
@@ -61,7 +86,12 @@ class BlockedKVCache:
                  configs: Tuple[KVCacheConfig, ...],
                  memory_config: MemoryConfig,
                  mp_group: Optional[Any] = None,
-                 offload: bool = False) -> None:
+                 offload: bool = False,
+                 offload_blocks: int = 0,
+                 offload_nvme_path: Optional[str] = None,
+                 offload_nvme_blocks: int = 0,
+                 offload_nvme_batch_blocks: int = 8,
+                 offload_nvme_prefetch_blocks: int = 32) -> None:
         """
         Create a container that will maintain the storage and allocations for a set of
         blocked KV-caches.
@@ -70,6 +100,16 @@ class BlockedKVCache:
             config (KVCacheConfig): The configuration of the KV-cache.
             slack (int): The amount of slack space to reserve in GPU memory for the cache.
             enable_offload (bool): Whether to enable offloading of the cache to the host.
+            offload_blocks (int): The number of blocks in the host pool when offloading is enabled.
+                If 0, the host pool has as many blocks as the accelerator cache.
+            offload_nvme_path (Optional[str]): Directory on an NVMe device to spill blocks of the
+                host pool to. If None, offloaded blocks are only kept on the host.
+            offload_nvme_blocks (int): The number of blocks of each cache that may be spilled to
+                NVMe. If 0, the free space at ``offload_nvme_path`` is split across the caches and
+                the local ranks.
+            offload_nvme_batch_blocks (int): The number of blocks per batch of NVMe writes.
+            offload_nvme_prefetch_blocks (int): The number of blocks that may be read from NVMe
+                asynchronously.
             blocks (int): The number of blocks to pre-allocate for the cache. If this is set,
                 slack will be ignored.
         """
@@ -77,9 +117,6 @@ class BlockedKVCache:
         self._memory_config = memory_config
         self._enable_offload = offload
 
-        if self._enable_offload:
-            raise NotImplementedError("Offloading of KV-caches is not yet supported.")
-
         if AllocationMode(self._memory_config.mode) is AllocationMode.RESERVE:
             # TODO(cmikeh2): Change the weighting based on the type of the KV-cache
 
@@ -144,6 +181,35 @@ class BlockedKVCache:
         for i, allocator in enumerate(self._allocators):
             self._free_blocks[i] = allocator.free_blocks
 
+        if self._enable_offload:
+            num_host_blocks = offload_blocks if offload_blocks > 0 else num_blocks
+            host_caches = []
+            host_allocators = []
+
+            for cache_group_id, cache in enumerate(self._caches):
+                host_shape = (num_host_blocks, cache.shape[0]) + tuple(cache.shape[2:])
+                inference_logger().info(
+                    f"Allocating host pool for KV-cache {cache_group_id} with shape: {host_shape}.")
+                host_caches.append(get_accelerator().pin_memory(torch.empty(host_shape, dtype=cache.dtype)))
+                host_allocators.append(BlockedAllocator(num_host_blocks))
+
+            self._host_caches = tuple(host_caches)
+            self._host_allocators = tuple(host_allocators)
+            self._host_tickets = tuple(torch.zeros(num_host_blocks, dtype=torch.int64) for _ in self._caches)
+            self._copy_engine = KVCopyEngine()
+
+        self._nvme_tiers = ()
+        if self._enable_offload and offload_nvme_path is not None:
+            rank = dist.get_rank() if dist.is_initialized() else 0
+            # Without the launcher's local size, assume every rank shares the device.
+            local_size = int(os.environ.get("LOCAL_SIZE", dist.get_world_size() if dist.is_initialized() else 1))
+            num_sharers = len(self._host_caches) * local_size
+            self._nvme_tiers = tuple(
+                KVNVMeTier(os.path.join(offload_nvme_path, f"rank_{rank}", f"kv_cache_{cache_group_id}"), host_cache,
+                           offload_nvme_blocks, offload_nvme_batch_blocks, offload_nvme_prefetch_blocks,
+                           partial(self._wait_host_copies, cache_group=cache_group_id), num_sharers)
+                for cache_group_id, host_cache in enumerate(self._host_caches))
+
     def reserve(self, num_blocks: int, cache_group: int = 0) -> torch.Tensor:
         """
         Reserve a number of blocks from the cache. This will return a 1D tensor of
@@ -166,25 +232,130 @@ class BlockedKVCache:
         """
         self._allocators[cache_group].free(blocks)
 
-    def offload(self, blocks: Iterable[int], cache_group: int = 0) -> torch.Tensor:
+    def offload(self, blocks: torch.Tensor, cache_group: int = 0, free: bool = True) -> torch.Tensor:
         """
-        Offload KV-cache blocks from accelerator memory to the host.
+        Offload KV-cache blocks from accelerator memory to the host. The copy is asynchronous,
+        but the accelerator blocks are freed immediately and may be reserved again right away.
+        Returns a 1D tensor of the host blocks now holding the data, in the order of ``blocks``.
 
         Parameters:
-            blocks (Iterable[int]): The blocks to offload.
+            blocks (torch.Tensor): The blocks to offload.
             cache_group (int): The cache group to offload from. Default is 0.
+            free (bool): Whether to free the accelerator blocks. If False, the caller frees them,
+                i.e. when they may be shared. Default is True.
         """
-        raise NotImplementedError("Offloading is not yet supported.")
-
-    def restore(self, blocks: Iterable[int], cache_group: int = 0) -> torch.Tensor:
+        if not self._enable_offload:
+            raise RuntimeError("Offloading of KV-caches is not enabled.")
+
+        host_blocks = self._host_allocators[cache_group].allocate(blocks.numel())
+        if blocks.numel() > 0:
+            ticket = self._copy_engine.offload(self._caches[cache_group], blocks, self._host_caches[cache_group],
+                                               host_blocks)
+            self._host_tickets[cache_group][host_blocks.to(torch.int64)] = ticket
+        if free:
+            self._allocators[cache_group].free(blocks)
+        return host_blocks
+
+    def restore(self, host_blocks: torch.Tensor, cache_group: int = 0) -> torch.Tensor:
         """
-        Restore KV-cache blocks from the host to accelerator memory.
+        Restore KV-cache blocks from the host to accelerator memory. The copy is asynchronous,
+        work queued on the current stream afterwards waits for it. The host blocks are freed.
+        Returns a 1D tensor of the accelerator blocks now holding the data, in the order of
+        ``host_blocks``.
 
         Parameters:
-            blocks (Iterable[int]): The blocks to restore.
+            host_blocks (torch.Tensor): The host blocks to restore, as returned by ``offload``.
             cache_group (int): The cache group to restore to. Default is 0.
         """
-        raise NotImplementedError("Offloading is not yet supported.")
+        if not self._enable_offload:
+            raise RuntimeError("Offloading of KV-caches is not enabled.")
+
+        blocks = self._allocators[cache_group].allocate(host_blocks.numel())
+        self._wait_nvme_reads(cache_group)
+        if blocks.numel() > 0:
+            ticket = self._copy_engine.restore(self._host_caches[cache_group], host_blocks, self._caches[cache_group],
+                                               blocks)
+            self._host_tickets[cache_group][host_blocks.to(torch.int64)] = ticket
+        self._host_allocators[cache_group].free(host_blocks)
+        return blocks
+
+    def free_offloaded(self, host_blocks: Iterable[int], cache_group: int = 0) -> None:
+        """
+        Free a set of offloaded blocks from the host pool without restoring them.
+
+        Parameters:
+            host_blocks (Iterable[int]): The host blocks to free.
+            cache_group (int): The cache group to free from. Default is 0.
+        """
+        self._wait_nvme_reads(cache_group)
+        self._host_allocators[cache_group].free(host_blocks)
+
+    def spill(self, host_blocks: torch.Tensor, cache_group: int = 0) -> torch.Tensor:
+        """
+        Spill offloaded blocks from the host pool to NVMe and free them from the host pool. Returns
+        a 1D tensor of the NVMe blocks now holding the data, in the order of ``host_blocks``.
+
+        Parameters:
+            host_blocks (torch.Tensor): The host blocks to spill.
+            cache_group (int): The cache group to spill from. Default is 0.
+        """
+        if not self.nvme_enabled:
+            raise RuntimeError("Spilling KV-caches to NVMe is not enabled.")
+
+        # The blocks may still be in flight from the accelerator or from NVMe.
+        self._wait_host_copies(host_blocks, cache_group)
+        self._wait_nvme_reads(cache_group)
+
+        nvme_blocks = self._nvme_tiers[cache_group].write(self._host_caches[cache_group], host_blocks)
+        self._host_allocators[cache_group].free(host_blocks)
+        return nvme_blocks
+
+    def fetch(self, nvme_blocks: torch.Tensor, cache_group: int = 0, async_op: bool = False) -> torch.Tensor:
+        """
+        Read spilled blocks from NVMe back into the host pool. Returns a 1D tensor of the host
+        blocks now holding the data, in the order of ``nvme_blocks``. With ``async_op`` the reads
+        may still be in flight, later operations on these host blocks wait for them.
+
+        Parameters:
+            nvme_blocks (torch.Tensor): The NVMe blocks to read, as returned by ``spill``.
+            cache_group (int): The cache group to read into. Default is 0.
+            async_op (bool): Whether to return before the reads complete. Default is False.
+        """
+        if not self.nvme_enabled:
+            raise RuntimeError("Spilling KV-caches to NVMe is not enabled.")
+
+        host_blocks = self._host_allocators[cache_group].allocate(nvme_blocks.numel())
+        self._nvme_tiers[cache_group].read(nvme_blocks, self._host_caches[cache_group], host_blocks, async_op=async_op)
+        return host_blocks
+
+    def free_spilled(self, nvme_blocks: Iterable[int], cache_group: int = 0) -> None:
+        """
+        Free a set of spilled blocks from NVMe without reading them back.
+
+        Parameters:
+            nvme_blocks (Iterable[int]): The NVMe blocks to free.
+            cache_group (int): The cache group to free from. Default is 0.
+        """
+        self._nvme_tiers[cache_group].free(nvme_blocks)
+
+    def _wait_host_copies(self, host_blocks: torch.Tensor, cache_group: int) -> None:
+        """
+        Wait for the copies to or from the accelerator that touch ``host_blocks``, i.e. before the
+        blocks are written from NVMe after a restore freed them.
+        """
+        if host_blocks.numel() > 0:
+            self._copy_engine.wait(self._host_tickets[cache_group][host_blocks.to(torch.int64)].max().item())
+
+    def _wait_nvme_reads(self, cache_group: int) -> None:
+        if self.nvme_enabled:
+            self._nvme_tiers[cache_group].wait_reads()
+
+    def synchronize_offload(self) -> None:
+        """
+        Wait on the host for all offload and restore copies to complete.
+        """
+        if self._enable_offload:
+            self._copy_engine.synchronize()
 
     def get_cache(self, cache_id: int, cache_group: int = 0) -> torch.Tensor:
         """
@@ -205,6 +376,31 @@ class BlockedKVCache:
             self._free_blocks[i] = allocator.free_blocks
         return self._free_blocks
 
+    @property
+    def free_offload_blocks(self) -> torch.Tensor:
+        """
+        Return the number of free blocks in the host pool of each cache
+        """
+        if not self._enable_offload:
+            return torch.zeros(len(self._allocators), dtype=torch.int32)
+        return torch.tensor([allocator.free_blocks for allocator in self._host_allocators], dtype=torch.int32)
+
+    @property
+    def free_nvme_blocks(self) -> torch.Tensor:
+        """
+        Return the number of free NVMe blocks of each cache
+        """
+        if not self.nvme_enabled:
+            return torch.zeros(len(self._allocators), dtype=torch.int32)
+        return torch.tensor([tier.free_blocks for tier in self._nvme_tiers], dtype=torch.int32)
+
+    @property
+    def nvme_enabled(self) -> bool:
+        """
+        Whether offloaded blocks may be spilled to NVMe
+        """
+        return len(self._nvme_tiers) > 0
+
     @property
     def num_caches(self) -> int:
         """
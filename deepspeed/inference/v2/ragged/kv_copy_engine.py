@@ -0,0 +1,148 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+from collections import deque
+from typing import Any, Deque, List, Tuple
+
+import torch
+
+from deepspeed.accelerator import get_accelerator
+
+
+def contiguous_runs(blocks: torch.Tensor) -> List[Tuple[int, int]]:
+    """
+    Split a list of block ids into runs of consecutive ids.
+
+    Parameters:
+        blocks (torch.Tensor): 1D tensor of block ids on the host.
+
+    Returns:
+        List[Tuple[int, int]]: (start, end) offsets into ``blocks`` of each run.
+    """
+    if blocks.numel() == 0:
+        return []
+    breaks = (torch.nonzero(blocks[1:] - blocks[:-1] != 1).flatten() + 1).tolist()
+    return list(zip([0] + breaks, breaks + [blocks.numel()]))
+
+
+class KVCopyEngine:
+    """
+    Moves KV-cache blocks between an accelerator cache and a pinned host pool on a dedicated
+    stream, so the copies overlap with the forward passes on the compute stream.
+
+    The accelerator cache has the shape (num_caches, num_blocks, ...) while the host pool is
+    (num_host_blocks, num_caches, ...), so that every host block is contiguous and each run of
+    consecutive host blocks is a single copy. Blocks are gathered/scattered on the accelerator.
+
+    Ordering is kept on the accelerator without blocking the host: a copy waits for the work
+    already queued on the compute stream, and the compute stream waits for the part of the
+    copy that it could race with. Because every copy is issued on the same stream, a host
+    block may be reused by another copy as soon as the copy reading it has been issued. Writes to
+    the host pool from outside of the stream (i.e. NVMe reads) must first ``wait`` on the ticket
+    of the last copy touching the block.
+    """
+
+    def __init__(self) -> None:
+        # Accelerators without streams (i.e. CPU) copy synchronously.
+        self._stream = get_accelerator().Stream() if get_accelerator().Stream is not None else None
+
+        # Tickets are issued in stream order, so completing one completes every earlier one.
+        self._num_tickets = 0
+        self._events: Deque[Tuple[int, Any]] = deque()
+
+    def _begin(self):
+        compute_stream = get_accelerator().current_stream()
+        if self._stream is not None:
+            self._stream.wait_stream(compute_stream)
+        return compute_stream
+
+    def _fence(self, compute_stream) -> None:
+        if self._stream is not None:
+            event = get_accelerator().Event()
+            event.record(self._stream)
+            compute_stream.wait_event(event)
+
+    def _ticket(self) -> int:
+        self._num_tickets += 1
+        if self._stream is not None:
+            while len(self._events) > 0 and self._events[0][1].query():
+                self._events.popleft()
+            event = get_accelerator().Event()
+            event.record(self._stream)
+            self._events.append((self._num_tickets, event))
+        return self._num_tickets
+
+    def offload(self, device_cache: torch.Tensor, device_blocks: torch.Tensor, host_cache: torch.Tensor,
+                host_blocks: torch.Tensor) -> int:
+        """
+        Copy ``device_blocks`` of ``device_cache`` into ``host_blocks`` of ``host_cache``. The
+        device blocks may be reallocated as soon as this returns. Returns the ticket of the copy.
+
+        Parameters:
+            device_cache (torch.Tensor): Accelerator cache of shape (num_caches, num_blocks, ...).
+            device_blocks (torch.Tensor): Host tensor of the blocks to copy from.
+            host_cache (torch.Tensor): Pinned host pool of shape (num_host_blocks, num_caches, ...).
+            host_blocks (torch.Tensor): Host tensor of the blocks to copy to.
+        """
+        compute_stream = self._begin()
+        with get_accelerator().stream(self._stream):
+            ids = device_blocks.to(device=device_cache.device, dtype=torch.int64, non_blocking=True)
+            staged = device_cache.transpose(0, 1).index_select(0, ids)
+
+            # Only the gather reads the device blocks, later writes to them need not wait for the
+            # transfer to the host.
+            self._fence(compute_stream)
+
+            for start, end in contiguous_runs(host_blocks):
+                first = host_blocks[start].item()
+                host_cache[first:first + end - start].copy_(staged[start:end], non_blocking=True)
+        return self._ticket()
+
+    def restore(self, host_cache: torch.Tensor, host_blocks: torch.Tensor, device_cache: torch.Tensor,
+                device_blocks: torch.Tensor) -> None:
+        """
+        Copy ``host_blocks`` of ``host_cache`` into ``device_blocks`` of ``device_cache``. Work
+        queued on the compute stream after this returns sees the restored blocks. Returns the
+        ticket of the copy.
+
+        Parameters:
+            host_cache (torch.Tensor): Pinned host pool of shape (num_host_blocks, num_caches, ...).
+            host_blocks (torch.Tensor): Host tensor of the blocks to copy from.
+            device_cache (torch.Tensor): Accelerator cache of shape (num_caches, num_blocks, ...).
+            device_blocks (torch.Tensor): Host tensor of the blocks to copy to.
+        """
+        compute_stream = self._begin()
+        with get_accelerator().stream(self._stream):
+            ids = device_blocks.to(device=device_cache.device, dtype=torch.int64, non_blocking=True)
+            staged = torch.empty((device_blocks.numel(), ) + host_cache.shape[1:],
+                                 dtype=device_cache.dtype,
+                                 device=device_cache.device)
+
+            for start, end in contiguous_runs(host_blocks):
+                first = host_blocks[start].item()
+                staged[start:end].copy_(host_cache[first:first + end - start], non_blocking=True)
+
+            device_cache.transpose(0, 1).index_copy_(0, ids, staged)
+            self._fence(compute_stream)
+        return self._ticket()
+
+    def wait(self, ticket: int) -> None:
+        """
+        Wait on the host for the copy with the given ticket, and all copies issued before it, to
+        complete. Ticket 0 is never issued and does not wait.
+        """
+        event = None
+        while len(self._events) > 0 and self._events[0][0] <= ticket:
+            event = self._events.popleft()[1]
+        if event is not None:
+            event.synchronize()
+
+    def synchronize(self) -> None:
+        """
+        Wait on the host for all issued copies to complete.
+        """
+        if self._stream is not None:
+            self._stream.synchronize()
+        self._events.clear()
@@ -0,0 +1,187 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+import os
+import shutil
+import weakref
+from typing import Callable, List, Tuple
+
+import torch
+
+from deepspeed.accelerator import get_accelerator
+from deepspeed.ops.op_builder import AsyncIOBuilder
+from deepspeed.runtime.swap_tensor.aio_config import AIO_DEFAULT_DICT
+from deepspeed.runtime.swap_tensor.constants import (AIO_BLOCK_SIZE, AIO_QUEUE_DEPTH, AIO_SINGLE_SUBMIT,
+                                                     AIO_OVERLAP_EVENTS, AIO_THREAD_COUNT, AIO_PRIORITY_HIGH,
+                                                     AIO_PRIORITY_LOW)
+
+from ..logging import inference_logger
+from .blocked_allocator import BlockedAllocator
+
+# O_DIRECT needs the buffer, the file size and the part of it handled by each AIO thread aligned.
+NVME_ALIGNED_BYTES = 4096
+
+# Upper bound on a capacity derived from free space, the allocator keeps a few bytes of host memory per block.
+MAX_DERIVED_NVME_BLOCKS = 1 << 20
+
+
+class KVNVMeTier:
+    """
+    Third tier of a KV-cache: blocks of the pinned host pool are spilled to a single file on an
+    NVMe device through the AIO handle, each block at a fixed offset.
+
+    Blocks go through pinned staging buffers, where every block is padded to the O_DIRECT
+    alignment. Writes are issued ``batch_blocks`` blocks at a time and waited on, so the host
+    blocks can be reused when ``write`` returns. Reads may be left in flight, up to the
+    ``prefetch_blocks`` blocks of the read staging buffer, and land in the host pool when
+    ``wait_reads`` is called. A read that finds the staging buffer full first waits for and lands
+    the reads in flight.
+    """
+
+    def __init__(self,
+                 path: str,
+                 host_cache: torch.Tensor,
+                 num_blocks: int,
+                 batch_blocks: int,
+                 prefetch_blocks: int,
+                 wait_host_copies: Callable[[torch.Tensor], None],
+                 num_sharers: int = 1) -> None:
+        """
+        Parameters:
+            path (str): Directory to keep the tier's file in. It is cleared on construction and removed
+                once the tier is garbage collected.
+            host_cache (torch.Tensor): The host pool blocks are spilled from and read back into.
+            num_blocks (int): The number of blocks the tier may hold, their space is allocated up front.
+                If 0, this is this tier's share of the free space at ``path``, up to
+                ``MAX_DERIVED_NVME_BLOCKS``. That space is not reserved.
+            batch_blocks (int): The number of blocks per batch of writes.
+            prefetch_blocks (int): The number of blocks that may be read asynchronously.
+            wait_host_copies (Callable[[torch.Tensor], None]): Waits for the accelerator copies that
+                touch the given host blocks, which may have been freed before those copies completed.
+            num_sharers (int): The number of tiers splitting the free space at ``path`` when
+                ``num_blocks`` is 0.
+        """
+        shutil.rmtree(path, ignore_errors=True)
+        os.makedirs(path, exist_ok=True)
+        self._file = os.path.join(path, "kv_cache.swp")
+        weakref.finalize(self, shutil.rmtree, path, ignore_errors=True)
+        self._batch_blocks = batch_blocks
+        self._prefetch_blocks = prefetch_blocks
+        self._wait_host_copies = wait_host_copies
+
+        aio_config = AIO_DEFAULT_DICT
+        self._align_bytes = NVME_ALIGNED_BYTES * aio_config[AIO_THREAD_COUNT]
+        block_bytes = host_cache[0].numel() * host_cache.element_size()
+        aligned_bytes = (block_bytes + self._align_bytes - 1) // self._align_bytes * self._align_bytes
+        self._block_numel = host_cache[0].numel()
+        self._aligned_numel = aligned_bytes // host_cache.element_size()
+        self._aligned_bytes = aligned_bytes
+
+        derived = num_blocks == 0
+        if derived:
+            num_blocks = min(shutil.disk_usage(path).free // aligned_bytes // num_sharers, MAX_DERIVED_NVME_BLOCKS)
+            inference_logger().info(f"Spilling up to {num_blocks} KV-cache blocks to {path}.")
+        self._allocator = BlockedAllocator(num_blocks)
+
+        # Reads must fall within the file, so it is sized for every block before any is written.
+        with open(self._file, "wb") as f:
+            if derived:
+                f.truncate(num_blocks * aligned_bytes)
+            else:
+                os.posix_fallocate(f.fileno(), 0, num_blocks * aligned_bytes)
+
+        aio_op = AsyncIOBuilder().load(verbose=False)
+        handle_args = (aio_config[AIO_BLOCK_SIZE], aio_config[AIO_QUEUE_DEPTH], aio_config[AIO_SINGLE_SUBMIT],
+                       aio_config[AIO_OVERLAP_EVENTS], aio_config[AIO_THREAD_COUNT])
+        self._read_handle = aio_op.aio_handle(*handle_args)
+        self._write_handle = aio_op.aio_handle(*handle_args)
+
+        self._read_staging = get_accelerator().pin_memory(
+            torch.zeros(prefetch_blocks * self._aligned_numel, dtype=host_cache.dtype))
+        self._write_staging = get_accelerator().pin_memory(
+            torch.zeros(batch_blocks * self._aligned_numel, dtype=host_cache.dtype))
+
+        # (host pool, host block, NVMe block) of each read in flight, by staging slot.
+        self._pending_reads: List[Tuple[torch.Tensor, int, int]] = []
+
+    def _block_offset(self, block: int) -> int:
+        return block * self._aligned_bytes
+
+    def _slot(self, staging: torch.Tensor, slot: int) -> torch.Tensor:
+        return staging.narrow(0, slot * self._aligned_numel, self._aligned_numel)
+
+    def write(self, host_cache: torch.Tensor, host_blocks: torch.Tensor) -> torch.Tensor:
+        """
+        Write ``host_blocks`` of ``host_cache`` to NVMe. Returns a 1D tensor of the NVMe blocks
+        now holding the data, in the order of ``host_blocks``.
+        """
+        nvme_blocks = self._allocator.allocate(host_blocks.numel())
+        host_list = host_blocks.tolist()
+        nvme_list = nvme_blocks.tolist()
+
+        for start in range(0, len(host_list), self._batch_blocks):
+            end = min(start + self._batch_blocks, len(host_list))
+            for slot, (host_block, nvme_block) in enumerate(zip(host_list[start:end], nvme_list[start:end])):
+                buffer = self._slot(self._write_staging, slot)
+                buffer[:self._block_numel].copy_(host_cache[host_block].view(-1))
+                if self._write_handle.async_pwrite(buffer,
+                                                   self._file,
+                                                   AIO_PRIORITY_LOW,
+                                                   file_offset=self._block_offset(nvme_block)) != 0:
+                    if slot > 0:
+                        self._write_handle.wait()
+                    self._allocator.free(nvme_blocks)
+                    raise RuntimeError(f"Failed to write KV-cache block {nvme_block} to {self._file}.")
+            self._write_handle.wait()
+
+        return nvme_blocks
+
+    def read(self, nvme_blocks: torch.Tensor, host_cache: torch.Tensor, host_blocks: torch.Tensor,
+             async_op: bool = False) -> None:
+        """
+        Read ``nvme_blocks`` into ``host_blocks`` of ``host_cache``. The NVMe blocks are freed once
+        the read completes. With ``async_op``, up to ``prefetch_blocks`` reads may still be in flight
+        on return, ``wait_reads`` completes them.
+        """
+        for host_block, nvme_block in zip(host_blocks.tolist(), nvme_blocks.tolist()):
+            if len(self._pending_reads) == self._prefetch_blocks:
+                self.wait_reads()
+            buffer = self._slot(self._read_staging, len(self._pending_reads))
+            if self._read_handle.async_pread(buffer,
+                                             self._file,
+                                             AIO_PRIORITY_HIGH,
+                                             file_offset=self._block_offset(nvme_block)) != 0:
+                raise RuntimeError(f"Failed to read KV-cache block {nvme_block} from {self._file}.")
+            self._pending_reads.append((host_cache, host_block, nvme_block))
+
+        if not async_op:
+            self.wait_reads()
+
+    def wait_reads(self) -> None:
+        """
+        Wait for the reads in flight and copy them into the host pool.
+        """
+        if len(self._pending_reads) == 0:
+            return
+
+        self._read_handle.wait()
+        self._wait_host_copies(torch.tensor([host_block for _, host_block, _ in self._pending_reads]))
+        for slot, (host_cache, host_block, _) in enumerate(self._pending_reads):
+            host_cache[host_block].view(-1).copy_(self._slot(self._read_staging, slot)[:self._block_numel])
+        self._allocator.free([nvme_block for _, _, nvme_block in self._pending_reads])
+        self._pending_reads = []
+
+    def free(self, nvme_blocks: torch.Tensor) -> None:
+        """
+        Free NVMe blocks without reading them back.
+        """
+        self._allocator.free(nvme_blocks)
+
+    @property
+    def free_blocks(self) -> int:
+        """
+        Return the number of free blocks in the tier.
+        """
+        return self._allocator.free_blocks
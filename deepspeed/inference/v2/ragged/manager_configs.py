@@ -4,7 +4,7 @@
 # DeepSpeed Team
 
 from enum import Enum
-from typing import Tuple
+from typing import Optional, Tuple
 
 from deepspeed.pydantic_v1 import PositiveInt, validator
 
@@ -170,7 +170,47 @@ class DSStateManagerConfig(DeepSpeedConfigModel):
 
     offload: bool = False
     """
-    Enable tracking for offloading KV-cache to host memory. Currently unsupported.
+    Enable offloading of KV-cache blocks to a pinned host pool. Offloaded sequences release their
+    accelerator blocks and are restored on their next forward without recomputing their context.
+    """
+
+    offload_blocks: int = 0
+    """
+    Number of blocks in the host pool of each KV-cache when ``offload`` is enabled. If 0, the host
+    pool has as many blocks as the accelerator cache.
+    """
+
+    offload_nvme_path: Optional[str] = None
+    """
+    Directory on an NVMe device that offloaded blocks are spilled to when the host pool fills up,
+    least recently offloaded sequences first. Requires ``offload``.
+    """
+
+    offload_nvme_blocks: int = 0
+    """
+    Number of blocks of each KV-cache that may be spilled to NVMe. If 0, the free space at
+    ``offload_nvme_path`` is split evenly across the KV-caches and the ranks of the node, up to 2^20
+    blocks each. The space is not reserved, so set this explicitly when the device is shared.
+    """
+
+    offload_nvme_batch_blocks: PositiveInt = 8
+    """
+    Number of blocks per batch of NVMe writes. This sizes the pinned write staging buffer.
+    """
+
+    offload_nvme_prefetch_blocks: PositiveInt = 32
+    """
+    Number of blocks that may be read from NVMe while the host keeps running. This sizes the pinned
+    read staging buffer, the reads land in the host pool when a sequence is next restored. Once more
+    blocks than this are fetched, the fetch waits for the reads already in flight, so this should
+    cover the blocks of the sequences prefetched for a batch.
+    """
+
+    prefix_caching: bool = False
+    """
+    Share the full KV blocks of identical token prefixes between sequences. The prefix of a new
+    sequence found in the cache is not computed again and its blocks are stored once. Only
+    supported for models with a single dense KV-cache.
     """
 
     @validator("max_ragged_sequence_count")
@@ -0,0 +1,146 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+import hashlib
+from typing import Dict, List, Tuple
+
+import torch
+
+
+class PrefixCache:
+    """
+    Shares full KV-cache blocks between sequences that start with the same tokens.
+
+    Every full block of a sequence is identified by a hash of its tokens chained with the hash of
+    the block before it, so equal hashes mean equal prefixes. Once the forward pass filling a
+    block has been issued, the block is published under its hash. A new sequence whose leading
+    blocks match published ones uses those blocks instead of computing them again. Shared blocks
+    are never written, as a sequence only writes the KV of tokens after its shared prefix.
+
+    Published blocks are reference counted by the sequences using them and are returned to the
+    allocator when the last of them releases it. Blocks that were never published are private to
+    their sequence.
+    """
+
+    _block_size: int
+
+    _blocks: Dict[bytes, int]
+    """
+    Published block for each prefix hash.
+    """
+
+    _hashes: Dict[int, bytes]
+    """
+    Prefix hash of each published block.
+    """
+
+    _ref_counts: Dict[int, int]
+    """
+    Number of sequences using each published block.
+    """
+
+    _seq_state: Dict[int, Tuple[bytes, int, torch.Tensor]]
+    """
+    For each sequence, the hash of its last hashed block, the number of its blocks hashed so far
+    and its tokens that do not fill a block yet.
+    """
+
+    def __init__(self, block_size: int) -> None:
+        self._block_size = block_size
+        self._blocks = {}
+        self._hashes = {}
+        self._ref_counts = {}
+        self._seq_state = {}
+
+    @staticmethod
+    def hash_block(prefix_hash: bytes, tokens: torch.Tensor) -> bytes:
+        """
+        Hash of a block holding ``tokens`` that follows the blocks hashed to ``prefix_hash``.
+        """
+        return hashlib.blake2b(prefix_hash + tokens.to(torch.int64).numpy().tobytes(), digest_size=16).digest()
+
+    def match(self, uid: int, tokens: torch.Tensor) -> torch.Tensor:
+        """
+        Find the published blocks holding the longest prefix of ``tokens``, the first tokens of a
+        new sequence, and take a reference to them. At least one token is left to compute so that
+        the sequence produces logits.
+
+        Returns:
+            torch.Tensor: The matched blocks, in order.
+        """
+        prefix_hash = b""
+        matched = []
+        for start in range(0, tokens.numel() - self._block_size, self._block_size):
+            block_hash = self.hash_block(prefix_hash, tokens[start:start + self._block_size])
+            block = self._blocks.get(block_hash, None)
+            if block is None:
+                break
+            matched.append(block)
+            prefix_hash = block_hash
+
+        for block in matched:
+            self._ref_counts[block] += 1
+
+        self._seq_state[uid] = (prefix_hash, len(matched), tokens[:0])
+        return torch.tensor(matched, dtype=torch.int32)
+
+    def append(self, uid: int, tokens: torch.Tensor, blocks: torch.Tensor) -> None:
+        """
+        Record ``tokens`` of a sequence whose forward pass has been issued and publish the blocks
+        they complete.
+
+        Parameters:
+            uid (int): The sequence.
+            tokens (torch.Tensor): The tokens of the forward pass, on the host.
+            blocks (torch.Tensor): All blocks of the sequence, on the host.
+        """
+        prefix_hash, num_hashed, pending = self._seq_state.get(uid, (b"", 0, tokens[:0]))
+        pending = torch.cat([pending, tokens.flatten()])
+
+        while pending.numel() >= self._block_size:
+            prefix_hash = self.hash_block(prefix_hash, pending[:self._block_size])
+            block = blocks[num_hashed].item()
+            # An equal block may have been computed by a concurrent sequence, keep the first one.
+            if prefix_hash not in self._blocks and block not in self._hashes:
+                self._blocks[prefix_hash] = block
+                self._hashes[block] = prefix_hash
+                self._ref_counts[block] = 1
+            pending = pending[self._block_size:]
+            num_hashed += 1
+
+        self._seq_state[uid] = (prefix_hash, num_hashed, pending)
+
+    def release(self, blocks: torch.Tensor) -> List[int]:
+        """
+        Drop the references of a sequence to its blocks, i.e. when it is flushed or offloaded.
+
+        Returns:
+            List[int]: The blocks no sequence uses any more, to return to the allocator.
+        """
+        unused = []
+        for block in blocks.tolist():
+            if block not in self._ref_counts:
+                unused.append(block)
+                continue
+
+            self._ref_counts[block] -= 1
+            if self._ref_counts[block] == 0:
+                del self._ref_counts[block]
+                del self._blocks[self._hashes.pop(block)]
+                unused.append(block)
+        return unused
+
+    def forget(self, uid: int) -> None:
+        """
+        Drop the hashing state of a flushed sequence.
+        """
+        self._seq_state.pop(uid, None)
+
+    @property
+    def num_cached_blocks(self) -> int:
+        """
+        Number of published blocks.
+        """
+        return len(self._blocks)
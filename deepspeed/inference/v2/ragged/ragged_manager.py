@@ -4,7 +4,9 @@
 # DeepSpeed Team
 
 import torch
-from typing import Any, Dict, Optional, Tuple
+from collections import OrderedDict
+from functools import partial
+from typing import Any, Callable, Dict, Iterable, Optional, Tuple
 
 from deepspeed.accelerator import get_accelerator
 from deepspeed.ops.op_builder import RaggedUtilsBuilder
@@ -12,8 +14,9 @@ from deepspeed.utils.logging import logger
 
 from .blocked_allocator import BlockedAllocator
 from .kv_cache import BlockedKVCache
-from .manager_configs import DSStateManagerConfig, KVCacheConfig
-from .sequence_descriptor import DSSequenceDescriptor
+from .manager_configs import DSStateManagerConfig, KVCacheConfig, KVCacheType
+from .prefix_cache import PrefixCache
+from .sequence_descriptor import DSSequenceDescriptor, KVTier
 
 
 class DSStateManager:
@@ -47,6 +50,17 @@ class DSStateManager:
     TODO(cmikeh2): Evaluate if this has any performance implications.
     """
 
+    _offloaded_seqs: Dict[int, None]
+    """
+    Sequences whose KV-cache is in the host pool, least recently offloaded first. These are the
+    candidates for spilling to NVMe.
+    """
+
+    _prefix_cache: Optional[PrefixCache]
+    """
+    Shared KV blocks of common token prefixes, None unless prefix caching is enabled.
+    """
+
     # Allocator for tracking sequences.
     _tracking_allocator: BlockedAllocator
     _all_block_ids: Tuple[torch.Tensor, ...]
@@ -90,12 +104,26 @@ class DSStateManager:
 
         # Initialize the sequence container.
         self._seqs = {}
+        self._offloaded_seqs = OrderedDict()
+
+        self._prefix_cache = None
+        if self._config.prefix_caching:
+            if len(kv_configs) == 1 and kv_configs[0].num_allocation_groups == 1 and KVCacheType(
+                    kv_configs[0].type) is KVCacheType.DENSE:
+                self._prefix_cache = PrefixCache(kv_configs[0].block_size)
+            else:
+                logger.warning("Prefix caching requires a single dense KV-cache, disabling it.")
 
         # Finally initialize the KV cache.
         self._kv_cache = BlockedKVCache(self._kv_configs,
                                         self._config.memory_config,
                                         mp_group=base_mp_group,
-                                        offload=self._config.offload)
+                                        offload=self._config.offload,
+                                        offload_blocks=self._config.offload_blocks,
+                                        offload_nvme_path=self._config.offload_nvme_path,
+                                        offload_nvme_blocks=self._config.offload_nvme_blocks,
+                                        offload_nvme_batch_blocks=self._config.offload_nvme_batch_blocks,
+                                        offload_nvme_prefetch_blocks=self._config.offload_nvme_prefetch_blocks)
 
     def get_cache(self, cache_id: int, cache_group: int = 0) -> torch.Tensor:
         """
@@ -117,11 +145,159 @@ class DSStateManager:
 
         seq = self._seqs[uid]
         for i in range(self.n_kv_cache_groups):
-            self._kv_cache.free(seq.all_block_ids(cache_group=i), cache_group=i)
-
+            if seq.kv_tier is KVTier.DEVICE:
+                self._release_blocks(seq.all_block_ids(cache_group=i, on_device=False), cache_group=i)
+            elif seq.kv_tier is KVTier.HOST:
+                self._kv_cache.free_offloaded(seq.all_block_ids(cache_group=i, on_device=False), cache_group=i)
+            else:
+                self._kv_cache.free_spilled(seq.all_block_ids(cache_group=i, on_device=False), cache_group=i)
+
+        self._offloaded_seqs.pop(uid, None)
+        if self._prefix_cache is not None:
+            self._prefix_cache.forget(uid)
         self._tracking_allocator.free(seq.tracking_id)
         del self._seqs[uid]
 
+    def offload_sequence(self, uid: int) -> None:
+        """
+        Move the KV-cache blocks of the given sequence to the host, freeing its accelerator blocks.
+        If the host pool is full and NVMe offload is enabled, the least recently offloaded
+        sequences are spilled to NVMe to make room. The sequence stays tracked and is restored
+        with ``restore_sequence``.
+        """
+        seq = self._seqs.get(uid, None)
+        if seq is None:
+            raise ValueError(f"Cannot offload sequence {uid} which does not exist.")
+        if seq.kv_tier is not KVTier.DEVICE:
+            return
+
+        self._make_host_room(seq, exclude=(uid, ))
+        if self._prefix_cache is None:
+            self._move_sequence(seq, self._kv_cache.offload, self._kv_cache.restore, KVTier.HOST)
+        else:
+            # Shared prefix blocks stay with their other users, the host pool gets a private copy.
+            blocks = seq.all_block_ids(on_device=False)
+            self._move_sequence(seq, partial(self._kv_cache.offload, free=False), self._kv_cache.restore,
+                                KVTier.HOST)
+            self._release_blocks(blocks)
+        self._offloaded_seqs[uid] = None
+
+    def restore_sequence(self, uid: int) -> None:
+        """
+        Move the KV-cache blocks of an offloaded sequence back to the accelerator.
+        """
+        seq = self._seqs.get(uid, None)
+        if seq is None:
+            raise ValueError(f"Cannot restore sequence {uid} which does not exist.")
+        if seq.kv_tier is KVTier.DEVICE:
+            return
+
+        if seq.kv_tier is KVTier.NVME:
+            self._fetch_sequence(uid, exclude=(uid, ))
+        self._move_sequence(seq, self._kv_cache.restore, self._kv_cache.offload, KVTier.DEVICE)
+        del self._offloaded_seqs[uid]
+
+    def match_prefix(self, uid: int, tokens: torch.Tensor) -> torch.Tensor:
+        """
+        Give a new sequence the cached blocks of the longest prefix of its first tokens and count
+        those tokens as seen. Returns the tokens that still need to be computed.
+
+        Arguments:
+            uid (int): The sequence, which must already be tracked.
+            tokens (torch.Tensor): The tokens of the sequence's first forward, on the host.
+        """
+        seq = self._seqs[uid]
+        if self._prefix_cache is None or seq.seen_tokens > 0 or seq.cur_allocated_blocks > 0:
+            return tokens
+
+        blocks = self._prefix_cache.match(uid, tokens)
+        if blocks.numel() == 0:
+            return tokens
+
+        num_cached_tokens = blocks.numel() * self._kv_configs[0].block_size
+        seq.extend_kv_cache(blocks)
+        seq.add_cached_tokens(num_cached_tokens)
+        return tokens[num_cached_tokens:]
+
+    def update_prefix_cache(self, uid: int, tokens: torch.Tensor) -> None:
+        """
+        Publish the blocks of a sequence that ``tokens``, the tokens of its last forward, filled.
+        """
+        if self._prefix_cache is None:
+            return
+        seq = self._seqs[uid]
+        self._prefix_cache.append(uid, tokens, seq.all_block_ids(on_device=False))
+
+    def prefetch_sequences(self, uids: Iterable[int]) -> None:
+        """
+        Start reading the sequences among ``uids`` that were spilled to NVMe back into the host
+        pool, so restoring them when they are next scheduled does not wait on NVMe. Intended to be
+        called with the upcoming batch. Sequences of the batch are not spilled to make room, and
+        prefetching stops when the host pool cannot hold the next sequence.
+        """
+        upcoming = set(uids)
+        for uid in uids:
+            seq = self._seqs.get(uid, None)
+            if seq is None or seq.kv_tier is not KVTier.NVME:
+                continue
+            try:
+                self._fetch_sequence(uid, exclude=upcoming, async_op=True)
+            except ValueError:
+                break
+
+    def _fetch_sequence(self, uid: int, exclude: Iterable[int], async_op: bool = False) -> None:
+        seq = self._seqs[uid]
+        self._make_host_room(seq, exclude=exclude)
+        self._move_sequence(seq, partial(self._kv_cache.fetch, async_op=async_op), self._kv_cache.spill,
+                            KVTier.HOST)
+        self._offloaded_seqs[uid] = None
+
+    def _release_blocks(self, blocks: torch.Tensor, cache_group: int = 0) -> None:
+        """
+        Free the accelerator blocks of a sequence, except those still shared with other sequences.
+        """
+        if self._prefix_cache is not None:
+            blocks = self._prefix_cache.release(blocks)
+        self._kv_cache.free(blocks, cache_group=cache_group)
+
+    def _make_host_room(self, seq: DSSequenceDescriptor, exclude: Iterable[int]) -> None:
+        """
+        Spill offloaded sequences to NVMe, least recently offloaded first, until the host pool can
+        hold the blocks of ``seq``.
+        """
+        if not self._kv_cache.nvme_enabled:
+            return
+
+        needed = torch.tensor([seq.all_block_ids(cache_group=i, on_device=False).numel()
+                               for i in range(self.n_kv_cache_groups)],
+                              dtype=torch.int32)
+        for victim in list(self._offloaded_seqs):
+            if (self._kv_cache.free_offload_blocks >= needed).all():
+                return
+            if victim not in exclude:
+                self._move_sequence(self._seqs[victim], self._kv_cache.spill, self._kv_cache.fetch, KVTier.NVME)
+                del self._offloaded_seqs[victim]
+
+    def _move_sequence(self, seq: DSSequenceDescriptor, move_fn: Callable, undo_fn: Callable,
+                       kv_tier: KVTier) -> None:
+        """
+        Move the blocks of every cache group of ``seq`` with ``move_fn`` and point its block table
+        at the new blocks. If a cache group cannot be moved, the ones already moved are moved back
+        with ``undo_fn`` and the error is raised.
+        """
+        new_blocks = []
+        try:
+            for i in range(self.n_kv_cache_groups):
+                new_blocks.append(move_fn(seq.all_block_ids(cache_group=i, on_device=False), cache_group=i))
+        except ValueError:
+            for i, blocks in enumerate(new_blocks):
+                seq.replace_kv_cache(undo_fn(blocks, cache_group=i), cache_group=i)
+            raise
+
+        for i, blocks in enumerate(new_blocks):
+            seq.replace_kv_cache(blocks, cache_group=i)
+        seq.kv_tier = kv_tier
+
     def get_sequence(self, uid: int) -> Optional[DSSequenceDescriptor]:
         """
         Get the sequence descriptor for the given sequence id. If the sequence does not exist,
@@ -167,6 +343,13 @@ class DSStateManager:
         logger.debug(f"Created sequence {uid} with tracking slot {tracking_slot}.")
         return self._seqs[uid]
 
+    @property
+    def num_cached_prefix_blocks(self) -> int:
+        """
+        Return the number of KV blocks shared through the prefix cache.
+        """
+        return 0 if self._prefix_cache is None else self._prefix_cache.num_cached_blocks
+
     @property
     def tracked_sequences(self) -> Dict[int, DSSequenceDescriptor]:
         """
@@ -202,5 +385,19 @@ class DSStateManager:
         """
         return self._kv_cache.free_blocks
 
+    @property
+    def free_offload_blocks(self) -> torch.Tensor:
+        """
+        Return the number of free blocks in the host pool of the KV cache.
+        """
+        return self._kv_cache.free_offload_blocks
+
+    @property
+    def free_nvme_blocks(self) -> torch.Tensor:
+        """
+        Return the number of free NVMe blocks of the KV cache.
+        """
+        return self._kv_cache.free_nvme_blocks
+
     def allocate_blocks(self, n_blocks: int, cache_group: int = 0) -> torch.Tensor:
         return self._kv_cache.reserve(n_blocks, cache_group=cache_group)
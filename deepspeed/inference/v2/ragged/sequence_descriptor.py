@@ -3,11 +3,33 @@
 
 # DeepSpeed Team
 
+from enum import Enum
 from typing import List, Tuple, Union
 
 import torch
 
 
+class KVTier(Enum):
+    """
+    Where the KV-cache blocks of a sequence are stored.
+    """
+
+    DEVICE = "device"
+    """
+    Accelerator KV-cache, the sequence may be scheduled.
+    """
+
+    HOST = "host"
+    """
+    Pinned host pool, the sequence has been offloaded.
+    """
+
+    NVME = "nvme"
+    """
+    NVMe storage, the sequence has been offloaded and then spilled from the host pool.
+    """
+
+
 class BaseSequenceDescriptor:
 
     @property
@@ -31,6 +53,13 @@ class BaseSequenceDescriptor:
         """
         raise NotImplementedError()
 
+    @property
+    def is_resident(self) -> bool:
+        """
+        Whether the KV blocks of this sequence are in accelerator memory.
+        """
+        raise NotImplementedError()
+
 
 class PlaceholderSequenceDescriptor(BaseSequenceDescriptor):
     """
@@ -55,6 +84,10 @@ class PlaceholderSequenceDescriptor(BaseSequenceDescriptor):
     def kv_blocks_ptr(self, cache_group: int = 0) -> int:
         return self._kv_blocks_ptr
 
+    @property
+    def is_resident(self) -> bool:
+        return True
+
 
 class DSSequenceDescriptor(BaseSequenceDescriptor):
 
@@ -95,6 +128,12 @@ class DSSequenceDescriptor(BaseSequenceDescriptor):
     # are stored. Used on flush.
     _tracking_id: int
 
+    _kv_tier: KVTier
+    """
+    The tier holding the KV-cache blocks of the sequence. The KV-cache IDs are block IDs of that
+    tier.
+    """
+
     def __init__(self,
                  tracking_id: int,
                  kv_cache_ids: Tuple[torch.Tensor, ...],
@@ -122,6 +161,7 @@ class DSSequenceDescriptor(BaseSequenceDescriptor):
 
         self._seen_tokens = 0
         self._in_flight_tokens = 0
+        self._kv_tier = KVTier.DEVICE
 
         self._num_allocation_groups = tuple(kv_cache_ids_shadow.shape[0]
                                             for kv_cache_ids_shadow in kv_cache_ids_shadow)
@@ -160,6 +200,25 @@ class DSSequenceDescriptor(BaseSequenceDescriptor):
         """
         return self._tracking_id
 
+    @property
+    def is_resident(self) -> bool:
+        """
+        Whether the KV blocks of this sequence are in accelerator memory. If not, the sequence has
+        been offloaded and its block IDs refer to the tier given by ``kv_tier``.
+        """
+        return self._kv_tier is KVTier.DEVICE
+
+    @property
+    def kv_tier(self) -> KVTier:
+        """
+        The tier holding the KV blocks of this sequence.
+        """
+        return self._kv_tier
+
+    @kv_tier.setter
+    def kv_tier(self, kv_tier: KVTier) -> None:
+        self._kv_tier = kv_tier
+
     @property
     def cur_allocated_blocks(self, cache_group: int = 0) -> int:
         """
@@ -196,19 +255,42 @@ class DSSequenceDescriptor(BaseSequenceDescriptor):
         return self._kv_cache_ids[cache_group].data_ptr()
 
     #TODO: this was previously a property but causing issues with PR-4668 need to consult w. Connor
-    def all_block_ids(self, cache_group: int = 0) -> torch.Tensor:
+    def all_block_ids(self, cache_group: int = 0, on_device: bool = True) -> torch.Tensor:
         """
         Return the Tensor containing all block IDs for this sequence in the specified cache group.
 
         Arguments:
             cache_group (int): The cache group to query.
+            on_device (bool): Whether or not to return the Tensor on the device or on the host.
         """
         block_ids = []
-        for allocation_group, num_blocks in zip(self._kv_cache_ids[cache_group],
+        for allocation_group, num_blocks in zip(self.kv_cache_ids(cache_group, on_device=on_device),
                                                 self._blocks_per_allocation_group[cache_group]):
             block_ids.append(allocation_group[:num_blocks])
         return torch.cat(block_ids)
 
+    def replace_kv_cache(self, new_ids: torch.IntTensor, cache_group: int = 0) -> None:
+        """
+        Replace all block IDs of the sequence in the specified cache group, i.e. when its blocks
+        move between the tiers of the KV-cache.
+
+        Arguments:
+            new_ids (torch.IntTensor): The new IDs on the host, in the order of ``all_block_ids``.
+            cache_group (int): The cache group to update.
+        """
+        num_ids = self._blocks_per_allocation_group[cache_group].sum().item()
+        if new_ids.numel() != num_ids:
+            raise ValueError(f"Provided {new_ids.numel()} block IDs, the sequence holds {num_ids} blocks")
+
+        offset = 0
+        for group_id, num_blocks in enumerate(self._blocks_per_allocation_group[cache_group].tolist()):
+            shadow_alloc_group = self._kv_cache_ids_shadow[cache_group][group_id]
+            alloc_group = self._kv_cache_ids[cache_group][group_id]
+
+            shadow_alloc_group[:num_blocks].copy_(new_ids[offset:offset + num_blocks])
+            alloc_group[:num_blocks].copy_(shadow_alloc_group[:num_blocks], non_blocking=True)
+            offset += num_blocks
+
     def pre_forward(self, num_tokens: int) -> None:
         """
         Update the state of the sequence before a forward pass.
@@ -219,6 +301,16 @@ class DSSequenceDescriptor(BaseSequenceDescriptor):
         """
         self._in_flight_tokens = num_tokens
 
+    def add_cached_tokens(self, num_tokens: int) -> None:
+        """
+        Count tokens whose KV is already in the blocks of the sequence as seen, i.e. a prefix
+        shared through the prefix cache, so they are not computed again.
+
+        Arguments:
+            num_tokens (int): The number of tokens.
+        """
+        self._seen_tokens += num_tokens
+
     def post_forward(self) -> None:
         """
         Update the state of the sequence after a forward pass. This should be called after the forward
@@ -13,10 +13,9 @@ import torch
 from torch import Tensor
 from deepspeed import comm as dist
 # NOTE: Use torch.distributed's ProcessGroup class until we have our own.
-from torch.distributed import ProcessGroup, all_to_all_single
+from torch.distributed import ProcessGroup
 from deepspeed.accelerator import get_accelerator
 from deepspeed.utils import instrument_w_nvtx
-from deepspeed.ops import op_builder
 
 
 def _torch_reduce_scatter_fn(input_tensor: Tensor, output_tensor: Tensor, group=None, async_op=False, prof=False):
@@ -31,7 +30,7 @@ quantizer_module = None
 def all_to_all_quant_reduce(tensors: List[Tensor], groups: {}) -> List[Tensor]:
     global quantizer_module
     if quantizer_module is None:
-        quantizer_module = op_builder.QuantizerBuilder().load()
+        quantizer_module = get_accelerator().create_op_builder("QuantizerBuilder").load()
     local_world_size = get_accelerator().device_count()
     global_world_size = dist.get_world_size()
     num_nodes = global_world_size // local_world_size
@@ -53,18 +52,23 @@ def all_to_all_quant_reduce(tensors: List[Tensor], groups: {}) -> List[Tensor]:
                                                                               local_world_size)
             local_output = torch.empty_like(intra_quant_int4)
             scale_output = torch.empty_like(intra_q_scales)
-            all_to_all_single(local_output, intra_quant_int4, group=groups[f'local_{intra_idx}'])
-            all_to_all_single(scale_output, intra_q_scales, group=groups[f'local_{intra_idx}'])
+            dist.all_to_all_single(local_output, intra_quant_int4, group=groups[f'local_{intra_idx}'])
+            dist.all_to_all_single(scale_output, intra_q_scales, group=groups[f'local_{intra_idx}'])
             global_input_tensor, global_scales = quantizer_module.quantized_reduction(
                 local_output, scale_output, intra_quant_group, inter_quant_group, 4, quantizer_module.Symmetric,
                 local_world_size)
             global_output = torch.empty_like(global_input_tensor)
             global_scale_output = torch.empty_like(global_scales)
-            all_to_all_single(global_output, global_input_tensor, group=groups[f'global_{inter_idx}'])
-            all_to_all_single(global_scale_output, global_scales, group=groups[f'global_{inter_idx}'])
-            final_output = quantizer_module.dequantize(global_output, global_scale_output, global_scale_output.numel(),
-                                                       4, quantizer_module.Symmetric)
-            output_lst[idx] = (sum(list(final_output.chunk(num_nodes))) / num_nodes).view(-1)
+            dist.all_to_all_single(global_output, global_input_tensor, group=groups[f'global_{inter_idx}'])
+            dist.all_to_all_single(global_scale_output, global_scales, group=groups[f'global_{inter_idx}'])
+            if tensor.dtype == torch.half:
+                dequantize = quantizer_module.dequantize
+            else:
+                # half can not hold every bf16 gradient
+                dequantize = quantizer_module.dequantize_fp32
+            final_output = dequantize(global_output, global_scale_output, global_scale_output.numel(), 4,
+                                      quantizer_module.Symmetric)
+            output_lst[idx] = (sum(list(final_output.chunk(num_nodes))) / num_nodes).view(-1).to(tensor.dtype)
     return output_lst
 
 
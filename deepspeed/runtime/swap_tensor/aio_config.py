@@ -3,17 +3,33 @@
 
 # DeepSpeed Team
 
+import json
+import os
+import socket
+
 from deepspeed.runtime.config_utils import get_scalar_param
 from deepspeed.runtime.swap_tensor.constants import *
+from deepspeed.utils.logging import logger
 
 AIO_DEFAULT_DICT = {
     AIO_BLOCK_SIZE: AIO_BLOCK_SIZE_DEFAULT,
     AIO_QUEUE_DEPTH: AIO_QUEUE_DEPTH_DEFAULT,
     AIO_THREAD_COUNT: AIO_THREAD_COUNT_DEFAULT,
     AIO_SINGLE_SUBMIT: AIO_SINGLE_SUBMIT_DEFAULT,
-    AIO_OVERLAP_EVENTS: AIO_OVERLAP_EVENTS_DEFAULT
+    AIO_OVERLAP_EVENTS: AIO_OVERLAP_EVENTS_DEFAULT,
+    AIO_AUTO_TUNE: AIO_AUTO_TUNE_DEFAULT,
+    AIO_AUTO_TUNE_CACHE: AIO_AUTO_TUNE_CACHE_DEFAULT,
+    AIO_ADAPTIVE_QUEUE_DEPTH: AIO_ADAPTIVE_QUEUE_DEPTH_DEFAULT,
+    AIO_LOW_PRIORITY_BANDWIDTH: AIO_LOW_PRIORITY_BANDWIDTH_DEFAULT
 }
 
+# Search space and probe size used when auto-tuning against a swap directory.
+AIO_TUNE_BLOCK_SIZES = [128 * 1024, 256 * 1024, 512 * 1024, 1024 * 1024]
+AIO_TUNE_QUEUE_DEPTHS = [4, 8, 16, 32]
+AIO_TUNE_THREAD_COUNTS = [1, 2, 4, 8]
+AIO_TUNE_PROBE_BYTES = 64 * 1024**2
+AIO_TUNE_CACHE_FILE = os.path.join(os.path.expanduser('~'), '.cache', 'deepspeed', 'aio_tune_cache.json')
+
 
 def get_aio_config(param_dict):
     if AIO in param_dict.keys() and param_dict[AIO] is not None:
@@ -23,7 +39,92 @@ def get_aio_config(param_dict):
             AIO_QUEUE_DEPTH: get_scalar_param(aio_dict, AIO_QUEUE_DEPTH, AIO_QUEUE_DEPTH_DEFAULT),
             AIO_THREAD_COUNT: get_scalar_param(aio_dict, AIO_THREAD_COUNT, AIO_THREAD_COUNT_DEFAULT),
             AIO_SINGLE_SUBMIT: get_scalar_param(aio_dict, AIO_SINGLE_SUBMIT, AIO_SINGLE_SUBMIT_DEFAULT),
-            AIO_OVERLAP_EVENTS: get_scalar_param(aio_dict, AIO_OVERLAP_EVENTS, AIO_OVERLAP_EVENTS_DEFAULT)
+            AIO_OVERLAP_EVENTS: get_scalar_param(aio_dict, AIO_OVERLAP_EVENTS, AIO_OVERLAP_EVENTS_DEFAULT),
+            AIO_AUTO_TUNE: get_scalar_param(aio_dict, AIO_AUTO_TUNE, AIO_AUTO_TUNE_DEFAULT),
+            AIO_AUTO_TUNE_CACHE: get_scalar_param(aio_dict, AIO_AUTO_TUNE_CACHE, AIO_AUTO_TUNE_CACHE_DEFAULT),
+            AIO_ADAPTIVE_QUEUE_DEPTH: get_scalar_param(aio_dict, AIO_ADAPTIVE_QUEUE_DEPTH,
+                                                       AIO_ADAPTIVE_QUEUE_DEPTH_DEFAULT),
+            AIO_LOW_PRIORITY_BANDWIDTH: get_scalar_param(aio_dict, AIO_LOW_PRIORITY_BANDWIDTH,
+                                                         AIO_LOW_PRIORITY_BANDWIDTH_DEFAULT)
         }
 
-    return AIO_DEFAULT_DICT
+    return AIO_DEFAULT_DICT.copy()
+
+
+def _get_device_key(path):
+    st_dev = os.stat(path).st_dev
+    return f'{os.major(st_dev)}:{os.minor(st_dev)}'
+
+
+def _load_tune_cache(cache_file):
+    try:
+        with open(cache_file, 'r') as f:
+            return json.load(f)
+    except (OSError, ValueError):
+        return {}
+
+
+def _save_tune_cache(cache_file, cache):
+    os.makedirs(os.path.dirname(os.path.abspath(cache_file)), exist_ok=True)
+    tmp_file = f'{cache_file}.{socket.gethostname()}.{os.getpid()}'
+    with open(tmp_file, 'w') as f:
+        json.dump(cache, f, indent=2)
+    os.replace(tmp_file, cache_file)
+
+
+def _tune_device(swap_folder, device_key, cache_file):
+    from deepspeed.ops.op_builder import AsyncIOBuilder
+    aio_op = AsyncIOBuilder().load(verbose=False)
+    tuner = aio_op.aio_tuner(swap_folder, AIO_TUNE_PROBE_BYTES, AIO_TUNE_BLOCK_SIZES, AIO_TUNE_QUEUE_DEPTHS,
+                             AIO_TUNE_THREAD_COUNTS)
+    if not tuner.tune():
+        logger.warning(f'AIO auto-tuning failed on {swap_folder}, keeping configured values')
+        return None
+
+    tuned = {
+        AIO_BLOCK_SIZE: tuner.get_block_size(),
+        AIO_QUEUE_DEPTH: tuner.get_queue_depth(),
+        AIO_THREAD_COUNT: tuner.get_thread_count()
+    }
+    logger.info(f'AIO auto-tuned device {device_key} ({swap_folder}): {tuned}, '
+                f'read {tuner.get_read_GB():.2f} GB/s, write {tuner.get_write_GB():.2f} GB/s')
+    cache = _load_tune_cache(cache_file)
+    cache[device_key] = tuned
+    _save_tune_cache(cache_file, cache)
+    return tuned
+
+
+def autotune_aio_config(aio_config, swap_folder):
+    """
+    Return a copy of ``aio_config`` with block_size, queue_depth and thread_count replaced by the
+    best values measured on the device backing ``swap_folder``. ``aio_config`` itself is left
+    untouched, so swappers on different devices each get their own values. Results are cached per
+    device in ``auto_tune_cache`` so that the probe only runs once per drive.
+
+    In a distributed job only local rank 0 probes, as concurrent probes from every rank would
+    measure a shared device. The other ranks wait for it and pick the result up from the cache.
+    """
+    if not aio_config[AIO_AUTO_TUNE]:
+        return aio_config
+
+    from deepspeed import comm as dist
+    cache_file = aio_config[AIO_AUTO_TUNE_CACHE] or AIO_TUNE_CACHE_FILE
+    device_key = _get_device_key(swap_folder)
+    tuned = _load_tune_cache(cache_file).get(device_key)
+
+    if dist.is_initialized():
+        if tuned is None and dist.get_local_rank() == 0:
+            tuned = _tune_device(swap_folder, device_key, cache_file)
+        dist.barrier()
+        if tuned is None:
+            tuned = _load_tune_cache(cache_file).get(device_key)
+            if tuned is None:
+                logger.warning(f'No AIO auto-tuning result for device {device_key} ({swap_folder}), '
+                               'keeping configured values')
+    elif tuned is None:
+        tuned = _tune_device(swap_folder, device_key, cache_file)
+
+    if tuned is None:
+        return aio_config
+
+    return {**aio_config, **{key: tuned[key] for key in (AIO_BLOCK_SIZE, AIO_QUEUE_DEPTH, AIO_THREAD_COUNT)}}
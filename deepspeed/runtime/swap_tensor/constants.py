@@ -11,7 +11,11 @@ AIO_FORMAT = '''
   "queue_depth": 8,
   "thread_count": 1,
   "single_submit": false,
-  "overlap_events": true
+  "overlap_events": true,
+  "auto_tune": false,
+  "auto_tune_cache": null,
+  "adaptive_queue_depth": false,
+  "low_priority_bandwidth": 0
 }
 '''
 AIO = "aio"
@@ -25,3 +29,16 @@ AIO_SINGLE_SUBMIT = "single_submit"
 AIO_SINGLE_SUBMIT_DEFAULT = False
 AIO_OVERLAP_EVENTS = "overlap_events"
 AIO_OVERLAP_EVENTS_DEFAULT = True
+AIO_AUTO_TUNE = "auto_tune"
+AIO_AUTO_TUNE_DEFAULT = False
+AIO_AUTO_TUNE_CACHE = "auto_tune_cache"
+AIO_AUTO_TUNE_CACHE_DEFAULT = None
+AIO_ADAPTIVE_QUEUE_DEPTH = "adaptive_queue_depth"
+AIO_ADAPTIVE_QUEUE_DEPTH_DEFAULT = False
+AIO_LOW_PRIORITY_BANDWIDTH = "low_priority_bandwidth"
+AIO_LOW_PRIORITY_BANDWIDTH_DEFAULT = 0
+
+# Scheduling classes of AIO handle ops; these mirror io_priority_t in csrc/aio.
+AIO_PRIORITY_HIGH = 0
+AIO_PRIORITY_NORMAL = 1
+AIO_PRIORITY_LOW = 2
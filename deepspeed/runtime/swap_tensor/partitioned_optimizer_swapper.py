@@ -33,9 +33,11 @@ class PartitionedOptimizerSwapper(OptimizerSwapper):
                                                           largest_numel, device, dtype, timers)
 
         aio_op = AsyncIOBuilder().load()
-        self.aio_handle = aio_op.aio_handle(aio_config[AIO_BLOCK_SIZE], aio_config[AIO_QUEUE_DEPTH],
-                                            aio_config[AIO_SINGLE_SUBMIT], aio_config[AIO_OVERLAP_EVENTS],
-                                            aio_config[AIO_THREAD_COUNT])
+        self.aio_handle = aio_op.aio_handle(self.aio_config[AIO_BLOCK_SIZE], self.aio_config[AIO_QUEUE_DEPTH],
+                                            self.aio_config[AIO_SINGLE_SUBMIT], self.aio_config[AIO_OVERLAP_EVENTS],
+                                            self.aio_config[AIO_THREAD_COUNT])
+        self.aio_handle.set_adaptive_queue_depth(self.aio_config[AIO_ADAPTIVE_QUEUE_DEPTH])
+        self.aio_handle.set_low_priority_bandwidth(self.aio_config[AIO_LOW_PRIORITY_BANDWIDTH])
 
         # Overlap swapping out
         self.gradient_swapper = AsyncTensorSwapper(aio_handle=self.aio_handle,
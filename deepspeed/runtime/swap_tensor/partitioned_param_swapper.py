@@ -14,6 +14,7 @@ from deepspeed import comm as dist
 from deepspeed.accelerator import get_accelerator
 from deepspeed.ops.op_builder import AsyncIOBuilder
 from .constants import *
+from .aio_config import autotune_aio_config
 from .utils import swap_in_tensors, swap_out_tensors, MIN_AIO_BYTES, AIO_ALIGNED_BYTES, print_object, SwapBufferPool
 
 
@@ -91,7 +92,7 @@ class AsyncPartitionedParameterSwapper(object):
 
         self.swap_element_size = torch.tensor([], dtype=self.dtype).element_size()
 
-        self.aio_config = ds_config.aio_config
+        self.aio_config = autotune_aio_config(ds_config.aio_config, self.swap_folder)
 
         # Read/Write alignment for each thread during Intra-request parallelism
         self.min_aio_bytes = max(MIN_AIO_BYTES, self.aio_config[AIO_BLOCK_SIZE])
@@ -118,6 +119,10 @@ class AsyncPartitionedParameterSwapper(object):
                                                 self.aio_config[AIO_SINGLE_SUBMIT],
                                                 self.aio_config[AIO_OVERLAP_EVENTS], self.aio_config[AIO_THREAD_COUNT])
 
+        self.aio_read_handle.set_adaptive_queue_depth(self.aio_config[AIO_ADAPTIVE_QUEUE_DEPTH])
+        self.aio_write_handle.set_adaptive_queue_depth(self.aio_config[AIO_ADAPTIVE_QUEUE_DEPTH])
+        self.aio_write_handle.set_low_priority_bandwidth(self.aio_config[AIO_LOW_PRIORITY_BANDWIDTH])
+
         self.swap_out_params = []
 
     #Check if partitioned param or numel in a tensor is swappable or not
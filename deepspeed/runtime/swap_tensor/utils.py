@@ -11,19 +11,30 @@ from deepspeed.utils.logging import logger
 from deepspeed.accelerator import get_accelerator
 
 from deepspeed import comm as dist
+from deepspeed.runtime.swap_tensor.constants import AIO_PRIORITY_HIGH, AIO_PRIORITY_LOW
 
 MIN_AIO_BYTES = 1024**2
 AIO_ALIGNED_BYTES = 1024
 
 
-def swap_in_tensors(swap_handle, tensor_buffers, swap_paths):
+# Swap-ins usually block compute, so by default they preempt swap-outs queued on the same handle.
+# A file_dtype different from the buffer dtype converts the data while it is being transferred.
+def swap_in_tensors(swap_handle, tensor_buffers, swap_paths, priority=AIO_PRIORITY_HIGH, file_dtype=None):
     for buffer, path in zip(tensor_buffers, swap_paths):
-        assert (swap_handle.async_pread(buffer, path) == 0)
+        if file_dtype is None or file_dtype == buffer.dtype:
+            assert (swap_handle.async_pread(buffer, path, priority) == 0)
+        else:
+            file_example = torch.empty(0, dtype=file_dtype)
+            assert (swap_handle.convert_pread(buffer, path, file_example, True, priority) == 0)
 
 
-def swap_out_tensors(swap_handle, tensor_buffers, swap_paths):
+def swap_out_tensors(swap_handle, tensor_buffers, swap_paths, priority=AIO_PRIORITY_LOW, file_dtype=None):
     for buffer, path in zip(tensor_buffers, swap_paths):
-        assert (swap_handle.async_pwrite(buffer, path) == 0)
+        if file_dtype is None or file_dtype == buffer.dtype:
+            assert (swap_handle.async_pwrite(buffer, path, priority) == 0)
+        else:
+            file_example = torch.empty(0, dtype=file_dtype)
+            assert (swap_handle.convert_pwrite(buffer, path, file_example, True, priority) == 0)
 
 
 def print_object(obj, name, exclude_list=[]):
@@ -7,4 +7,5 @@
 from .comm import CCLCommBuilder
 from .fused_adam import FusedAdamBuilder
 from .cpu_adam import CPUAdamBuilder
+from .quantizer import QuantizerBuilder
 from .no_impl import NotImplementedBuilder
@@ -58,6 +58,7 @@ class RaggedUtilsBuilder(CUDAOpBuilder):
 
     def sources(self):
         sources = [
+            "inference/v2/ragged/csrc/blocked_allocator.cpp",
             "inference/v2/ragged/csrc/fast_host_buffer.cu",
             "inference/v2/ragged/csrc/ragged_ops.cpp",
         ]
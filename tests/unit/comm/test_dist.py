@@ -3,6 +3,7 @@
 
 # DeepSpeed Team
 
+import json
 import os
 import torch
 import deepspeed.comm as dist
@@ -138,6 +139,249 @@ class TestDistInferenceAllReduce(DistributedTest):
         assert torch.all(x == result)
 
 
+class TestDistAsyncAllReduce(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        x = torch.ones(1, 3).to(get_accelerator().device_name()) * (dist.get_rank() + 1)
+        sum_of_ranks = (dist.get_world_size() * (dist.get_world_size() + 1)) // 2
+        result = torch.ones(1, 3).to(get_accelerator().device_name()) * sum_of_ranks
+        handle = dist.all_reduce(x, async_op=True)
+        handle.wait()
+        assert torch.all(x == result)
+
+
+class TestDistAsyncInferenceAllReduce(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        sum_of_ranks = (dist.get_world_size() * (dist.get_world_size() + 1)) // 2
+        tensors = [torch.ones(size).to(get_accelerator().device_name()) * (dist.get_rank() + 1) for size in (3, 70001)]
+        handles = [dist.inference_all_reduce(x, async_op=True) for x in tensors]
+        # completes in issue order without wait() being called
+        while not handles[-1].is_completed():
+            pass
+        assert all(handle.is_completed() for handle in handles)
+        for handle in handles:
+            handle.wait()
+        for x in tensors:
+            assert torch.all(x == sum_of_ranks)
+
+    def test_dropped_tensor(self):
+        # the handle keeps the tensor alive after the caller's last reference to it is gone
+        handle = dist.all_reduce(torch.ones(1025).to(get_accelerator().device_name()), async_op=True)
+        x = torch.ones(3).to(get_accelerator().device_name())
+        dist.broadcast(x, 0, async_op=True).wait()
+        handle.wait()
+        assert handle.is_completed()
+
+
+class TestDistAllReduceCoalesced(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        if not dist.has_all_reduce_coalesced():
+            pytest.skip("all_reduce_coalesced is not supported")
+        sum_of_ranks = (dist.get_world_size() * (dist.get_world_size() + 1)) // 2
+        tensors = [
+            torch.ones(size).to(get_accelerator().device_name()) * (dist.get_rank() + 1) for size in (3, 1025, 17)
+        ]
+        dist.all_reduce_coalesced(tensors)
+        for x in tensors:
+            assert torch.all(x == sum_of_ranks)
+
+        # mixed dtypes take oneCCL, one allreduce per dtype over its packed tensors
+        tensors = [
+            torch.ones(size, dtype=dtype).to(get_accelerator().device_name()) * (dist.get_rank() + 1)
+            for size, dtype in ((3, torch.float32), (5, torch.int32), (1025, torch.float32), (2, torch.int32))
+        ]
+        dist.all_reduce_coalesced(tensors)
+        for x in tensors:
+            assert torch.all(x == sum_of_ranks)
+
+
+class TestDistAllGatherIntoTensor(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        x = torch.ones(1, 3).to(get_accelerator().device_name()) * (dist.get_rank() + 1)
+        output = torch.zeros(dist.get_world_size(), 3).to(get_accelerator().device_name())
+        result = torch.arange(1, dist.get_world_size() + 1).unsqueeze(1).expand(-1, 3).float()
+        dist.all_gather_into_tensor(output, x)
+        assert torch.all(output.cpu() == result)
+
+
+class TestDistReduceScatterTensor(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        x = torch.ones(dist.get_world_size(), 3).to(get_accelerator().device_name()) * (dist.get_rank() + 1)
+        sum_of_ranks = (dist.get_world_size() * (dist.get_world_size() + 1)) // 2
+        output = torch.zeros(1, 3).to(get_accelerator().device_name())
+        dist.reduce_scatter_tensor(output, x)
+        assert torch.all(output.cpu() == sum_of_ranks)
+
+
+class TestDistAllToAllSingle(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        rank, world_size = dist.get_rank(), dist.get_world_size()
+        # rank r sends r + d + 1 rows to rank d, each row holding the sender's rank
+        input_split_sizes = [rank + d + 1 for d in range(world_size)]
+        output_split_sizes = [s + rank + 1 for s in range(world_size)]
+        x = torch.ones(sum(input_split_sizes), 3).to(get_accelerator().device_name()) * rank
+        output = torch.zeros(sum(output_split_sizes), 3).to(get_accelerator().device_name())
+        dist.all_to_all_single(output, x, output_split_sizes, input_split_sizes)
+        result = torch.cat([torch.ones(size, 3) * s for s, size in enumerate(output_split_sizes)])
+        assert torch.all(output.cpu() == result)
+
+
+class TestDistSubGroupAllReduce(DistributedTest):
+    world_size = 4
+
+    def test(self):
+        rank = dist.get_rank()
+        # every rank takes part in creating every group
+        groups = [dist.new_group(ranks) for ranks in ([0, 2], [1, 3])]
+        group = groups[rank % 2]
+        x = torch.ones(70001).to(get_accelerator().device_name()) * (rank + 1)
+        dist.inference_all_reduce(x, group=group)
+        assert torch.all(x == (rank % 2 + 1) + (rank % 2 + 3))
+
+        # the world group still has a workspace of its own
+        x = torch.ones(3).to(get_accelerator().device_name()) * (rank + 1)
+        dist.inference_all_reduce(x)
+        assert torch.all(x == 10)
+
+
+@pytest.mark.parametrize("nodes", [(0, 1, 0, 1), (0, 0, 0, 1)])
+class TestDistHierarchicalAllReduce(DistributedTest):
+    world_size = 4
+    init_distributed = False
+
+    def test(self, monkeypatch, nodes):
+        # two "nodes" of two interleaved ranks each, where the world allreduce reduces within each
+        # node over SHM and across nodes with oneCCL, or nodes of different sizes, where it does not
+        from deepspeed.comm.ccl import CCLBackend
+        monkeypatch.setattr(CCLBackend, '_node_name', lambda self: f'node{nodes[self.get_rank()]}')
+        os.environ['LOCAL_SIZE'] = '2'
+        deepspeed.init_distributed(get_accelerator().communication_backend_name())
+        rank = dist.get_rank()
+        for numel in (3, 300001):
+            x = torch.arange(numel).float().to(get_accelerator().device_name()) + rank
+            dist.inference_all_reduce(x)
+            assert torch.all(x.cpu() == torch.arange(numel).float() * 4 + 6)
+
+            # only sums go through SHM, other ops are reduced by oneCCL
+            x = torch.arange(numel).float().to(get_accelerator().device_name()) + rank
+            dist.inference_all_reduce(x, op=dist.ReduceOp.MAX)
+            assert torch.all(x.cpu() == torch.arange(numel).float() + 3)
+
+
+class TestDistCollStats(DistributedTest):
+    world_size = 2
+
+    def test(self, tmpdir):
+        backend = deepspeed.comm.comm.cdb
+        if not hasattr(backend, 'get_coll_stats'):
+            pytest.skip("collective statistics are not supported")
+        x, y = [torch.ones(1025).to(get_accelerator().device_name()) for _ in range(2)]
+        dist.inference_all_reduce(x)
+        assert backend.get_coll_stats() == {}
+
+        backend.enable_coll_stats()
+        backend.enable_trace()
+        dist.inference_all_reduce(x)
+        handles = [dist.all_reduce(x, async_op=True), dist.broadcast(y, 0, async_op=True)]
+        for handle in handles:
+            handle.wait()
+        backend.enable_trace(False)
+        backend.enable_coll_stats(False)
+        dist.inference_all_reduce(x)
+
+        stats = backend.get_coll_stats()
+        assert sorted(stats.keys()) == ['all_reduce', 'broadcast', 'inference_all_reduce']
+        for collective in stats.values():
+            assert sum(collective['count']) == 1
+            assert sum(collective['bytes']) == x.numel() * x.element_size()
+        backend.reset_coll_stats()
+        assert backend.get_coll_stats() == {}
+
+        trace_file = os.path.join(tmpdir, f'trace_{dist.get_rank()}.json')
+        backend.dump_trace(trace_file)
+        with open(trace_file) as f:
+            events = json.load(f)['traceEvents']
+        assert sorted(event['name'] for event in events) == ['all_reduce', 'broadcast', 'inference_all_reduce']
+        # events on one row must not overlap for Chrome tracing to show them
+        by_tid = {}
+        for event in events:
+            by_tid.setdefault(event['tid'], []).append((event['ts'], event['ts'] + event['dur']))
+        for intervals in by_tid.values():
+            intervals.sort()
+            assert all(end <= next_start for (_, end), (next_start, _) in zip(intervals, intervals[1:]))
+
+
+@pytest.mark.parametrize("isa", ["avx2", "scalar"])
+class TestDistShmIsa(DistributedTest):
+    world_size = 2
+    init_distributed = False
+
+    def test(self, isa):
+        if get_accelerator().communication_backend_name() != 'ccl':
+            pytest.skip("SHM kernels are only used by the CCL backend")
+        # forces the SHM kernels below what the CPU supports
+        os.environ['DS_SHM_ISA'] = isa
+        deepspeed.init_distributed(get_accelerator().communication_backend_name())
+        rank = dist.get_rank()
+
+        for dtype in (torch.float32, torch.bfloat16, torch.float16, torch.int32, torch.int64):
+            # odd size so that both the vector kernels and the scalar tail run
+            x = (torch.arange(1029) % 7 + rank).to(dtype)
+            dist.inference_all_reduce(x)
+            assert torch.all(x == ((torch.arange(1029) % 7) * 2 + 1).to(dtype))
+
+        # 1-bit compressed allreduce, whose sign packing has an AVX-512 path as well. Values of
+        # +-(rank + 1) compress without error and average to +-1.5.
+        from deepspeed.runtime.comm.ccl import CclBackend
+        backend = CclBackend()
+        signs = torch.where(torch.arange(592) % 3 == 0, -1.0, 1.0)
+        x = signs * (rank + 1)
+        worker_error, server_error = torch.zeros(592), torch.zeros(296)
+        x = backend.compressed_allreduce(x, worker_error, server_error, rank)
+        assert torch.allclose(x, signs * 1.5)
+        assert torch.allclose(worker_error, torch.zeros(592), atol=1e-6)
+
+
+class TestDistCommArena(DistributedTest):
+    world_size = 2
+
+    def test(self):
+        backend = deepspeed.comm.comm.cdb
+        if not hasattr(backend, 'map_comm_buffer'):
+            pytest.skip("communication arenas are not supported")
+        rank = dist.get_rank()
+        backend.register_comm_arena(1 << 20)
+        like = torch.empty(1025)
+        bucket = backend.map_comm_buffer("bucket", like)
+        bucket.fill_(rank + 1)
+        dist.all_reduce(bucket)
+        assert torch.all(bucket == 3)
+
+        # the same name maps the same memory, with its content
+        bucket = backend.map_comm_buffer("bucket", like)
+        assert torch.all(bucket == 3)
+        assert backend.map_comm_buffer("other", like).data_ptr() != bucket.data_ptr()
+
+        # another op on the same buffer must not reuse the plan cached for the sum
+        bucket.fill_(rank + 1)
+        dist.all_reduce(bucket, op=dist.ReduceOp.MAX)
+        assert torch.all(bucket == 2)
+        bucket.fill_(rank + 1)
+        dist.all_reduce(bucket)
+        assert torch.all(bucket == 3)
+
+
 @pytest.mark.parametrize("dist_init_required", [True, False, None])
 class TestDistInit(DistributedTest):
     init_distributed = False
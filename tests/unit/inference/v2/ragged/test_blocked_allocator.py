@@ -114,6 +114,21 @@ def test_invalid_alloc_indices(index: int):
     assert allocator.free_blocks == 1
 
 
+@pytest.mark.inference_v2
+def test_duplicate_dealloc_indices():
+    allocator = BlockedAllocator(4)
+    block = allocator.allocate(2)[0].item()
+
+    with pytest.raises(ValueError):
+        allocator.free(torch.tensor([block, block]))
+
+    # Neither copy of the block should be freed.
+    assert allocator.free_blocks == 2
+
+    allocator.free(torch.tensor([block]))
+    assert allocator.free_blocks == 3
+
+
 @pytest.mark.inference_v2
 @pytest.mark.parametrize('test_iters', [8192])
 def test_long_running_allocation(test_iters: int) -> None:
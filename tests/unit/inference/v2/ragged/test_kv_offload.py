@@ -0,0 +1,241 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+import os
+
+import pytest
+import torch
+
+from deepspeed.inference.v2.ragged import (
+    AllocationMode,
+    DSStateManager,
+    DSStateManagerConfig,
+    KVCacheConfig,
+    KVTier,
+    MemoryConfig,
+)
+from deepspeed.ops.op_builder import AsyncIOBuilder
+
+
+def build_manager(num_blocks: int,
+                  offload_blocks: int = 0,
+                  nvme_path: str = None,
+                  nvme_prefetch_blocks: int = 2,
+                  prefix_caching: bool = False) -> DSStateManager:
+    config = DSStateManagerConfig(max_tracked_sequences=8,
+                                  max_ragged_batch_size=64,
+                                  max_ragged_sequence_count=8,
+                                  memory_config=MemoryConfig(mode=AllocationMode.ALLOCATE, size=num_blocks),
+                                  offload=True,
+                                  offload_blocks=offload_blocks,
+                                  offload_nvme_path=nvme_path,
+                                  offload_nvme_blocks=16,
+                                  offload_nvme_batch_blocks=2,
+                                  offload_nvme_prefetch_blocks=nvme_prefetch_blocks,
+                                  prefix_caching=prefix_caching)
+    kv_config = KVCacheConfig(block_size=4, cache_shape=(2, 2, 8), max_blocks_per_allocation_group=8)
+    return DSStateManager(config, (kv_config, ))
+
+
+def fill_sequence(manager: DSStateManager, uid: int, num_blocks: int, value: float) -> torch.Tensor:
+    seq = manager.get_or_create_sequence(uid)
+    seq.extend_kv_cache(manager.allocate_blocks(num_blocks))
+    blocks = seq.all_block_ids(on_device=False).to(torch.int64)
+    for cache_id in range(2):
+        cache = manager.get_cache(cache_id)
+        cache[blocks] = torch.randn(cache[blocks].shape, device=cache.device, dtype=cache.dtype) + value
+    return read_sequence(manager, uid)
+
+
+def read_sequence(manager: DSStateManager, uid: int) -> torch.Tensor:
+    blocks = manager.get_sequence(uid).all_block_ids(on_device=False).to(torch.int64)
+    return torch.stack([manager.get_cache(cache_id)[blocks] for cache_id in range(2)])
+
+
+def share_prefix(manager: DSStateManager) -> torch.Tensor:
+    """
+    Sequence 0 publishes 3 blocks of 12 tokens, sequence 1 shares the first 2 of them and writes 1
+    private block. Returns the contents of sequence 1.
+    """
+    prompt = torch.arange(12)
+    fill_sequence(manager, uid=0, num_blocks=3, value=0.0)
+    manager.update_prefix_cache(0, prompt)
+
+    manager.get_or_create_sequence(1)
+    remaining = manager.match_prefix(1, torch.cat([prompt[:8], torch.tensor([42, 43])]))
+    assert remaining.tolist() == [42, 43]
+
+    seq = manager.get_sequence(1)
+    private = manager.allocate_blocks(1)
+    seq.extend_kv_cache(private)
+    for cache_id in range(2):
+        cache = manager.get_cache(cache_id)
+        cache[private.to(torch.int64)] = torch.randn(cache[private.to(torch.int64)].shape,
+                                                     device=cache.device,
+                                                     dtype=cache.dtype) + 10.0
+    assert manager.free_blocks[0] == 4
+    return read_sequence(manager, 1)
+
+
+@pytest.mark.inference_v2
+def test_offload_restore() -> None:
+    manager = build_manager(num_blocks=8)
+    expected = fill_sequence(manager, uid=0, num_blocks=6, value=0.0)
+
+    manager.offload_sequence(0)
+    seq = manager.get_sequence(0)
+    assert not seq.is_resident
+    assert manager.free_blocks[0] == 8
+    assert manager.free_offload_blocks[0] == 2
+
+    # Another sequence reuses (and overwrites) the blocks that were offloaded.
+    fill_sequence(manager, uid=1, num_blocks=8, value=10.0)
+    manager.flush_sequence(1)
+
+    manager.restore_sequence(0)
+    assert seq.is_resident
+    assert manager.free_blocks[0] == 2
+    assert manager.free_offload_blocks[0] == 8
+
+    assert torch.equal(read_sequence(manager, 0), expected)
+    assert torch.equal(seq.all_block_ids().cpu(), seq.all_block_ids(on_device=False))
+
+
+@pytest.mark.inference_v2
+def test_flush_offloaded() -> None:
+    manager = build_manager(num_blocks=8)
+    fill_sequence(manager, uid=0, num_blocks=3, value=0.0)
+
+    manager.offload_sequence(0)
+    manager.flush_sequence(0)
+    assert manager.free_blocks[0] == 8
+    assert manager.free_offload_blocks[0] == 8
+
+
+@pytest.mark.inference_v2
+def test_offload_pool_full() -> None:
+    manager = build_manager(num_blocks=8, offload_blocks=2)
+    fill_sequence(manager, uid=0, num_blocks=3, value=0.0)
+
+    with pytest.raises(ValueError):
+        manager.offload_sequence(0)
+
+    assert manager.get_sequence(0).is_resident
+    assert manager.free_blocks[0] == 5
+    assert manager.free_offload_blocks[0] == 2
+
+
+@pytest.mark.inference_v2
+@pytest.mark.parametrize('prefetch', [False, True])
+def test_nvme_spill(tmpdir, prefetch: bool) -> None:
+    if not AsyncIOBuilder().is_compatible():
+        pytest.skip("Async IO is not available on this system")
+
+    manager = build_manager(num_blocks=8, offload_blocks=4, nvme_path=str(tmpdir))
+    expected_0 = fill_sequence(manager, uid=0, num_blocks=3, value=0.0)
+    expected_1 = fill_sequence(manager, uid=1, num_blocks=3, value=10.0)
+
+    # Sequence 1 only fits in the host pool once sequence 0 is spilled to NVMe.
+    manager.offload_sequence(0)
+    manager.offload_sequence(1)
+    assert manager.get_sequence(0).kv_tier is KVTier.NVME
+    assert manager.get_sequence(1).kv_tier is KVTier.HOST
+    assert manager.free_offload_blocks[0] == 1
+    # Every spilled block lives in the tier's single file.
+    assert [name for _, _, names in os.walk(str(tmpdir)) for name in names] == ["kv_cache.swp"]
+
+    if prefetch:
+        # Sequence 1 is also in the upcoming batch so it is not spilled to make room.
+        manager.prefetch_sequences([1, 0])
+        assert manager.get_sequence(0).kv_tier is KVTier.NVME
+        manager.restore_sequence(1)
+        manager.prefetch_sequences([0])
+        assert manager.get_sequence(0).kv_tier is KVTier.HOST
+
+    for uid, expected in ((0, expected_0), (1, expected_1)):
+        manager.restore_sequence(uid)
+        assert manager.get_sequence(uid).is_resident
+        assert torch.equal(read_sequence(manager, uid), expected)
+
+    assert manager.free_offload_blocks[0] == 4
+    assert manager.free_blocks[0] == 2
+
+
+@pytest.mark.inference_v2
+@pytest.mark.parametrize('prefetch', [False, True])
+@pytest.mark.parametrize('prefetch_blocks', [2, 8])
+def test_restore_then_fetch(tmpdir, prefetch: bool, prefetch_blocks: int) -> None:
+    if not AsyncIOBuilder().is_compatible():
+        pytest.skip("Async IO is not available on this system")
+
+    # With 2 blocks of read staging, fetching a sequence of 3 blocks lands the first reads early.
+    manager = build_manager(num_blocks=8,
+                            offload_blocks=4,
+                            nvme_path=str(tmpdir),
+                            nvme_prefetch_blocks=prefetch_blocks)
+    expected_0 = fill_sequence(manager, uid=0, num_blocks=3, value=0.0)
+    expected_1 = fill_sequence(manager, uid=1, num_blocks=3, value=10.0)
+    manager.offload_sequence(0)
+    manager.offload_sequence(1)
+    assert manager.get_sequence(0).kv_tier is KVTier.NVME
+
+    # Sequence 0 is read from NVMe into the host blocks that restoring sequence 1 just freed, while
+    # the copy out of them may still be in flight.
+    manager.restore_sequence(1)
+    if prefetch:
+        manager.prefetch_sequences([0])
+    manager.restore_sequence(0)
+
+    for uid, expected in ((0, expected_0), (1, expected_1)):
+        assert torch.equal(read_sequence(manager, uid), expected)
+
+
+@pytest.mark.inference_v2
+@pytest.mark.parametrize('flushed', [0, 1])
+def test_flush_shared_prefix(flushed: int) -> None:
+    manager = build_manager(num_blocks=8, prefix_caching=True)
+    expected_1 = share_prefix(manager)
+    expected = {0: read_sequence(manager, 0), 1: expected_1}
+    kept = 1 - flushed
+
+    manager.flush_sequence(flushed)
+    # The flushed sequence only frees the blocks the other one does not use.
+    assert manager.free_blocks[0] == 8 - manager.get_sequence(kept).all_block_ids().numel()
+    assert manager.num_cached_prefix_blocks == (2 if flushed == 0 else 3)
+
+    # Whatever is allocated next must not be the blocks still in use.
+    fill_sequence(manager, uid=2, num_blocks=manager.free_blocks[0].item(), value=20.0)
+    assert torch.equal(read_sequence(manager, kept), expected[kept])
+
+
+@pytest.mark.inference_v2
+def test_offload_shared_prefix() -> None:
+    manager = build_manager(num_blocks=8, prefix_caching=True)
+    expected_1 = share_prefix(manager)
+    expected_0 = read_sequence(manager, 0)
+    published = manager.get_sequence(0).all_block_ids(on_device=False).clone()
+
+    # The shared blocks stay allocated for the publisher, only the private block is freed.
+    manager.offload_sequence(1)
+    assert manager.get_sequence(1).kv_tier is KVTier.HOST
+    assert manager.free_blocks[0] == 5
+    assert manager.num_cached_prefix_blocks == 3
+
+    fill_sequence(manager, uid=2, num_blocks=5, value=20.0)
+    manager.flush_sequence(2)
+
+    # Sequence 1 comes back with private copies of the shared prefix.
+    manager.restore_sequence(1)
+    restored = manager.get_sequence(1).all_block_ids(on_device=False)
+    assert not any(block in published.tolist() for block in restored.tolist())
+    assert manager.free_blocks[0] == 2
+    assert torch.equal(read_sequence(manager, 1), expected_1)
+    assert torch.equal(manager.get_sequence(0).all_block_ids(on_device=False), published)
+    assert torch.equal(read_sequence(manager, 0), expected_0)
+
+    # A later sequence with the same prefix still shares the publisher's blocks.
+    manager.get_or_create_sequence(3)
+    manager.match_prefix(3, torch.arange(10))
+    assert torch.equal(manager.get_sequence(3).all_block_ids(on_device=False), published[:2])
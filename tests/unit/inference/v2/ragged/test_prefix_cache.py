@@ -0,0 +1,69 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+import pytest
+import torch
+
+from deepspeed.inference.v2.ragged.prefix_cache import PrefixCache
+
+BLOCK_SIZE = 4
+
+
+@pytest.mark.inference_v2
+def test_match_published_prefix() -> None:
+    cache = PrefixCache(BLOCK_SIZE)
+    prompt = torch.arange(10)
+
+    assert cache.match(0, prompt).numel() == 0
+    cache.append(0, prompt, torch.tensor([5, 6, 7], dtype=torch.int32))
+    assert cache.num_cached_blocks == 2
+
+    # Same first two blocks, the third differs.
+    matched = cache.match(1, torch.cat([prompt[:8], torch.tensor([42, 43])]))
+    assert matched.tolist() == [5, 6]
+
+    # A different first block shares nothing even if later tokens match.
+    assert cache.match(2, torch.cat([torch.tensor([9, 9, 9, 9]), prompt[4:]])).numel() == 0
+
+
+@pytest.mark.inference_v2
+def test_match_leaves_a_token() -> None:
+    cache = PrefixCache(BLOCK_SIZE)
+    prompt = torch.arange(8)
+    cache.append(0, prompt, torch.tensor([0, 1], dtype=torch.int32))
+
+    # Both blocks are cached but the last token has to be computed for its logits.
+    assert cache.match(1, prompt).tolist() == [0]
+
+
+@pytest.mark.inference_v2
+def test_incremental_append() -> None:
+    cache = PrefixCache(BLOCK_SIZE)
+    blocks = torch.tensor([3, 4], dtype=torch.int32)
+
+    cache.match(0, torch.arange(3))
+    cache.append(0, torch.arange(3), blocks)
+    assert cache.num_cached_blocks == 0
+
+    # Decode steps complete the first block one token at a time.
+    cache.append(0, torch.tensor([3]), blocks)
+    assert cache.num_cached_blocks == 1
+    assert cache.match(1, torch.arange(6)).tolist() == [3]
+
+
+@pytest.mark.inference_v2
+def test_release_last_user() -> None:
+    cache = PrefixCache(BLOCK_SIZE)
+    prompt = torch.arange(9)
+    cache.append(0, prompt, torch.tensor([0, 1, 2], dtype=torch.int32))
+    cache.match(1, prompt)
+
+    # Sequence 1 still uses blocks 0 and 1, only the private block is unused.
+    assert cache.release(torch.tensor([0, 1, 2])) == [2]
+    assert cache.num_cached_blocks == 2
+
+    assert cache.release(torch.tensor([0, 1, 7])) == [0, 1, 7]
+    assert cache.num_cached_blocks == 0
+    assert cache.match(2, prompt).numel() == 0
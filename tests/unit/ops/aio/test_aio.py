@@ -6,11 +6,13 @@
 import pytest
 import os
 import filecmp
+import time
 import torch
 import deepspeed
 import deepspeed.comm as dist
 from deepspeed.accelerator import get_accelerator
 from deepspeed.ops.op_builder import AsyncIOBuilder
+from deepspeed.runtime.swap_tensor.constants import AIO_PRIORITY_HIGH, AIO_PRIORITY_LOW
 from unit.common import DistributedTest
 
 KILO_BYTE = 1024
@@ -316,3 +318,246 @@ class TestAsyncQueue(DistributedTest):
 
             filecmp.clear_cache()
             assert filecmp.cmp(ref_files[i], aio_files[i], shallow=False)
+
+
+class TestAutoTune(DistributedTest):
+    world_size = 1
+    requires_cuda_env = False
+    if not get_accelerator().is_available():
+        init_distributed = False
+        set_dist_env = False
+
+    def test_tuner(self, tmpdir):
+        block_sizes = [BLOCK_SIZE * 4, BLOCK_SIZE * 8]
+        queue_depths = [1, QUEUE_DEPTH]
+        thread_counts = [1, IO_PARALLEL]
+        tuner = AsyncIOBuilder().load().aio_tuner(str(tmpdir), IO_SIZE * 16, block_sizes, queue_depths, thread_counts)
+
+        assert tuner.tune()
+        assert tuner.get_block_size() in block_sizes
+        assert tuner.get_queue_depth() in queue_depths
+        assert tuner.get_thread_count() in thread_counts
+        assert tuner.get_read_GB() > 0
+        assert tuner.get_write_GB() > 0
+        assert len(os.listdir(tmpdir)) == 0
+
+    def test_adaptive_queue_depth(self, tmpdir):
+        h = AsyncIOBuilder().load().aio_handle(BLOCK_SIZE, QUEUE_DEPTH, False, True, IO_PARALLEL)
+        assert not h.get_adaptive_queue_depth()
+        h.set_adaptive_queue_depth(True)
+        assert h.get_adaptive_queue_depth()
+
+        aio_buffer = h.new_cpu_locked_tensor(IO_SIZE, torch.empty(0, dtype=torch.uint8))
+        ref_file, _ = _do_ref_write(tmpdir)
+        for _ in range(4):
+            assert h.sync_pread(aio_buffer, ref_file) == 1
+            with open(ref_file, 'rb') as f:
+                assert list(f.read()) == aio_buffer.tolist()
+
+        h.free_cpu_locked_tensor(aio_buffer)
+
+
+class TestAutoTuneDistributed(DistributedTest):
+    world_size = 2
+    requires_cuda_env = False
+
+    def test_local_rank_zero_probes(self, monkeypatch, class_tmpdir):
+        from deepspeed.runtime.swap_tensor import aio_config
+        from deepspeed.runtime.swap_tensor.constants import (AIO_AUTO_TUNE, AIO_AUTO_TUNE_CACHE, AIO_BLOCK_SIZE,
+                                                             AIO_QUEUE_DEPTH, AIO_THREAD_COUNT)
+        monkeypatch.setattr(aio_config, 'AIO_TUNE_BLOCK_SIZES', [BLOCK_SIZE * 4])
+        monkeypatch.setattr(aio_config, 'AIO_TUNE_QUEUE_DEPTHS', [1, QUEUE_DEPTH])
+        monkeypatch.setattr(aio_config, 'AIO_TUNE_THREAD_COUNTS', [1])
+        monkeypatch.setattr(aio_config, 'AIO_TUNE_PROBE_BYTES', IO_SIZE * 16)
+
+        probes = []
+        tune_device = aio_config._tune_device
+        monkeypatch.setattr(aio_config, '_tune_device', lambda *args: probes.append(args) or tune_device(*args))
+
+        cache_file = os.path.join(class_tmpdir, 'aio_tune_cache.json')
+        swap_folder = os.path.join(class_tmpdir, f'rank{dist.get_rank()}')
+        os.makedirs(swap_folder, exist_ok=True)
+        shared_config = aio_config.get_aio_config({'aio': {AIO_AUTO_TUNE: True, AIO_AUTO_TUNE_CACHE: cache_file}})
+        untuned_config = dict(shared_config)
+        config = aio_config.autotune_aio_config(shared_config, swap_folder)
+
+        # The tuned values go to a copy, other swappers sharing the config still see the configured ones.
+        assert shared_config == untuned_config
+        assert len(probes) == (1 if dist.get_local_rank() == 0 else 0)
+        assert config[AIO_BLOCK_SIZE] == BLOCK_SIZE * 4
+        assert config[AIO_QUEUE_DEPTH] in [1, QUEUE_DEPTH]
+        assert config[AIO_THREAD_COUNT] == 1
+        # The cache was written atomically, no temporary files are left behind.
+        assert sorted(os.listdir(class_tmpdir)) == ['aio_tune_cache.json', 'rank0', 'rank1']
+
+
+class TestPriority(DistributedTest):
+    world_size = 1
+    requires_cuda_env = False
+    if not get_accelerator().is_available():
+        init_distributed = False
+        set_dist_env = False
+
+    def test_mixed_priorities(self, tmpdir):
+        h = AsyncIOBuilder().load().aio_handle(BLOCK_SIZE, QUEUE_DEPTH, False, True, IO_PARALLEL)
+        h.set_low_priority_bandwidth(IO_SIZE * 1024)
+        assert h.get_low_priority_bandwidth() == IO_SIZE * 1024
+
+        num_ops = 3
+        ref_files, read_buffers, write_buffers, write_files = [], [], [], []
+        for i in range(num_ops):
+            ref_file, ref_buffer = _do_ref_write(tmpdir, i)
+            ref_files.append(ref_file)
+            read_buffers.append(h.new_cpu_locked_tensor(IO_SIZE, torch.empty(0, dtype=torch.uint8)))
+            write_buffer = h.new_cpu_locked_tensor(IO_SIZE, torch.empty(0, dtype=torch.uint8))
+            write_buffer.copy_(torch.ByteTensor(list(ref_buffer)))
+            write_buffers.append(write_buffer)
+            write_files.append(_get_test_write_file(tmpdir, i))
+
+        # Low priority writes are queued first, high priority reads still run ahead of them.
+        for i in range(num_ops):
+            assert h.async_pwrite(write_buffers[i], write_files[i], priority=AIO_PRIORITY_LOW) == 0
+        for i in range(num_ops):
+            assert h.async_pread(read_buffers[i], ref_files[i], priority=AIO_PRIORITY_HIGH,
+                                 deadline_usec=1000) == 0
+        assert h.wait() == 2 * num_ops
+
+        for i in range(num_ops):
+            with open(ref_files[i], 'rb') as f:
+                assert list(f.read()) == read_buffers[i].tolist()
+            assert filecmp.cmp(ref_files[i], write_files[i], shallow=False)
+            h.free_cpu_locked_tensor(read_buffers[i])
+            h.free_cpu_locked_tensor(write_buffers[i])
+
+    def test_read_preempts_capped_write(self, tmpdir):
+        h = AsyncIOBuilder().load().aio_handle(BLOCK_SIZE, QUEUE_DEPTH, False, True, IO_PARALLEL)
+        # The cap stretches the write to about a second.
+        write_bytes = IO_SIZE * 256
+        h.set_low_priority_bandwidth(write_bytes)
+
+        write_buffer = h.new_cpu_locked_tensor(write_bytes, torch.empty(0, dtype=torch.uint8))
+        write_buffer.copy_(torch.randint(0, 256, (write_bytes, ), dtype=torch.uint8))
+        write_file = _get_test_write_file(tmpdir, 0)
+        ref_file, ref_buffer = _do_ref_write(tmpdir)
+        ref_tensor = torch.ByteTensor(list(ref_buffer))
+        read_buffer = h.new_cpu_locked_tensor(IO_SIZE, torch.empty(0, dtype=torch.uint8))
+        read_buffer.zero_()
+
+        start = time.time()
+        assert h.async_pwrite(write_buffer, write_file, priority=AIO_PRIORITY_LOW) == 0
+        time.sleep(0.1)
+        assert h.async_pread(read_buffer, ref_file, priority=AIO_PRIORITY_HIGH) == 0
+
+        # Reads into CPU tensors land in place, so the read shows up before wait() returns.
+        while not torch.equal(read_buffer, ref_tensor) and time.time() - start < 5:
+            time.sleep(0.01)
+        read_sec = time.time() - start
+        assert h.wait() == 2
+        write_sec = time.time() - start
+
+        # Behind the write in FIFO order, the read could not land before the write completed.
+        assert torch.equal(read_buffer, ref_tensor)
+        assert read_sec < write_sec / 2
+        with open(write_file, 'rb') as f:
+            assert list(f.read()) == write_buffer.tolist()
+
+        h.free_cpu_locked_tensor(write_buffer)
+        h.free_cpu_locked_tensor(read_buffer)
+
+
+class TestFileOffset(DistributedTest):
+    world_size = 1
+    requires_cuda_env = False
+    if not get_accelerator().is_available():
+        init_distributed = False
+        set_dist_env = False
+
+    def test_write_read(self, tmpdir):
+        h = AsyncIOBuilder().load().aio_handle(BLOCK_SIZE, QUEUE_DEPTH, False, True, IO_PARALLEL)
+        num_slots = 4
+        test_file = _get_test_write_file(tmpdir, 0)
+        with open(test_file, 'wb') as f:
+            f.truncate(num_slots * IO_SIZE)
+
+        refs = [torch.randint(0, 256, (IO_SIZE, ), dtype=torch.uint8) for _ in range(num_slots)]
+        buffer = h.new_cpu_locked_tensor(IO_SIZE, torch.empty(0, dtype=torch.uint8))
+        for slot in reversed(range(num_slots)):
+            buffer.copy_(refs[slot])
+            assert h.sync_pwrite(buffer, test_file, file_offset=slot * IO_SIZE) == 1
+
+        with open(test_file, 'rb') as f:
+            assert f.read() == b''.join(bytes(ref.tolist()) for ref in refs)
+
+        for slot in range(num_slots):
+            assert h.sync_pread(buffer, test_file, file_offset=slot * IO_SIZE) == 1
+            assert torch.equal(buffer, refs[slot])
+
+        assert h.sync_pread(buffer, test_file, file_offset=num_slots * IO_SIZE) == -1
+
+        h.free_cpu_locked_tensor(buffer)
+
+
+@pytest.mark.parametrize("buffer_dtype, file_dtype", [(torch.float32, torch.float16), (torch.float32, torch.bfloat16),
+                                                      (torch.float16, torch.float32)])
+class TestConvert(DistributedTest):
+    world_size = 1
+    requires_cuda_env = False
+    if not get_accelerator().is_available():
+        init_distributed = False
+        set_dist_env = False
+
+    def test_write_read(self, tmpdir, buffer_dtype, file_dtype):
+        h = AsyncIOBuilder().load().aio_handle(BLOCK_SIZE, QUEUE_DEPTH, False, True, IO_PARALLEL)
+        file_example = torch.empty(0, dtype=file_dtype)
+        num_elem = IO_SIZE * 4
+
+        ref_tensor = torch.randn(num_elem).to(buffer_dtype)
+        write_buffer = h.new_cpu_locked_tensor(num_elem, torch.empty(0, dtype=buffer_dtype))
+        write_buffer.copy_(ref_tensor)
+        test_file = _get_test_write_file(tmpdir, 0)
+        assert h.convert_pwrite(write_buffer, test_file, file_example, False) == 1
+
+        ref_file = os.path.join(tmpdir, 'ref.pt')
+        ref_tensor.to(file_dtype).view(torch.uint8).numpy().tofile(ref_file)
+        assert filecmp.cmp(ref_file, test_file, shallow=False)
+
+        read_buffer = h.new_cpu_locked_tensor(num_elem, torch.empty(0, dtype=buffer_dtype))
+        assert h.convert_pread(read_buffer, test_file, file_example, False) == 1
+        assert torch.equal(read_buffer, ref_tensor.to(file_dtype).to(buffer_dtype))
+
+        h.free_cpu_locked_tensor(write_buffer)
+        h.free_cpu_locked_tensor(read_buffer)
+
+
+@pytest.mark.parametrize("dtype", [torch.float32, torch.bfloat16, torch.int8])
+class TestCopy(DistributedTest):
+    world_size = 1
+    requires_cuda_env = False
+    if not get_accelerator().is_available():
+        init_distributed = False
+        set_dist_env = False
+
+    def test_memcpy(self, dtype):
+        aio_op = AsyncIOBuilder().load()
+        src = torch.randint(-100, 100, (IO_SIZE * 1024 + 3, ), dtype=torch.int32).to(dtype)
+        dest = torch.zeros_like(src)
+        assert aio_op.deepspeed_memcpy(dest, src) == 0
+        assert torch.equal(dest, src)
+
+        assert aio_op.deepspeed_memcpy(dest[:-1], src) == -1
+
+    def test_gather_scatter(self, dtype):
+        aio_op = AsyncIOBuilder().load()
+        numels = [IO_SIZE * 64 + 1, 7, IO_SIZE * 256]
+        srcs = [torch.randint(-100, 100, (n, ), dtype=torch.int32).to(dtype) for n in numels]
+        # Non-contiguous members take the copy_() path.
+        srcs.append(torch.randint(-100, 100, (16, 4), dtype=torch.int32).to(dtype).t())
+
+        buffer = torch.zeros(sum(t.numel() for t in srcs), dtype=dtype)
+        assert aio_op.deepspeed_memcpy_gather(buffer, srcs) == 0
+        assert torch.equal(buffer, torch.cat([t.flatten() for t in srcs]))
+
+        dests = [torch.zeros_like(t) for t in srcs]
+        assert aio_op.deepspeed_memcpy_scatter(dests, buffer) == 0
+        for dest, src in zip(dests, srcs):
+            assert torch.equal(dest, src)
@@ -0,0 +1,76 @@
+# Copyright (c) Microsoft Corporation.
+# SPDX-License-Identifier: Apache-2.0
+
+# DeepSpeed Team
+
+import pytest
+import torch
+from deepspeed.accelerator import get_accelerator
+
+# the CUDA kernels quantize from and reduce in half precision, these references follow the CPU ones
+if get_accelerator().device_name() != 'cpu':
+    pytest.skip("CPU quantizer tests", allow_module_level=True)
+
+builder = get_accelerator().create_op_builder("QuantizerBuilder")
+if not builder.is_compatible():
+    pytest.skip("Quantizer op is not available on this system", allow_module_level=True)
+
+quantizer_module = None
+
+
+def get_quantizer_module():
+    global quantizer_module
+    if quantizer_module is None:
+        quantizer_module = builder.load()
+    return quantizer_module
+
+
+def reference_quant_dequant(values, groups, q_bits):
+    # symmetric quantization as done by the kernels, returns what dequantize gives back
+    values = values.float().reshape(groups, -1)
+    abs_max = values.abs().amax(dim=1, keepdim=True)
+    scale = torch.where(abs_max == 0, torch.ones_like(abs_max), 2**q_bits / (2 * abs_max))
+    q = torch.clamp(torch.round(values * scale), -2**(q_bits - 1), 2**(q_bits - 1) - 1)
+    return (q / scale).flatten()
+
+
+def swizzle(chunks, nodes, devices_per_node):
+    # partition d * nodes + n of the output is partition n * devices_per_node + d of the input
+    return [chunks[n * devices_per_node + d] for d in range(devices_per_node) for n in range(nodes)]
+
+
+@pytest.mark.parametrize("q_bits", [4, 8])
+@pytest.mark.parametrize("nodes, devices_per_node", [(1, 4), (2, 2), (2, 4)])
+def test_swizzle_quant(q_bits, nodes, devices_per_node):
+    module = get_quantizer_module()
+    groups = nodes * devices_per_node * 4
+    values = torch.randn(groups * 64, dtype=torch.bfloat16)
+
+    quantized, scales = module.swizzle_quant(values, groups, q_bits, module.Symmetric, 1, nodes, devices_per_node)
+    assert quantized.numel() == values.numel() * q_bits // 8
+    assert scales.shape == (groups, 1)
+
+    result = module.dequantize_fp32(quantized, scales, groups, q_bits, module.Symmetric)
+    expected = reference_quant_dequant(values, groups, q_bits).chunk(nodes * devices_per_node)
+    expected = torch.cat(swizzle(expected, nodes, devices_per_node))
+    assert torch.allclose(result, expected, rtol=1e-5, atol=1e-6)
+
+
+@pytest.mark.parametrize("q_bits", [4, 8])
+@pytest.mark.parametrize("devices_per_node", [2, 4])
+def test_quantized_reduction(q_bits, devices_per_node):
+    module = get_quantizer_module()
+    in_groups = devices_per_node * 8
+    out_groups = 4
+    values = torch.randn(in_groups * 128)
+
+    quantized, scales = module.swizzle_quant(values, in_groups, q_bits, module.Symmetric, 1, 1, devices_per_node)
+    inputs = module.dequantize_fp32(quantized, scales, in_groups, q_bits, module.Symmetric)
+    reduced, reduced_scales = module.quantized_reduction(quantized, scales, in_groups, out_groups, q_bits,
+                                                         module.Symmetric, devices_per_node)
+    assert reduced.numel() == quantized.numel() // devices_per_node
+    assert reduced_scales.shape == (out_groups, 1)
+
+    result = module.dequantize_fp32(reduced, reduced_scales, out_groups, q_bits, module.Symmetric)
+    expected = reference_quant_dequant(sum(inputs.chunk(devices_per_node)), out_groups, q_bits)
+    assert torch.allclose(result, expected, rtol=1e-4, atol=1e-5)